@@ -10,6 +10,7 @@ public class Catnip : ModuleRules
 
         PrecompileForTargets = PrecompileTargetsType.Any;
         PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore" });
+        PrivateDependencyModuleNames.AddRange(new string[] { "RenderCore", "Slate", "SlateCore" });
 
         if (Target.Type == TargetRules.TargetType.Editor)
         {
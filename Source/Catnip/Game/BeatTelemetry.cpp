@@ -0,0 +1,371 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BeatTelemetry.h"
+
+#include "Async/Async.h"
+#include "Misc/Paths.h"
+#include "Misc/FileHelper.h"
+#include "HAL/IConsoleManager.h"
+#include "GameFramework/InputSettings.h"
+#include "Framework/Application/SlateApplication.h"
+#include "Framework/Application/IInputProcessor.h"
+
+static FAutoConsoleCommand BeatTimingStatsCommand(TEXT("Catnip.BeatTimingStats"),
+	TEXT("Logs the action latency and beat timing error histograms and writes them to Saved/Logs/CatnipBeatTiming.csv."),
+	FConsoleCommandDelegate::CreateLambda([]() { FBeatTelemetry::Get().Export(); }));
+
+namespace
+{
+	// Milliseconds covered by the histograms. Timing error is signed, latency isn't.
+	constexpr float ErrorRange = 200.0f;
+	constexpr float LatencyRange = 100.0f;
+
+	// An input older than this when an action is dispatched belongs to something else.
+	constexpr double MaxInputAge = 0.5;
+
+	const TCHAR *JudgementNames[] = { TEXT("Ignored"), TEXT("Success"), TEXT("Fail") };
+	const TCHAR *LatencyNames[] = { TEXT("InputToDispatch"), TEXT("DispatchToJudged"), TEXT("JudgedToBroadcast"),
+		TEXT("BroadcastToAudio"), TEXT("InputToAudio") };
+
+	float CyclesToMs(uint64 From, uint64 To)
+	{
+		return From != 0 && To >= From ? float(FPlatformTime::ToMilliseconds64(To - From)) : -1.0f;
+	}
+
+	/** Stamps key presses bound to Action as Slate pumps them, before they wait for the player controller. */
+	class FBeatInputProcessor : public IInputProcessor
+	{
+	public:
+		explicit FBeatInputProcessor(TArray<FKey> &&InKeys)
+			: Keys(MoveTemp(InKeys))
+		{
+		}
+
+		virtual void Tick(const float DeltaTime, FSlateApplication &SlateApp, TSharedRef<ICursor> Cursor) override
+		{
+		}
+
+		virtual bool HandleKeyDownEvent(FSlateApplication &SlateApp, const FKeyEvent &InKeyEvent) override
+		{
+			if (!InKeyEvent.IsRepeat())
+			{
+				this->Stamp(InKeyEvent.GetKey());
+			}
+			return false;
+		}
+
+		virtual bool HandleMouseButtonDownEvent(FSlateApplication &SlateApp, const FPointerEvent &MouseEvent) override
+		{
+			this->Stamp(MouseEvent.GetEffectingButton());
+			return false;
+		}
+
+	private:
+		void Stamp(const FKey &Key)
+		{
+			if (this->Keys.Contains(Key))
+			{
+				FBeatTelemetry::Get().SetInputCycles(FPlatformTime::Cycles64());
+			}
+		}
+
+		TArray<FKey> Keys;
+	};
+}
+
+void FBeatHistogram::Init(float InMin, float InMax)
+{
+	*this = FBeatHistogram();
+	this->Min = InMin;
+	this->BinWidth = (InMax - InMin) / NumBins;
+}
+
+void FBeatHistogram::Add(float Value)
+{
+	const int32 Bin = FMath::FloorToInt((Value - this->Min) / this->BinWidth);
+	if (Bin < 0)
+	{
+		++this->Under;
+	}
+	else if (Bin >= NumBins)
+	{
+		++this->Over;
+	}
+	else
+	{
+		++this->Bins[Bin];
+	}
+	this->MinValue = this->Count > 0 ? FMath::Min(this->MinValue, Value) : Value;
+	this->MaxValue = this->Count > 0 ? FMath::Max(this->MaxValue, Value) : Value;
+	this->Sum += Value;
+	++this->Count;
+}
+
+float FBeatHistogram::GetPercentile(float Fraction) const
+{
+	if (this->Count == 0)
+	{
+		return 0.0f;
+	}
+	const float Target = Fraction * this->Count;
+	float Seen = float(this->Under);
+	if (Seen >= Target)
+	{
+		return this->MinValue;
+	}
+	for (int32 i = 0; i < NumBins; ++i)
+	{
+		if (Seen + this->Bins[i] >= Target)
+		{
+			return this->Min + this->BinWidth * (i + (Target - Seen) / this->Bins[i]);
+		}
+		Seen += this->Bins[i];
+	}
+	return this->MaxValue;
+}
+
+FBeatTelemetry &FBeatTelemetry::Get()
+{
+	static FBeatTelemetry Instance;
+	return Instance;
+}
+
+FBeatTelemetry::FBeatTelemetry()
+	: WriteIndex(0), ReadIndex(0), bDraining(false), bDrainQueued(false), NumDropped(0), LastInputCycles(0), bActionPending(false), NumEvents(0)
+{
+	this->ResetHistograms();
+}
+
+void FBeatTelemetry::BeginRun()
+{
+	check(IsInGameThread());
+	if (!this->InputProcessor.IsValid() && FSlateApplication::IsInitialized())
+	{
+		TArray<FKey> Keys;
+		for (const FInputActionKeyMapping &Mapping : UInputSettings::GetInputSettings()->ActionMappings)
+		{
+			if (Mapping.ActionName == TEXT("Action"))
+			{
+				Keys.AddUnique(Mapping.Key);
+			}
+		}
+		this->InputProcessor = MakeShared<FBeatInputProcessor>(MoveTemp(Keys));
+		FSlateApplication::Get().RegisterInputPreProcessor(this->InputProcessor);
+	}
+
+	this->Lock(true);
+	this->DrainLocked();
+	this->ResetHistograms();
+	this->Unlock();
+	this->NumDropped = 0;
+	this->LastInputCycles = 0;
+	this->bActionPending = false;
+}
+
+void FBeatTelemetry::EndRun()
+{
+	if (this->NumEvents > 0 || this->WriteIndex.Load() != this->ReadIndex.Load())
+	{
+		this->Export();
+	}
+	this->bActionPending = false;
+
+	if (this->InputProcessor.IsValid())
+	{
+		if (FSlateApplication::IsInitialized())
+		{
+			FSlateApplication::Get().UnregisterInputPreProcessor(this->InputProcessor);
+		}
+		this->InputProcessor.Reset();
+	}
+}
+
+void FBeatTelemetry::BeginAction()
+{
+	this->Pending = FBeatTimingEvent();
+	this->Pending.DispatchCycles = FPlatformTime::Cycles64();
+	if (this->LastInputCycles != 0 && FPlatformTime::ToSeconds64(this->Pending.DispatchCycles - this->LastInputCycles) <= MaxInputAge)
+	{
+		this->Pending.InputCycles = this->LastInputCycles;
+	}
+	this->LastInputCycles = 0;
+	this->bActionPending = true;
+}
+
+void FBeatTelemetry::MarkJudged(EBeatJudgement Judgement, int32 BeatIndex, float ErrorDistance)
+{
+	if (this->bActionPending)
+	{
+		this->Pending.JudgedCycles = FPlatformTime::Cycles64();
+		this->Pending.Judgement = Judgement;
+		this->Pending.BeatIndex = BeatIndex;
+		this->Pending.TimingError = ErrorDistance;
+	}
+}
+
+void FBeatTelemetry::MarkBroadcast()
+{
+	if (this->bActionPending && this->Pending.BroadcastCycles == 0)
+	{
+		this->Pending.BroadcastCycles = FPlatformTime::Cycles64();
+	}
+}
+
+void FBeatTelemetry::MarkAudioSubmit()
+{
+	if (this->bActionPending && this->Pending.AudioCycles == 0)
+	{
+		this->Pending.AudioCycles = FPlatformTime::Cycles64();
+	}
+}
+
+void FBeatTelemetry::EndAction(float Speed)
+{
+	if (!this->bActionPending)
+	{
+		return;
+	}
+	this->bActionPending = false;
+	this->Pending.TimingError = Speed > 0.0f ? this->Pending.TimingError / Speed : 0.0f;
+	this->Push(this->Pending);
+}
+
+void FBeatTelemetry::Push(const FBeatTimingEvent &Event)
+{
+	const uint32 Write = this->WriteIndex.Load(EMemoryOrder::Relaxed);
+	const uint32 Used = Write - this->ReadIndex.Load();
+	if (Used >= Capacity)
+	{
+		++this->NumDropped;
+		return;
+	}
+	this->Events[Write % Capacity] = Event;
+	this->WriteIndex.Store(Write + 1);
+
+	// Drain well before the ring fills, off the game thread. One drain is queued at a time, the pushes until it runs
+	// are picked up by it.
+	if (Used + 1 >= Capacity / 2 && !this->bDraining.Load(EMemoryOrder::Relaxed) && !this->bDrainQueued.Exchange(true))
+	{
+		AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [this]()
+		{
+			if (this->Lock(false))
+			{
+				this->DrainLocked();
+				this->Unlock();
+			}
+			this->bDrainQueued = false;
+		});
+	}
+}
+
+bool FBeatTelemetry::Lock(bool bWait)
+{
+	bool bExpected = false;
+	while (!this->bDraining.CompareExchange(bExpected, true))
+	{
+		if (!bWait)
+		{
+			return false;
+		}
+		bExpected = false;
+		FPlatformProcess::Yield();
+	}
+	return true;
+}
+
+void FBeatTelemetry::Unlock()
+{
+	this->bDraining = false;
+}
+
+void FBeatTelemetry::DrainLocked()
+{
+	const uint32 Write = this->WriteIndex.Load();
+	for (uint32 Read = this->ReadIndex.Load(EMemoryOrder::Relaxed); Read != Write; ++Read)
+	{
+		const FBeatTimingEvent &Event = this->Events[Read % Capacity];
+		if (Event.BeatIndex != INDEX_NONE)
+		{
+			this->ErrorHistograms[int32(Event.Judgement)].Add(Event.TimingError * 1000.0f);
+		}
+
+		const float Latency[] = {
+			CyclesToMs(Event.InputCycles, Event.DispatchCycles),
+			CyclesToMs(Event.DispatchCycles, Event.JudgedCycles),
+			CyclesToMs(Event.JudgedCycles, Event.BroadcastCycles),
+			CyclesToMs(Event.BroadcastCycles, Event.AudioCycles),
+			CyclesToMs(Event.InputCycles, Event.AudioCycles)
+		};
+		static_assert(ARRAY_COUNT(Latency) == int32(EBeatLatency::Num), "A latency is missing.");
+		for (int32 i = 0; i < int32(EBeatLatency::Num); ++i)
+		{
+			if (Latency[i] >= 0.0f)
+			{
+				this->LatencyHistograms[i].Add(Latency[i]);
+			}
+		}
+		++this->NumEvents;
+
+		// Hand each slot back as soon as it's read.
+		this->ReadIndex.Store(Read + 1);
+	}
+}
+
+void FBeatTelemetry::ResetHistograms()
+{
+	for (FBeatHistogram &Histogram : this->ErrorHistograms)
+	{
+		Histogram.Init(-ErrorRange, ErrorRange);
+	}
+	for (FBeatHistogram &Histogram : this->LatencyHistograms)
+	{
+		Histogram.Init(0.0f, LatencyRange);
+	}
+	this->NumEvents = 0;
+}
+
+void FBeatTelemetry::Export()
+{
+	this->Lock(true);
+	this->DrainLocked();
+
+	UE_LOG(LogTemp, Log, TEXT("Beat timing: %d actions, %d dropped."), this->NumEvents, this->NumDropped.Load());
+	FString Csv = TEXT("Histogram,Samples,Mean,P50,P95,Min,Max,Under");
+	for (int32 i = 0; i < FBeatHistogram::NumBins; ++i)
+	{
+		Csv += FString::Printf(TEXT(",Bin%d"), i);
+	}
+	Csv += TEXT(",Over\n");
+
+	auto Write = [&Csv](const FString &Name, const FBeatHistogram &Histogram)
+	{
+		const float Mean = Histogram.Count > 0 ? float(Histogram.Sum / Histogram.Count) : 0.0f;
+		UE_LOG(LogTemp, Log, TEXT("  %-24s %5d samples, mean %7.2f ms, p50 %7.2f, p95 %7.2f, min %7.2f, max %7.2f."), *Name,
+			Histogram.Count, Mean, Histogram.GetPercentile(0.5f), Histogram.GetPercentile(0.95f), Histogram.MinValue, Histogram.MaxValue);
+
+		// Bins differ between histograms, so each row names its own start and width.
+		Csv += FString::Printf(TEXT("%s [%g ms + %g ms bins],%d,%.3f,%.3f,%.3f,%.3f,%.3f,%d"), *Name, Histogram.Min, Histogram.BinWidth,
+			Histogram.Count, Mean, Histogram.GetPercentile(0.5f), Histogram.GetPercentile(0.95f), Histogram.MinValue, Histogram.MaxValue, Histogram.Under);
+		for (int32 Bin : Histogram.Bins)
+		{
+			Csv += FString::Printf(TEXT(",%d"), Bin);
+		}
+		Csv += FString::Printf(TEXT(",%d\n"), Histogram.Over);
+	};
+	for (int32 i = 0; i < int32(EBeatJudgement::Num); ++i)
+	{
+		Write(FString::Printf(TEXT("Error%s"), JudgementNames[i]), this->ErrorHistograms[i]);
+	}
+	for (int32 i = 0; i < int32(EBeatLatency::Num); ++i)
+	{
+		Write(LatencyNames[i], this->LatencyHistograms[i]);
+	}
+	this->Unlock();
+
+	const FString FileName = FPaths::ProjectLogDir() / TEXT("CatnipBeatTiming.csv");
+	if (!FFileHelper::SaveStringToFile(Csv, *FileName))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write %s."), *FileName);
+	}
+}
@@ -0,0 +1,134 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Level/RingSim.h"
+#include "Templates/Atomic.h"
+
+#define CATNIP_BEAT_TELEMETRY !UE_BUILD_SHIPPING
+
+class IInputProcessor;
+
+/** Steps of the timing chain measured from one timestamp to the next. */
+enum class EBeatLatency : uint8
+{
+	InputToDispatch, DispatchToJudged, JudgedToBroadcast, BroadcastToAudio, InputToAudio, Num
+};
+
+/** One action through the timing chain. Timestamps are in cycles, 0 for a step that didn't happen. */
+struct FBeatTimingEvent
+{
+	// Key pumped from the platform, then ACatCharacter::Action, RegisterAction's decision, the start of the
+	// success or fail broadcast and the feedback sound being submitted.
+	uint64 InputCycles = 0;
+	uint64 DispatchCycles = 0;
+	uint64 JudgedCycles = 0;
+	uint64 BroadcastCycles = 0;
+	uint64 AudioCycles = 0;
+
+	// Pawn distance from the judged beat ring, negative when early. Seconds once the action ends.
+	float TimingError = 0.0f;
+	int32 BeatIndex = INDEX_NONE;
+	EBeatJudgement Judgement = EBeatJudgement::Ignored;
+};
+
+/** Fixed width bins over a range, counting what falls either side. */
+struct FBeatHistogram
+{
+	static constexpr int32 NumBins = 40;
+
+	float Min = 0.0f;
+	float BinWidth = 1.0f;
+	int32 Bins[NumBins] = {};
+	int32 Under = 0;
+	int32 Over = 0;
+
+	int32 Count = 0;
+	double Sum = 0.0;
+	float MinValue = 0.0f;
+	float MaxValue = 0.0f;
+
+	void Init(float InMin, float InMax);
+
+	void Add(float Value);
+
+	// Value below which the given fraction of samples fall, interpolated within its bin.
+	float GetPercentile(float Fraction) const;
+};
+
+/**
+ * Times every action from the key press to the feedback sound, and how far from its beat it was judged.
+ * The game thread pushes finished actions into a lock-free ring. They are drained into histograms on a background
+ * thread as it fills, and written to Saved/Logs/CatnipBeatTiming.csv when the run ends or Catnip.BeatTimingStats runs.
+ * The earliest timestamp available is when Slate pumps the key from the platform, so OS and device latency isn't included.
+ */
+class CATNIP_API FBeatTelemetry
+{
+public:
+	static FBeatTelemetry &Get();
+
+	// Starts listening for the keys bound to Action and clears the histograms.
+	void BeginRun();
+
+	// Exports what the run recorded and stops listening for keys.
+	void EndRun();
+
+	// Called along the chain on the game thread. Steps outside an action are ignored, like beats missed without one.
+	void BeginAction();
+
+	void MarkJudged(EBeatJudgement Judgement, int32 BeatIndex, float ErrorDistance);
+
+	void MarkBroadcast();
+
+	void MarkAudioSubmit();
+
+	// Speed turns the distance from the beat into time.
+	void EndAction(float Speed);
+
+	// Drains what is left and writes the histograms.
+	void Export();
+
+	FORCEINLINE void SetInputCycles(uint64 Cycles)
+	{
+		this->LastInputCycles = Cycles;
+	}
+
+private:
+	FBeatTelemetry();
+
+	void Push(const FBeatTimingEvent &Event);
+
+	// Only one thread drains or reads the histograms at a time. Returns false if another is, unless told to wait for it.
+	bool Lock(bool bWait);
+
+	void Unlock();
+
+	void DrainLocked();
+
+	void ResetHistograms();
+
+private:
+	static constexpr uint32 Capacity = 1024;
+
+	// Single producer, the game thread, and a single drainer at a time.
+	FBeatTimingEvent Events[Capacity];
+	TAtomic<uint32> WriteIndex;
+	TAtomic<uint32> ReadIndex;
+	TAtomic<bool> bDraining;
+	TAtomic<bool> bDrainQueued;
+	TAtomic<int32> NumDropped;
+
+	// Written by the input processor, on the game thread like the rest of the chain.
+	uint64 LastInputCycles;
+
+	FBeatTimingEvent Pending;
+	bool bActionPending;
+
+	TSharedPtr<IInputProcessor> InputProcessor;
+
+	// Owned by whoever is draining.
+	FBeatHistogram ErrorHistograms[int32(EBeatJudgement::Num)];
+	FBeatHistogram LatencyHistograms[int32(EBeatLatency::Num)];
+	int32 NumEvents;
+};
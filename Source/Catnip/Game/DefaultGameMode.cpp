@@ -4,28 +4,69 @@
 #include "DefaultGameMode.h"
 
 #include "Level/Ring.h"
+#include "Misc/Paths.h"
 #include "Engine/World.h"
+#include "Level/RingTrace.h"
+#include "Level/TrackData.h"
 #include "Level/RingHandler.h"
+#include "Game/BeatTelemetry.h"
+#include "Level/RingTrackGraph.h"
 #include "Player/CatCharacter.h"
+#include "Level/TrackManifest.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/AssetManager.h"
 #include "Camera/CameraComponent.h"
 #include "Kismet/GameplayStatics.h"
-#include "UObject/ConstructorHelpers.h"
+#include "Materials/MaterialInterface.h"
+#include "Game/FeedbackSoundComponent.h"
+#include "Components/SkeletalMeshComponent.h"
 #include "GameFramework/SpringArmComponent.h"
+#include "GameFramework/CharacterMovementComponent.h"
 
 #if WITH_EDITOR
 #include "EditorLevelLibrary.h"
 #include "Camera/PlayerCameraManager.h"
 #endif
 
-ADefaultGameMode::ADefaultGameMode()
+static void ResetRunCommand(UWorld *World)
+{
+	ADefaultGameMode *GameMode = World != nullptr ? World->GetAuthGameMode<ADefaultGameMode>() : nullptr;
+	if (GameMode != nullptr)
+	{
+		GameMode->ResetRun();
+	}
+}
+
+static FAutoConsoleCommandWithWorld ResetRunConsoleCommand(TEXT("Catnip.ResetRun"),
+	TEXT("Starts the current run over without reloading the map."),
+	FConsoleCommandWithWorldDelegate::CreateStatic(&ResetRunCommand));
+
+static void RewindCommand(const TArray<FString> &Args, UWorld *World)
 {
-	static ConstructorHelpers::FClassFinder<APawn> PawnClass(TEXT("/Game/Blueprints/Player/BP_CatCharacter"));
-	if (PawnClass.Class != nullptr)
+	ADefaultGameMode *GameMode = World != nullptr ? World->GetAuthGameMode<ADefaultGameMode>() : nullptr;
+	if (GameMode != nullptr)
 	{
-		Super::DefaultPawnClass = PawnClass.Class;
+		GameMode->Rewind(Args.Num() > 0 ? FCString::Atof(*Args[0]) : 3.0f);
 	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs RewindConsoleCommand(TEXT("Catnip.Rewind"),
+	TEXT("Rewinds a practice run by the given seconds, 3 by default."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&RewindCommand));
+
+namespace
+{
+	// Steps per second the rewind buffer is sized for. Faster frame rates cover less time.
+	constexpr float RewindStepRate = 120.0f;
+}
+
+ADefaultGameMode::ADefaultGameMode()
+{
+	this->PawnClass = TSoftClassPtr<ACatCharacter>(FSoftObjectPath(TEXT("/Game/Blueprints/Player/BP_CatCharacter.BP_CatCharacter_C")));
+	this->GhostClass = nullptr;
 
 	this->LifeCount = 9;
+	this->StartLifeCount = 9;
 
 	this->MovementSpeed = 1600.0f;
 	//this->CurrentDistance = -5250.0f;
@@ -34,6 +75,23 @@ ADefaultGameMode::ADefaultGameMode()
 
 	this->PlayerOffsetCache = FVector::ZeroVector;
 
+	this->bPreloading = false;
+	this->PreloadStartTime = 0.0;
+
+	this->bRecordGhost = true;
+	this->GhostMaterial = nullptr;
+	this->Ghost = nullptr;
+	this->RunTime = 0.0;
+	this->bActionThisStep = false;
+	this->GhostOffsetCache = FVector::ZeroVector;
+
+	this->bPracticeMode = false;
+	this->RewindBufferSeconds = 10.0f;
+	this->RewindHead = 0;
+	this->RewindCount = 0;
+
+	this->FeedbackSounds = UObject::CreateDefaultSubobject<UFeedbackSoundComponent>(TEXT("FeedbackSounds"));
+
 	Super::bStartPlayersAsSpectators = true;
 	Super::PrimaryActorTick.bCanEverTick = true;
 }
@@ -42,50 +100,516 @@ void ADefaultGameMode::BeginPlay()
 {
 	Super::BeginPlay();
 
+	this->StartLifeCount = this->LifeCount;
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().BeginRun();
+#endif
+#if CATNIP_RING_TRACE
+	FRingTrace::Get().BeginRun();
+#endif
+
 	TArray<AActor*> TempArray;
 
-	// Destroy all exisiting rings.
+	// Destroy all exisiting rings. Those owned by the ring handler are its pool.
 	UGameplayStatics::GetAllActorsOfClass(Super::GetWorld(), ARing::StaticClass(), TempArray);
 	for (int32 i = TempArray.Num() - 1; i >= 0; --i)
 	{
-		if (TempArray[i] != nullptr)
+		if (TempArray[i] != nullptr && TempArray[i]->GetOwner() == nullptr)
 		{
 			TempArray[i]->Destroy();
 		}
 	}
 }
 
+void ADefaultGameMode::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	this->StopGhostRecording();
+	this->StopGhostPlayback();
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().EndRun();
+#endif
+#if CATNIP_RING_TRACE
+	FRingTrace::Get().EndRun();
+#endif
+
+	Super::EndPlay(EndPlayReason);
+}
+
 void ADefaultGameMode::FindRingHandler()
 {
 	TArray<AActor*> TempArray;
 
-	// Set the ring handler. It should already be placed in-world.
-	UGameplayStatics::GetAllActorsOfClass(Super::GetWorld(), ARingHandler::StaticClass(), TempArray);
-	if (ensure(TempArray.Num() == 1))
+	// A track graph spawns the handlers of its segments. Otherwise the ring handler should already be placed in-world.
+	UGameplayStatics::GetAllActorsOfClass(Super::GetWorld(), ARingTrackGraph::StaticClass(), TempArray);
+	if (TempArray.Num() > 0)
 	{
+		ensure(TempArray.Num() == 1);
+		this->TrackGraph = Cast<ARingTrackGraph>(TempArray[0]);
+		this->TrackGraph->OnBeatRingFail.AddDynamic(this, &ADefaultGameMode::OnBeatRingFail);
+		this->TrackGraph->OnBeatRingSuccess.AddDynamic(this, &ADefaultGameMode::OnBeatRingSuccess);
+		this->RingHandler = this->TrackGraph->StartGraph();
+		if (!ensure(this->RingHandler != nullptr))
+		{
+			return;
+		}
+	}
+	else
+	{
+		UGameplayStatics::GetAllActorsOfClass(Super::GetWorld(), ARingHandler::StaticClass(), TempArray);
+		if (!ensure(TempArray.Num() == 1))
+		{
+			return;
+		}
 		this->RingHandler = Cast<ARingHandler>(TempArray[0]);
 
 		this->RingHandler->OnBeatRingFail.AddDynamic(this, &ADefaultGameMode::OnBeatRingFail);
 		this->RingHandler->OnBeatRingSuccess.AddDynamic(this, &ADefaultGameMode::OnBeatRingSuccess);
+	}
+
+	this->CurrentDistance = -this->RingHandler->GetFadeDistance();
+
+	if (this->bPracticeMode)
+	{
+		this->RewindFrames.SetNum(FMath::CeilToInt(this->RewindBufferSeconds * RewindStepRate));
+		if (this->TrackGraph != nullptr)
+		{
+			this->TrackGraph->SetRewindDistance(this->RewindBufferSeconds * this->MovementSpeed);
+		}
+		else
+		{
+			this->RingHandler->SetRewindDistance(this->RewindBufferSeconds * this->MovementSpeed);
+		}
+	}
+
+	this->StartPreload();
+}
+
+UClass *ADefaultGameMode::GetDefaultPawnClassForController_Implementation(AController *InController)
+{
+	// Already loaded once the preload is done, so this only resolves it.
+	UClass *Class = this->PawnClass.LoadSynchronous();
+	return Class != nullptr ? Class : Super::GetDefaultPawnClassForController_Implementation(InController);
+}
+
+void ADefaultGameMode::CollectRunAssets(TArray<FSoftObjectPath> &OutAssets) const
+{
+	if (!this->PawnClass.IsNull())
+	{
+		OutAssets.AddUnique(this->PawnClass.ToSoftObjectPath());
+	}
+	this->FeedbackSounds->CollectAssets(OutAssets);
+}
+
+void ADefaultGameMode::StartPreload()
+{
+	check(this->RingHandler != nullptr);
+
+	// The game mode's own assets are added too, in case the manifest was generated before they were soft.
+	TArray<FSoftObjectPath> Assets;
+	UTrackManifest *Manifest = this->RingHandler->GetTrackManifest();
+	if (Manifest != nullptr)
+	{
+		Manifest->GetAssetsToLoad(Assets);
+	}
+	this->CollectRunAssets(Assets);
+	if (Assets.Num() == 0)
+	{
+		this->OnPreloadFinished();
+		return;
+	}
 
-		this->CurrentDistance = -this->RingHandler->GetFadeDistance();
+	// Request everything in one batch. The handle keeps the assets referenced for the rest of the run.
+	this->bPreloading = true;
+	this->PreloadStartTime = FPlatformTime::Seconds();
+	this->PreloadHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(Assets,
+		FStreamableDelegate::CreateUObject(this, &ADefaultGameMode::OnPreloadFinished), FStreamableManager::AsyncLoadHighPriority);
+	if (!this->PreloadHandle.IsValid())
+	{
+		this->OnPreloadFinished();
 	}
 }
 
+void ADefaultGameMode::OnPreloadFinished()
+{
+	if (this->PreloadHandle.IsValid())
+	{
+		UE_LOG(LogTemp, Log, TEXT("Track preload finished in %.1f ms."), (FPlatformTime::Seconds() - this->PreloadStartTime) * 1000.0);
+	}
+	this->bPreloading = false;
+	this->RingHandler->FillRingActorPool();
+	this->FeedbackSounds->PrepareSounds();
+	this->RunTime = 0.0;
+	this->StartGhostRecording();
+	this->OnPreloadCompleted();
+}
+
+void ADefaultGameMode::ResetRun()
+{
+	if (!ensure(this->RingHandler != nullptr) || this->bPreloading)
+	{
+		return;
+	}
+	const double StartTime = FPlatformTime::Seconds();
+
+	this->StopGhostRecording();
+	if (this->TrackGraph != nullptr)
+	{
+		this->RingHandler = this->TrackGraph->ResetGraph();
+		if (!ensure(this->RingHandler != nullptr))
+		{
+			return;
+		}
+	}
+	else
+	{
+		this->RingHandler->ResetRun();
+	}
+
+	this->ResetRunState();
+	UE_LOG(LogTemp, Log, TEXT("Run reset in %.2f ms."), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	this->OnRunReset();
+}
+
+bool ADefaultGameMode::LoadTrack(UTrackData *Data)
+{
+	if (!ensure(this->RingHandler != nullptr) || this->bPreloading)
+	{
+		return false;
+	}
+	// A track graph loads the track of each of its segments itself.
+	if (this->TrackGraph != nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("LoadTrack can't replace the track of a track graph."));
+		return false;
+	}
+	const double StartTime = FPlatformTime::Seconds();
+
+	this->StopGhostRecording();
+	if (!this->RingHandler->LoadTrack(Data))
+	{
+		this->StartGhostRecording();
+		return false;
+	}
+
+	// A ghost of another track doesn't follow this one.
+	this->StopGhostPlayback();
+	this->ResetRunState();
+	UE_LOG(LogTemp, Log, TEXT("Run started on track %s in %.2f ms."), *Data->GetName(), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	this->OnRunReset();
+	return true;
+}
+
+void ADefaultGameMode::ResetRunState()
+{
+	this->LifeCount = this->StartLifeCount;
+	RING_TRACE(Counter, "Lives", 0, this->LifeCount);
+	this->FeedbackSounds->ResetStreak();
+	this->CurrentDistance = -this->RingHandler->GetFadeDistance();
+	this->RunTime = 0.0;
+	this->bActionThisStep = false;
+	this->PlayerOffsetCache = FVector::ZeroVector;
+	this->RewindHead = 0;
+	this->RewindCount = 0;
+
+	APlayerController *Controller = Super::GetWorld()->GetFirstPlayerController();
+	ACatCharacter *Character = Controller != nullptr ? Cast<ACatCharacter>(Controller->GetPawn()) : nullptr;
+	if (Character != nullptr)
+	{
+		const float SplineDistance = float(this->CurrentDistance - this->RingHandler->GetTrackDistanceBase());
+		Character->GetPlayerOffsetRef() = FVector::ZeroVector;
+		Character->SetTilt(FRotator::ZeroRotator);
+		Character->GetCharacterMovement()->StopMovementImmediately();
+		Character->SetActorLocationAndRotation(this->RingHandler->GetLocationAtDistance(SplineDistance),
+			this->RingHandler->GetRotationAtDistance(SplineDistance), false, nullptr, ETeleportType::ResetPhysics);
+	}
+
+	// Play the same ghost again from the start, keeping its actor.
+	if (this->Ghost != nullptr && !this->GhostPlaybackFile.IsEmpty())
+	{
+		this->StartGhostPlayback(this->GhostPlaybackFile);
+	}
+
+	this->StartGhostRecording();
+}
+
+bool ADefaultGameMode::Rewind(float Seconds)
+{
+	if (!this->bPracticeMode || !ensure(this->RingHandler != nullptr) || this->bPreloading || this->RewindCount == 0)
+	{
+		return false;
+	}
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 NumFrames = this->RewindFrames.Num();
+	const double TargetTime = this->RunTime - Seconds;
+	auto GetSplineDistance = [this](const FRunRewindFrame &Frame)
+	{
+		return float(Frame.Distance - this->RingHandler->GetTrackDistanceBase());
+	};
+
+	// Newest step at or before the target time, or the oldest one the ring window can still be rebuilt at.
+	int32 Age = INDEX_NONE;
+	for (int32 i = 0; i < this->RewindCount; ++i)
+	{
+		const FRunRewindFrame &Frame = this->RewindFrames[(this->RewindHead - 1 - i + NumFrames) % NumFrames];
+		if (!this->RingHandler->CanRewindTo(GetSplineDistance(Frame)))
+		{
+			break;
+		}
+		Age = i;
+		if (Frame.RunTime <= TargetTime)
+		{
+			break;
+		}
+	}
+	if (Age == INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Nothing to rewind to."));
+		return false;
+	}
+
+	// The restored step becomes the newest one kept.
+	this->RewindHead = (this->RewindHead - Age + NumFrames) % NumFrames;
+	this->RewindCount -= Age;
+	const FRunRewindFrame &Frame = this->RewindFrames[(this->RewindHead - 1 + NumFrames) % NumFrames];
+	const float SplineDistance = GetSplineDistance(Frame);
+	verify(this->RingHandler->RewindTo(Frame.Ring, SplineDistance));
+
+	this->StopGhostRecording();
+	const double RewoundSeconds = this->RunTime - Frame.RunTime;
+	this->RunTime = Frame.RunTime;
+	this->CurrentDistance = Frame.Distance;
+	this->LifeCount = Frame.LifeCount;
+	RING_TRACE(Counter, "Lives", 0, this->LifeCount);
+	this->bActionThisStep = false;
+	this->PlayerOffsetCache = Frame.PlayerOffset;
+
+	APlayerController *Controller = Super::GetWorld()->GetFirstPlayerController();
+	ACatCharacter *Character = Controller != nullptr ? Cast<ACatCharacter>(Controller->GetPawn()) : nullptr;
+	if (Character != nullptr)
+	{
+		const FRotator RailRotation = this->RingHandler->GetRotationAtDistance(SplineDistance);
+		Character->GetPlayerOffsetRef() = Frame.PlayerOffset;
+		Character->SetTilt(Frame.Tilt);
+		Character->GetCharacterMovement()->StopMovementImmediately();
+		Character->SetActorLocationAndRotation(this->RingHandler->GetLocationAtDistance(SplineDistance) + RailRotation.RotateVector(Frame.PlayerOffset),
+			RailRotation, false, nullptr, ETeleportType::ResetPhysics);
+	}
+
+	// Ghosts are played against run time, so the same ghost catches up from the start.
+	if (this->Ghost != nullptr && !this->GhostPlaybackFile.IsEmpty())
+	{
+		this->StartGhostPlayback(this->GhostPlaybackFile);
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Rewound %.2f s in %.2f ms."), RewoundSeconds, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	this->OnRewind();
+	return true;
+}
+
+bool ADefaultGameMode::ChooseBranch(bool bRight)
+{
+	if (this->TrackGraph == nullptr || this->bPreloading)
+	{
+		return false;
+	}
+	const int32 NumBranches = this->TrackGraph->GetNumBranches();
+	return NumBranches > 0 && this->TrackGraph->ChooseBranch(bRight ? NumBranches - 1 : 0);
+}
+
+void ADefaultGameMode::SaveRewindFrame(ACatCharacter *Character)
+{
+	if (this->RewindFrames.Num() == 0)
+	{
+		return;
+	}
+	FRunRewindFrame &Frame = this->RewindFrames[this->RewindHead];
+	Frame.RunTime = this->RunTime;
+	Frame.Distance = this->CurrentDistance;
+	Frame.PlayerOffset = Character != nullptr ? Character->GetPlayerOffsetRef() : FVector::ZeroVector;
+	Frame.Tilt = Character != nullptr ? Character->GetTilt() : FRotator::ZeroRotator;
+	Frame.LifeCount = this->LifeCount;
+	this->RingHandler->SaveRewindState(Frame.Ring);
+
+	this->RewindHead = (this->RewindHead + 1) % this->RewindFrames.Num();
+	this->RewindCount = FMath::Min(this->RewindCount + 1, this->RewindFrames.Num());
+}
+
+float ADefaultGameMode::GetPreloadProgress() const
+{
+	if (!this->bPreloading)
+	{
+		return 1.0f;
+	}
+	return this->PreloadHandle.IsValid() ? this->PreloadHandle->GetProgress() : 0.0f;
+}
+
+void ADefaultGameMode::StartGhostRecording()
+{
+	this->StopGhostRecording();
+
+	// Ghosts are recorded as distances along one track, which a track graph starts over on every segment.
+	if (!this->bRecordGhost || this->TrackGraph != nullptr)
+	{
+		return;
+	}
+
+	FString MapName = UGameplayStatics::GetCurrentLevelName(this, true);
+	FString FileName = FPaths::ProjectSavedDir() / TEXT("Ghosts") / FString::Printf(TEXT("%s_%s.ghost"), *MapName, *FDateTime::Now().ToString());
+	if (this->GhostWriter.Open(FileName))
+	{
+		this->GhostRecordingFile = FileName;
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not open %s for ghost recording."), *FileName);
+	}
+}
+
+void ADefaultGameMode::StopGhostRecording()
+{
+	if (this->GhostWriter.IsOpen())
+	{
+		UE_LOG(LogTemp, Log, TEXT("Ghost recorded to %s, %lld bytes."), *this->GhostRecordingFile, this->GhostWriter.GetNumBytes());
+		this->GhostWriter.Close();
+	}
+	this->GhostRecordingFile.Empty();
+}
+
+bool ADefaultGameMode::StartGhostPlayback(const FString &FileName)
+{
+	this->GhostReader.Reset();
+	UClass *Class = this->GhostClass != nullptr ? this->GhostClass.Get() : this->PawnClass.Get();
+	if (!ensure(this->RingHandler != nullptr) || Class == nullptr)
+	{
+		this->StopGhostPlayback();
+		return false;
+	}
+
+	FString Path = FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("Ghosts") / FileName : FileName;
+	TUniquePtr<FGhostReader> Reader = MakeUnique<FGhostReader>();
+	if (!Reader->Open(Path) || !Reader->Read(this->GhostNextStep))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not play ghost %s."), *Path);
+		this->StopGhostPlayback();
+		return false;
+	}
+	this->GhostPlaybackFile = Path;
+
+	// A ghost already on the rail is reused, as when a run is reset.
+	if (this->Ghost != nullptr)
+	{
+		this->GhostReader = MoveTemp(Reader);
+		this->GhostStep = this->GhostNextStep;
+		this->GhostOffsetCache = FVector::ZeroVector;
+		return true;
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	this->Ghost = Super::GetWorld()->SpawnActor<ACatCharacter>(Class, FTransform::Identity, SpawnParameters);
+	if (this->Ghost == nullptr)
+	{
+		this->GhostPlaybackFile.Empty();
+		return false;
+	}
+
+	// The rail moves the ghost. It must not collide with obstacles or fall.
+	this->Ghost->SetActorEnableCollision(false);
+	this->Ghost->GetCharacterMovement()->DisableMovement();
+	this->Ghost->GetCharacterMovement()->SetComponentTickEnabled(false);
+	if (this->GhostMaterial != nullptr)
+	{
+		USkeletalMeshComponent *Mesh = this->Ghost->GetMesh();
+		for (int32 i = 0; i < Mesh->GetNumMaterials(); ++i)
+		{
+			Mesh->SetMaterial(i, this->GhostMaterial);
+		}
+	}
+
+	this->GhostReader = MoveTemp(Reader);
+	this->GhostStep = this->GhostNextStep;
+	this->GhostOffsetCache = FVector::ZeroVector;
+	return true;
+}
+
+void ADefaultGameMode::StopGhostPlayback()
+{
+	this->GhostReader.Reset();
+	this->GhostPlaybackFile.Empty();
+	if (this->Ghost != nullptr)
+	{
+		this->Ghost->Destroy();
+		this->Ghost = nullptr;
+	}
+}
+
+void ADefaultGameMode::TickGhost(float DeltaTime)
+{
+	if (!this->GhostReader.IsValid() || this->Ghost == nullptr)
+	{
+		return;
+	}
+
+	// Consume every recorded step up to the current run time. The ghost stays at its last step once the recording ends.
+	while (this->GhostNextStep.Time <= this->RunTime)
+	{
+		this->GhostStep = this->GhostNextStep;
+		if (!this->GhostReader->Read(this->GhostNextStep))
+		{
+			this->GhostReader.Reset();
+			break;
+		}
+	}
+
+	double Distance = this->GhostStep.TrackDistance;
+	if (this->GhostReader.IsValid() && this->GhostNextStep.Time > this->GhostStep.Time)
+	{
+		double Alpha = (this->RunTime - this->GhostStep.Time) / (this->GhostNextStep.Time - this->GhostStep.Time);
+		Distance = FMath::Lerp(this->GhostStep.TrackDistance, this->GhostNextStep.TrackDistance, FMath::Clamp(Alpha, 0.0, 1.0));
+	}
+	const float SplineDistance = float(Distance - this->RingHandler->GetTrackDistanceBase());
+
+	FVector Offset(0.0f, this->GhostStep.PlayerOffset.X, this->GhostStep.PlayerOffset.Y);
+	this->MoveAlongRail(this->Ghost, this->RingHandler->GetLocationAtDistance(SplineDistance), this->RingHandler->GetRotationAtDistance(SplineDistance),
+		Offset, this->GhostOffsetCache, DeltaTime);
+	this->Ghost->SetTilt(this->GhostStep.Tilt);
+}
+
+void ADefaultGameMode::MoveAlongRail(ACatCharacter *Character, const FVector &RailLocation, const FRotator &RailRotation, const FVector &Offset,
+	FVector &OffsetCache, float DeltaTime) const
+{
+	// Interpolate offset.
+	if (OffsetCache.IsNearlyZero())
+	{
+		OffsetCache = Offset;
+	}
+	OffsetCache = FMath::VInterpTo(OffsetCache, Offset, DeltaTime, this->InterpCharacterSpeed);
+
+	Character->SetActorLocationAndRotation(RailLocation + RailRotation.RotateVector(OffsetCache), RailRotation);
+}
+
 void ADefaultGameMode::OnBeatRingFail(int32 RingIndex)
 {
 	//UE_LOG(LogTemp, Log, TEXT("FAIL %d"), RingIndex);
 	--this->LifeCount;
+	RING_TRACE(Counter, "Lives", 0, this->LifeCount);
 
 	if (this->LifeCount == 0)
 	{
+		this->FeedbackSounds->PlayDeath();
+		this->StopGhostRecording();
 		this->OnGameFailed();
 	}
+	else
+	{
+		this->FeedbackSounds->PlayFail();
+	}
 }
 
 void ADefaultGameMode::OnBeatRingSuccess(int32 RingIndex)
 {
 	//UE_LOG(LogTemp, Log, TEXT("SUCCESS %d"), RingIndex);
+	this->FeedbackSounds->PlaySuccess();
 }
 
 void ADefaultGameMode::RegisterAction()
@@ -95,6 +619,10 @@ void ADefaultGameMode::RegisterAction()
 		return;
 	}
 	this->RingHandler->RegisterAction();
+	this->bActionThisStep = true;
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().EndAction(this->MovementSpeed);
+#endif
 
 	//APlayerController *Controller = Super::GetWorld()->GetFirstPlayerController();
 	//check(controller != nullptr);
@@ -139,12 +667,27 @@ void ADefaultGameMode::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
-	if (this->RingHandler == nullptr)
+	if (this->RingHandler == nullptr || this->bPreloading)
 	{
 		return;
 	}
 
+	this->RunTime += DeltaTime;
 	this->CurrentDistance += this->MovementSpeed * DeltaTime;
+	if (this->TrackGraph != nullptr)
+	{
+		const float PassedLength = this->TrackGraph->AdvanceGraph(float(this->CurrentDistance));
+		if (PassedLength > 0.0f)
+		{
+			// On to the next segment. Rewinds don't go back past the junction.
+			this->RingHandler = this->TrackGraph->GetActiveHandler();
+			this->CurrentDistance -= PassedLength;
+			this->RewindHead = 0;
+			this->RewindCount = 0;
+		}
+	}
+	RING_TRACE(Counter, "Distance", 0, this->CurrentDistance);
+	const float SplineDistance = float(this->CurrentDistance - this->RingHandler->GetTrackDistanceBase());
 
 	APlayerController *Controller = Super::GetWorld()->GetFirstPlayerController();
 
@@ -162,36 +705,46 @@ void ADefaultGameMode::Tick(float DeltaTime)
 	else
 #endif
 	{
-		LocationUpdate = this->RingHandler->GetLocationAtDistance(this->CurrentDistance);
+		LocationUpdate = this->RingHandler->GetLocationAtDistance(SplineDistance);
 	}
 
 	ACatCharacter *Character = Cast<ACatCharacter>(Controller->GetPawn());
 	if (Character != nullptr)
 	{
 		FRotator CharacterRotation = Character->GetActorRotation();
-		FRotator RotationUpdate = this->RingHandler->GetRotationAtDistance(this->CurrentDistance);
+		FRotator RotationUpdate = this->RingHandler->GetRotationAtDistance(SplineDistance);
 
 		float RadiusShrink = Character->GetSimpleCollisionRadius() * 2.0f;
 
 		// Restrict PlayerOffset.
 		FVector &PlayerOffset = Character->GetPlayerOffsetRef();
 		{
-			PlayerOffset = this->RingHandler->RestrictPositionOffset(LocationUpdate, PlayerOffset, RadiusShrink);
+			PlayerOffset = this->RingHandler->RestrictPositionOffset(SplineDistance, PlayerOffset, RadiusShrink);
 		}
 
-		// Interpolate PlayerOffset.
+		// Update character location and rotation.
+		this->MoveAlongRail(Character, LocationUpdate, RotationUpdate, PlayerOffset, this->PlayerOffsetCache, DeltaTime);
+
+		if (this->GhostWriter.IsOpen())
 		{
-			if (this->PlayerOffsetCache.IsNearlyZero())
-			{
-				this->PlayerOffsetCache = PlayerOffset;
-			}
-			this->PlayerOffsetCache = FMath::VInterpTo(this->PlayerOffsetCache, PlayerOffset, DeltaTime, this->InterpCharacterSpeed);
+			FGhostStep Step;
+			Step.Time = this->RunTime;
+			Step.TrackDistance = this->CurrentDistance;
+			Step.PlayerOffset = FVector2D(PlayerOffset.Y, PlayerOffset.Z);
+			Step.Tilt = Character->GetTilt();
+			Step.bAction = this->bActionThisStep;
+			this->GhostWriter.Write(Step);
 		}
-
-		// Update character location and rotation.
-		Character->SetActorLocationAndRotation(LocationUpdate + RotationUpdate.RotateVector(this->PlayerOffsetCache), RotationUpdate);
 	}
+	this->bActionThisStep = false;
 	//this->RingHandler->UpdatePawnLocation(LocationUpdate);
 
+	this->TickGhost(DeltaTime);
+
 	this->RingHandler->UpdateHandler(LocationUpdate);
+	if (this->TrackGraph != nullptr)
+	{
+		this->TrackGraph->UpdateBranches(SplineDistance);
+	}
+	this->SaveRewindFrame(Character);
 }
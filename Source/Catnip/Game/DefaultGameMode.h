@@ -3,10 +3,28 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Level/RingHandler.h"
+#include "Game/GhostRecording.h"
 #include "GameFramework/GameModeBase.h"
 #include "DefaultGameMode.generated.h"
 
-class ARingHandler;
+class ACatCharacter;
+class UTrackData;
+class ARingTrackGraph;
+class UMaterialInterface;
+class UFeedbackSoundComponent;
+struct FStreamableHandle;
+
+/** One step of a practice run, as much as a rewind puts back. */
+struct FRunRewindFrame
+{
+	double RunTime = 0.0;
+	double Distance = 0.0;
+	FVector PlayerOffset = FVector::ZeroVector;
+	FRotator Tilt = FRotator::ZeroRotator;
+	int32 LifeCount = 0;
+	FRingRewindState Ring;
+};
 
 /**
  * 
@@ -22,9 +40,17 @@ public:
 protected:
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:
 	virtual void Tick(float DeltaTime) override;
 
+	// The soft pawn class, loaded by the preload by the time the player is spawned.
+	virtual UClass *GetDefaultPawnClassForController_Implementation(AController *InController) override;
+
+	// Assets the run needs besides the track's: the pawn and the feedback sounds.
+	void CollectRunAssets(TArray<FSoftObjectPath> &OutAssets) const;
+
 	void RegisterAction();
 
 	UFUNCTION(BlueprintCallable, Category = "GameMode")
@@ -42,6 +68,56 @@ public:
 	UFUNCTION(BlueprintImplementableEvent, Category = "GameMode")
 	void OnGameCompleted();
 
+	// Called once every asset in the track manifest is loaded. Hide the loading screen here.
+	UFUNCTION(BlueprintImplementableEvent, Category = "GameMode")
+	void OnPreloadCompleted();
+
+	UFUNCTION(BlueprintPure, Category = "GameMode")
+	float GetPreloadProgress() const;
+
+	// Starts the run over without reloading the map. Rings, lives, the pawn, the ghost and the recording all go back to the start.
+	UFUNCTION(BlueprintCallable, Category = "GameMode")
+	void ResetRun();
+
+	UFUNCTION(BlueprintImplementableEvent, Category = "GameMode")
+	void OnRunReset();
+
+	// Swaps the ring handler's track during play and starts the run over on it, as ResetRun does. Ghost playback stops.
+	// Not for track graphs, which load the tracks of their segments themselves.
+	UFUNCTION(BlueprintCallable, Category = "GameMode")
+	bool LoadTrack(UTrackData *Data);
+
+	// Puts a practice run back Seconds, or as far as the buffer goes. Ghost recording stops, as the run no longer counts.
+	UFUNCTION(BlueprintCallable, Category = "Practice")
+	bool Rewind(float Seconds);
+
+	UFUNCTION(BlueprintImplementableEvent, Category = "Practice")
+	void OnRewind();
+
+	// Takes the leftmost or rightmost branch at the next junction of a track graph. Returns false if there is none to choose.
+	UFUNCTION(BlueprintCallable, Category = "GameMode")
+	bool ChooseBranch(bool bRight);
+
+	UFUNCTION(BlueprintPure, Category = "GameMode")
+	FORCEINLINE bool IsPreloading() const
+	{
+		return this->bPreloading;
+	}
+
+	// Plays a ghost from an earlier run next to the player. Relative file names are looked up in Saved/Ghosts.
+	UFUNCTION(BlueprintCallable, Category = "Ghost")
+	bool StartGhostPlayback(const FString &FileName);
+
+	UFUNCTION(BlueprintCallable, Category = "Ghost")
+	void StopGhostPlayback();
+
+	// File the current run is being recorded to. Empty if not recording.
+	UFUNCTION(BlueprintPure, Category = "Ghost")
+	FORCEINLINE FString GetGhostRecordingFile() const
+	{
+		return this->GhostRecordingFile;
+	}
+
 	UFUNCTION(BlueprintPure, Category = "GameMode")
 	FORCEINLINE ARingHandler* GetRingHandler()
 	{
@@ -61,11 +137,91 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float InterpCharacterSpeed;
 
+	// Spawned for the player, and for ghosts unless GhostClass is set. Soft, so it's loaded with the track manifest.
+	UPROPERTY(EditAnywhere, Category = "GameMode")
+	TSoftClassPtr<ACatCharacter> PawnClass;
+
 	UPROPERTY()
 	ARingHandler *RingHandler;
 
+	// Plays the track when placed in the level, RingHandler being its active segment.
+	UPROPERTY()
+	ARingTrackGraph *TrackGraph;
+
+	// Record every run to Saved/Ghosts.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ghost")
+	bool bRecordGhost;
+
+	// Spawned for ghost playback. Defaults to PawnClass.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ghost")
+	TSubclassOf<ACatCharacter> GhostClass;
+
+	// Applied to every material slot of the ghost mesh. Should be translucent.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ghost")
+	UMaterialInterface *GhostMaterial;
+
+	UPROPERTY()
+	ACatCharacter *Ghost;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "GameMode")
+	UFeedbackSoundComponent *FeedbackSounds;
+
+	// Snapshot every step so the run can be rewound.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Practice")
+	bool bPracticeMode;
+
+	// How far back a rewind can go. Takes effect when the ring handler is found.
+	UPROPERTY(EditAnywhere, Category = "Practice", meta = (ClampMin = 1))
+	float RewindBufferSeconds;
+
 private:
-	float CurrentDistance;
+	void StartPreload();
+
+	void OnPreloadFinished();
+
+	void StartGhostRecording();
+
+	void StopGhostRecording();
+
+	// Puts lives, distance, the pawn, the rewind buffer and the ghost back to the start of the handler's run, then records again.
+	void ResetRunState();
+
+	void TickGhost(float DeltaTime);
+
+	void SaveRewindFrame(ACatCharacter *Character);
+
+	// Puts a character on the rail, easing its offset from the rail towards Offset. Shared by the player and ghosts.
+	void MoveAlongRail(ACatCharacter *Character, const FVector &RailLocation, const FRotator &RailRotation, const FVector &Offset,
+		FVector &OffsetCache, float DeltaTime) const;
+
+private:
+	// Absolute track distance. Kept in double precision so it stays exact over long endless runs. Starts over on every track graph segment.
+	double CurrentDistance;
+
+	bool bPreloading;
+	double PreloadStartTime;
+	TSharedPtr<FStreamableHandle> PreloadHandle;
 
 	FVector PlayerOffsetCache;
+
+	// Seconds since preload finished. Ghosts are recorded and played back against this.
+	double RunTime;
+	bool bActionThisStep;
+
+	FGhostWriter GhostWriter;
+	FString GhostRecordingFile;
+
+	// Lives the run started with, restored by ResetRun.
+	int32 StartLifeCount;
+
+	FString GhostPlaybackFile;
+	TUniquePtr<FGhostReader> GhostReader;
+	FGhostStep GhostStep;
+	FGhostStep GhostNextStep;
+	FVector GhostOffsetCache;
+
+	// Fixed ring of the latest steps. RewindHead is where the next one goes.
+	TArray<FRunRewindFrame> RewindFrames;
+	int32 RewindHead;
+	int32 RewindCount;
 };
@@ -0,0 +1,301 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FeedbackSoundComponent.h"
+
+#include "BeatTelemetry.h"
+#include "AudioDevice.h"
+#include "Engine/World.h"
+#include "Sound/SoundCue.h"
+#include "Sound/SoundWave.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectIterator.h"
+#include "Components/AudioComponent.h"
+#include "Sound/SoundNodeWavePlayer.h"
+
+static void LogFeedbackSoundStats(UWorld *World)
+{
+	for (TObjectIterator<UFeedbackSoundComponent> It; It; ++It)
+	{
+		if (It->GetWorld() == World)
+		{
+			It->LogStats();
+		}
+	}
+}
+
+static FAutoConsoleCommandWithWorld FeedbackSoundStatsCommand(TEXT("Catnip.FeedbackSoundStats"),
+	TEXT("Logs voice use and latency of the beat feedback sounds."),
+	FConsoleCommandWithWorldDelegate::CreateStatic(&LogFeedbackSoundStats));
+
+UFeedbackSoundComponent::UFeedbackSoundComponent()
+{
+	static const TArray<FSoftObjectPath> SuccessPaths = []()
+	{
+		TArray<FSoftObjectPath> Paths;
+		for (int32 i = 1; i <= 10; ++i)
+		{
+			Paths.Add(FSoftObjectPath(FString::Printf(TEXT("/Game/Master_Audio/CatnipSUCCESS%02d.CatnipSUCCESS%02d"), i, i)));
+		}
+		return Paths;
+	}();
+	static const FSoftObjectPath FailPath(TEXT("/Game/Master_Audio/CatnipPAIN.CatnipPAIN"));
+	static const FSoftObjectPath DeathPath(TEXT("/Game/Master_Audio/CatnipDEATH.CatnipDEATH"));
+	for (const FSoftObjectPath &Path : SuccessPaths)
+	{
+		this->SuccessSounds.Add(TSoftObjectPtr<USoundBase>(Path));
+	}
+	this->FailSound = TSoftObjectPtr<USoundBase>(FailPath);
+	this->DeathSound = TSoftObjectPtr<USoundBase>(DeathPath);
+	this->LoadedFailSound = nullptr;
+	this->LoadedDeathSound = nullptr;
+
+	this->bEnabled = false;
+	this->NumVoices = 6;
+	this->StealPolicy = EVoiceStealPolicy::LowestPriority;
+	this->SuccessStreak = 0;
+
+	this->NumPlays = 0;
+	this->NumSteals = 0;
+	this->NumDrops = 0;
+	this->DispatchTotal = 0.0;
+	this->DispatchMax = 0.0;
+	this->NumStarts = 0;
+	this->StartLatencyTotal = 0.0;
+	this->StartLatencyMax = 0.0;
+}
+
+void UFeedbackSoundComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	AActor *Owner = Super::GetOwner();
+	check(Owner != nullptr);
+	this->Voices.Reset(this->NumVoices);
+	this->VoiceStates.SetNum(this->NumVoices);
+	for (int32 i = 0; i < this->NumVoices; ++i)
+	{
+		UAudioComponent *Voice = NewObject<UAudioComponent>(Owner);
+		Voice->bAutoActivate = false;
+		Voice->bAutoDestroy = false;
+		Voice->bAllowSpatialization = false;
+		Voice->bIsUISound = true;
+		Voice->OnAudioPlaybackPercentNative.AddUObject(this, &UFeedbackSoundComponent::OnVoicePlaybackPercent);
+		Voice->RegisterComponent();
+		this->Voices.Add(Voice);
+	}
+}
+
+void UFeedbackSoundComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (this->NumPlays > 0)
+	{
+		this->LogStats();
+	}
+	for (UAudioComponent *Voice : this->Voices)
+	{
+		if (Voice != nullptr)
+		{
+			Voice->OnAudioPlaybackPercentNative.RemoveAll(this);
+			Voice->DestroyComponent();
+		}
+	}
+	this->Voices.Empty();
+	this->VoiceStates.Empty();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UFeedbackSoundComponent::CollectAssets(TArray<FSoftObjectPath> &OutAssets) const
+{
+	for (const TSoftObjectPtr<USoundBase> &Sound : this->SuccessSounds)
+	{
+		if (!Sound.IsNull())
+		{
+			OutAssets.AddUnique(Sound.ToSoftObjectPath());
+		}
+	}
+	for (const TSoftObjectPtr<USoundBase> *Sound : { &this->FailSound, &this->DeathSound })
+	{
+		if (!Sound->IsNull())
+		{
+			OutAssets.AddUnique(Sound->ToSoftObjectPath());
+		}
+	}
+}
+
+void UFeedbackSoundComponent::PrepareSounds()
+{
+	this->LoadedSuccessSounds.Reset(this->SuccessSounds.Num());
+	for (const TSoftObjectPtr<USoundBase> &Sound : this->SuccessSounds)
+	{
+		if (USoundBase *Loaded = Sound.LoadSynchronous())
+		{
+			this->LoadedSuccessSounds.Add(Loaded);
+		}
+	}
+	this->LoadedFailSound = this->FailSound.LoadSynchronous();
+	this->LoadedDeathSound = this->DeathSound.LoadSynchronous();
+
+	for (USoundBase *Sound : this->LoadedSuccessSounds)
+	{
+		this->PrewarmSound(Sound);
+	}
+	this->PrewarmSound(this->LoadedFailSound);
+	this->PrewarmSound(this->LoadedDeathSound);
+}
+
+void UFeedbackSoundComponent::PlaySuccess()
+{
+	if (this->LoadedSuccessSounds.Num() > 0)
+	{
+		this->Play(EFeedbackSound::Success, this->LoadedSuccessSounds[FMath::Min(this->SuccessStreak, this->LoadedSuccessSounds.Num() - 1)]);
+	}
+	++this->SuccessStreak;
+}
+
+void UFeedbackSoundComponent::PlayFail()
+{
+	this->Play(EFeedbackSound::Fail, this->LoadedFailSound);
+	this->SuccessStreak = 0;
+}
+
+void UFeedbackSoundComponent::PlayDeath()
+{
+	this->Play(EFeedbackSound::Death, this->LoadedDeathSound);
+	this->SuccessStreak = 0;
+}
+
+void UFeedbackSoundComponent::ResetStreak()
+{
+	this->SuccessStreak = 0;
+}
+
+void UFeedbackSoundComponent::Play(EFeedbackSound Type, USoundBase *Sound)
+{
+	if (!this->bEnabled || Sound == nullptr || this->Voices.Num() == 0)
+	{
+		return;
+	}
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	const int32 Index = this->FindVoice(Type);
+	if (Index == INDEX_NONE)
+	{
+		++this->NumDrops;
+		return;
+	}
+
+	UAudioComponent *Voice = this->Voices[Index];
+	if (Voice->IsPlaying())
+	{
+		Voice->Stop();
+		++this->NumSteals;
+	}
+	Voice->SetSound(Sound);
+	Voice->Play();
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().MarkAudioSubmit();
+#endif
+
+	FFeedbackVoiceState &State = this->VoiceStates[Index];
+	State.Type = Type;
+	State.RequestCycles = StartCycles;
+	State.StartTime = FPlatformTime::Seconds();
+
+	const double Dispatch = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles);
+	this->DispatchTotal += Dispatch;
+	this->DispatchMax = FMath::Max(this->DispatchMax, Dispatch);
+	++this->NumPlays;
+}
+
+int32 UFeedbackSoundComponent::FindVoice(EFeedbackSound Type) const
+{
+	int32 Oldest = INDEX_NONE, Lowest = INDEX_NONE;
+	for (int32 i = 0; i < this->Voices.Num(); ++i)
+	{
+		if (!this->Voices[i]->IsPlaying())
+		{
+			return i;
+		}
+
+		const FFeedbackVoiceState &State = this->VoiceStates[i];
+		if (Oldest == INDEX_NONE || State.StartTime < this->VoiceStates[Oldest].StartTime)
+		{
+			Oldest = i;
+		}
+		if (State.Type <= Type && (Lowest == INDEX_NONE || State.Type < this->VoiceStates[Lowest].Type
+			|| (State.Type == this->VoiceStates[Lowest].Type && State.StartTime < this->VoiceStates[Lowest].StartTime)))
+		{
+			Lowest = i;
+		}
+	}
+
+	switch (this->StealPolicy)
+	{
+	case EVoiceStealPolicy::Oldest:
+		return Oldest;
+	case EVoiceStealPolicy::LowestPriority:
+		return Lowest;
+	default:
+		return INDEX_NONE;
+	}
+}
+
+void UFeedbackSoundComponent::PrewarmSound(USoundBase *Sound)
+{
+	FAudioDevice *AudioDevice = Super::GetWorld() != nullptr ? Super::GetWorld()->GetAudioDevice() : nullptr;
+	if (Sound == nullptr || AudioDevice == nullptr)
+	{
+		return;
+	}
+
+	// Decompress up front so the first play of each sound doesn't wait on the decoder.
+	TArray<USoundWave*> Waves;
+	if (USoundWave *Wave = Cast<USoundWave>(Sound))
+	{
+		Waves.Add(Wave);
+	}
+	else if (USoundCue *Cue = Cast<USoundCue>(Sound))
+	{
+		for (USoundNode *Node : Cue->AllNodes)
+		{
+			USoundNodeWavePlayer *Player = Cast<USoundNodeWavePlayer>(Node);
+			if (Player != nullptr && Player->GetSoundWave() != nullptr)
+			{
+				Waves.Add(Player->GetSoundWave());
+			}
+		}
+	}
+	for (USoundWave *Wave : Waves)
+	{
+		AudioDevice->Precache(Wave, true, true, true);
+	}
+}
+
+void UFeedbackSoundComponent::OnVoicePlaybackPercent(const UAudioComponent *Component, const USoundWave *Wave, const float Percent)
+{
+	// The first playback report after Play is when the mixer started rendering the sound.
+	const int32 Index = this->Voices.IndexOfByKey(Component);
+	if (Index == INDEX_NONE || this->VoiceStates[Index].RequestCycles == 0)
+	{
+		return;
+	}
+	FFeedbackVoiceState &State = this->VoiceStates[Index];
+	const double Latency = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - State.RequestCycles);
+	State.RequestCycles = 0;
+
+	this->StartLatencyTotal += Latency;
+	this->StartLatencyMax = FMath::Max(this->StartLatencyMax, Latency);
+	++this->NumStarts;
+}
+
+void UFeedbackSoundComponent::LogStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Feedback sounds: %d played, %d stolen, %d dropped over %d voices."),
+		this->NumPlays, this->NumSteals, this->NumDrops, this->Voices.Num());
+	UE_LOG(LogTemp, Log, TEXT("  dispatch: mean %.1f us, max %.1f us."),
+		this->NumPlays > 0 ? this->DispatchTotal * 1.0e6 / this->NumPlays : 0.0, this->DispatchMax * 1.0e6);
+	UE_LOG(LogTemp, Log, TEXT("  start latency: mean %.1f ms, max %.1f ms over %d sounds."),
+		this->NumStarts > 0 ? this->StartLatencyTotal * 1000.0 / this->NumStarts : 0.0, this->StartLatencyMax * 1000.0, this->NumStarts);
+}
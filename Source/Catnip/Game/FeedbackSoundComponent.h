@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "FeedbackSoundComponent.generated.h"
+
+class USoundBase;
+class USoundWave;
+class UAudioComponent;
+
+/** Beat feedback sounds, least important first. */
+UENUM(BlueprintType)
+enum class EFeedbackSound : uint8
+{
+	Success,
+	Fail,
+	Death
+};
+
+/** What to do when every voice is busy. */
+UENUM(BlueprintType)
+enum class EVoiceStealPolicy : uint8
+{
+	// Drop the new sound.
+	None,
+	// Stop the voice that started first.
+	Oldest,
+	// Stop the oldest of the least important voices. Never stops a more important sound than the new one.
+	LowestPriority
+};
+
+struct FFeedbackVoiceState
+{
+	EFeedbackSound Type = EFeedbackSound::Success;
+	// Cycles when Play was called. Cleared once the voice reports playback.
+	uint64 RequestCycles = 0;
+	double StartTime = 0.0;
+};
+
+/**
+ * Plays the beat success, fail and death sounds from native code with a fixed pool of audio components.
+ * The components are registered at BeginPlay and the sounds decompressed once the run's preload has loaded them,
+ * so a beat only picks a voice and starts it.
+ * Run Catnip.FeedbackSoundStats to log dispatch cost, start latency, steals and drops.
+ */
+UCLASS(ClassGroup = Audio, meta = (BlueprintSpawnableComponent))
+class CATNIP_API UFeedbackSoundComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UFeedbackSoundComponent();
+
+protected:
+	virtual void BeginPlay() override;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+public:
+	// Successive successes climb through SuccessSounds. A fail starts over from the first.
+	UFUNCTION(BlueprintCallable, Category = "FeedbackSound")
+	void PlaySuccess();
+
+	UFUNCTION(BlueprintCallable, Category = "FeedbackSound")
+	void PlayFail();
+
+	UFUNCTION(BlueprintCallable, Category = "FeedbackSound")
+	void PlayDeath();
+
+	// Successes start from the first sound again, as at the start of a run.
+	UFUNCTION(BlueprintCallable, Category = "FeedbackSound")
+	void ResetStreak();
+
+	void LogStats() const;
+
+	// Sounds for the track manifest. They are soft references, so nothing is loaded with the map.
+	void CollectAssets(TArray<FSoftObjectPath> &OutAssets) const;
+
+	// Resolves and decompresses the sounds. Called once the preload is done. Loads them itself if they weren't preloaded.
+	void PrepareSounds();
+
+protected:
+	// Off by default while BP_RingHandler still plays the feedback sounds from its own event bindings, which would
+	// play every sound twice. Turn on once those nodes are gone.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "FeedbackSound")
+	bool bEnabled;
+
+	UPROPERTY(EditAnywhere, Category = "FeedbackSound")
+	TArray<TSoftObjectPtr<USoundBase>> SuccessSounds;
+
+	UPROPERTY(EditAnywhere, Category = "FeedbackSound")
+	TSoftObjectPtr<USoundBase> FailSound;
+
+	UPROPERTY(EditAnywhere, Category = "FeedbackSound")
+	TSoftObjectPtr<USoundBase> DeathSound;
+
+	UPROPERTY(EditAnywhere, Category = "FeedbackSound", meta = (ClampMin = 1, ClampMax = 32))
+	int32 NumVoices;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "FeedbackSound")
+	EVoiceStealPolicy StealPolicy;
+
+private:
+	void Play(EFeedbackSound Type, USoundBase *Sound);
+
+	// Free voice, or the one to steal under StealPolicy. INDEX_NONE drops the sound.
+	int32 FindVoice(EFeedbackSound Type) const;
+
+	void PrewarmSound(USoundBase *Sound);
+
+	void OnVoicePlaybackPercent(const UAudioComponent *Component, const USoundWave *Wave, const float Percent);
+
+private:
+	UPROPERTY(Transient)
+	TArray<UAudioComponent*> Voices;
+
+	// Resolved by PrepareSounds, and kept referenced for the rest of the run.
+	UPROPERTY(Transient)
+	TArray<USoundBase*> LoadedSuccessSounds;
+
+	UPROPERTY(Transient)
+	USoundBase *LoadedFailSound;
+
+	UPROPERTY(Transient)
+	USoundBase *LoadedDeathSound;
+
+	TArray<FFeedbackVoiceState> VoiceStates;
+	int32 SuccessStreak;
+
+	int32 NumPlays;
+	int32 NumSteals;
+	int32 NumDrops;
+	double DispatchTotal;
+	double DispatchMax;
+	int32 NumStarts;
+	double StartLatencyTotal;
+	double StartLatencyMax;
+};
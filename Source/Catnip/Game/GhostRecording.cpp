@@ -0,0 +1,262 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GhostRecording.h"
+
+#include "HAL/FileManager.h"
+#include "Serialization/Archive.h"
+
+namespace
+{
+	constexpr uint32 GhostMagic = 0x54534847; // GHST
+	constexpr uint32 GhostVersion = 1;
+	constexpr int32 GhostBufferSize = 4096;
+
+	// Quantisation. Ticks per second, and steps per unit or degree.
+	constexpr double TimeScale = 10000.0;
+	constexpr double DistanceScale = 16.0;
+	constexpr float OffsetScale = 4.0f;
+	constexpr float TiltScale = 4.0f;
+
+	enum EGhostFlags : uint8
+	{
+		GF_Time = 1 << 0,
+		GF_Distance = 1 << 1,
+		GF_OffsetY = 1 << 2,
+		GF_OffsetZ = 1 << 3,
+		GF_TiltRoll = 1 << 4,
+		GF_TiltYaw = 1 << 5,
+		GF_Action = 1 << 6
+	};
+
+	FORCEINLINE int32 WriteVarInt(int64 Value, uint8 *Output)
+	{
+		uint64 ZigZag = (uint64(Value) << 1) ^ uint64(Value >> 63);
+		int32 Count = 0;
+		do
+		{
+			uint8 Byte = ZigZag & 0x7F;
+			ZigZag >>= 7;
+			Output[Count++] = Byte | (ZigZag != 0 ? 0x80 : 0);
+		} while (ZigZag != 0);
+		return Count;
+	}
+
+	FORCEINLINE bool ReadVarInt(const uint8 *Input, int32 Length, int32 &Offset, int64 &OutValue)
+	{
+		uint64 ZigZag = 0;
+		for (int32 Shift = 0; Shift < 64; Shift += 7)
+		{
+			if (Offset >= Length)
+			{
+				return false;
+			}
+			uint8 Byte = Input[Offset++];
+			ZigZag |= uint64(Byte & 0x7F) << Shift;
+			if ((Byte & 0x80) == 0)
+			{
+				OutValue = int64(ZigZag >> 1) ^ -int64(ZigZag & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+int32 FGhostStepCodec::Encode(const FGhostStep &Step, uint8 *Output)
+{
+	const int64 NewTime = int64(FMath::RoundToDouble(Step.Time * TimeScale));
+	const int64 NewDistance = int64(FMath::RoundToDouble(Step.TrackDistance * DistanceScale));
+	const int64 NewTimeDelta = NewTime - this->Time;
+	const int64 NewDistanceDelta = NewDistance - this->Distance;
+	const int32 NewOffsetY = FMath::RoundToInt(Step.PlayerOffset.X * OffsetScale);
+	const int32 NewOffsetZ = FMath::RoundToInt(Step.PlayerOffset.Y * OffsetScale);
+	const int32 NewTiltRoll = FMath::RoundToInt(Step.Tilt.Roll * TiltScale);
+	const int32 NewTiltYaw = FMath::RoundToInt(Step.Tilt.Yaw * TiltScale);
+
+	uint8 &Flags = Output[0];
+	Flags = Step.bAction ? GF_Action : 0;
+	int32 Count = 1;
+	auto WriteField = [&](EGhostFlags Flag, int64 Delta)
+	{
+		if (Delta != 0)
+		{
+			Flags |= Flag;
+			Count += WriteVarInt(Delta, &Output[Count]);
+		}
+	};
+	WriteField(GF_Time, NewTimeDelta - this->TimeDelta);
+	WriteField(GF_Distance, NewDistanceDelta - this->DistanceDelta);
+	WriteField(GF_OffsetY, NewOffsetY - this->OffsetY);
+	WriteField(GF_OffsetZ, NewOffsetZ - this->OffsetZ);
+	WriteField(GF_TiltRoll, NewTiltRoll - this->TiltRoll);
+	WriteField(GF_TiltYaw, NewTiltYaw - this->TiltYaw);
+
+	this->Time = NewTime;
+	this->TimeDelta = NewTimeDelta;
+	this->Distance = NewDistance;
+	this->DistanceDelta = NewDistanceDelta;
+	this->OffsetY = NewOffsetY;
+	this->OffsetZ = NewOffsetZ;
+	this->TiltRoll = NewTiltRoll;
+	this->TiltYaw = NewTiltYaw;
+	return Count;
+}
+
+int32 FGhostStepCodec::Decode(const uint8 *Input, int32 Length, FGhostStep &OutStep)
+{
+	if (Length <= 0)
+	{
+		return 0;
+	}
+	const uint8 Flags = Input[0];
+	int32 Offset = 1;
+
+	int64 Deltas[6] = { 0, 0, 0, 0, 0, 0 };
+	const EGhostFlags Fields[6] = { GF_Time, GF_Distance, GF_OffsetY, GF_OffsetZ, GF_TiltRoll, GF_TiltYaw };
+	for (int32 i = 0; i < 6; ++i)
+	{
+		if ((Flags & Fields[i]) != 0 && !ReadVarInt(Input, Length, Offset, Deltas[i]))
+		{
+			return 0;
+		}
+	}
+
+	this->TimeDelta += Deltas[0];
+	this->Time += this->TimeDelta;
+	this->DistanceDelta += Deltas[1];
+	this->Distance += this->DistanceDelta;
+	this->OffsetY += int32(Deltas[2]);
+	this->OffsetZ += int32(Deltas[3]);
+	this->TiltRoll += int32(Deltas[4]);
+	this->TiltYaw += int32(Deltas[5]);
+
+	OutStep.Time = this->Time / TimeScale;
+	OutStep.TrackDistance = this->Distance / DistanceScale;
+	OutStep.PlayerOffset = FVector2D(this->OffsetY / OffsetScale, this->OffsetZ / OffsetScale);
+	OutStep.Tilt = FRotator(0.0f, this->TiltYaw / TiltScale, this->TiltRoll / TiltScale);
+	OutStep.bAction = (Flags & GF_Action) != 0;
+	return Offset;
+}
+
+/// WRITER ///
+
+FGhostWriter::~FGhostWriter()
+{
+	this->Close();
+}
+
+bool FGhostWriter::Open(const FString &FileName)
+{
+	this->Close();
+	this->Archive.Reset(IFileManager::Get().CreateFileWriter(*FileName));
+	if (!this->Archive.IsValid())
+	{
+		return false;
+	}
+	this->Codec = FGhostStepCodec();
+	this->Buffer.Reset(GhostBufferSize);
+
+	uint32 Magic = GhostMagic, Version = GhostVersion;
+	*this->Archive << Magic << Version;
+	this->NumBytes = sizeof(Magic) + sizeof(Version);
+	return true;
+}
+
+void FGhostWriter::Write(const FGhostStep &Step)
+{
+	if (!this->IsOpen())
+	{
+		return;
+	}
+	if (this->Buffer.Num() + FGhostStepCodec::MaxStepBytes > GhostBufferSize)
+	{
+		this->Flush();
+	}
+	int32 Offset = this->Buffer.Num();
+	this->Buffer.AddUninitialized(FGhostStepCodec::MaxStepBytes);
+	int32 Count = this->Codec.Encode(Step, &this->Buffer[Offset]);
+	this->Buffer.SetNum(Offset + Count, false);
+	this->NumBytes += Count;
+}
+
+void FGhostWriter::Flush()
+{
+	if (this->IsOpen() && this->Buffer.Num() > 0)
+	{
+		this->Archive->Serialize(this->Buffer.GetData(), this->Buffer.Num());
+		this->Buffer.Reset();
+	}
+}
+
+void FGhostWriter::Close()
+{
+	if (!this->IsOpen())
+	{
+		return;
+	}
+	this->Flush();
+	this->Archive->Close();
+	this->Archive.Reset();
+}
+
+/// READER ///
+
+FGhostReader::~FGhostReader()
+{
+	if (this->Archive.IsValid())
+	{
+		this->Archive->Close();
+	}
+}
+
+bool FGhostReader::Open(const FString &FileName)
+{
+	this->Archive.Reset(IFileManager::Get().CreateFileReader(*FileName));
+	if (!this->Archive.IsValid())
+	{
+		return false;
+	}
+	uint32 Magic = 0, Version = 0;
+	*this->Archive << Magic << Version;
+	if (Magic != GhostMagic || Version != GhostVersion)
+	{
+		this->Archive.Reset();
+		return false;
+	}
+	this->Codec = FGhostStepCodec();
+	this->Buffer.Reset(GhostBufferSize);
+	this->BufferOffset = 0;
+	return true;
+}
+
+void FGhostReader::Refill()
+{
+	// Keep the unread tail and top the buffer back up from the file.
+	this->Buffer.RemoveAt(0, this->BufferOffset, false);
+	this->BufferOffset = 0;
+
+	int64 Remaining = this->Archive->TotalSize() - this->Archive->Tell();
+	int32 Count = int32(FMath::Min<int64>(Remaining, GhostBufferSize - this->Buffer.Num()));
+	if (Count > 0)
+	{
+		int32 Offset = this->Buffer.Num();
+		this->Buffer.AddUninitialized(Count);
+		this->Archive->Serialize(&this->Buffer[Offset], Count);
+	}
+}
+
+bool FGhostReader::Read(FGhostStep &OutStep)
+{
+	if (!this->Archive.IsValid())
+	{
+		return false;
+	}
+	if (this->Buffer.Num() - this->BufferOffset < FGhostStepCodec::MaxStepBytes)
+	{
+		this->Refill();
+	}
+	int32 Count = this->Codec.Decode(&this->Buffer.GetData()[this->BufferOffset], this->Buffer.Num() - this->BufferOffset, OutStep);
+	this->BufferOffset += Count;
+	return Count > 0;
+}
@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FArchive;
+
+/** Everything needed to put a pawn back on the rail for one step of a run. */
+struct FGhostStep
+{
+	// Seconds since the run started.
+	double Time = 0.0;
+	double TrackDistance = 0.0;
+
+	// PlayerOffset Y and Z. X is always zero.
+	FVector2D PlayerOffset = FVector2D::ZeroVector;
+
+	// Only roll and yaw are used for tilt.
+	FRotator Tilt = FRotator::ZeroRotator;
+
+	bool bAction = false;
+};
+
+/**
+ * Quantised step state. Each step is written as a flag byte followed by zigzag varint deltas of the fields that changed.
+ * Time and distance store the change in their delta, so a steady frame rate and speed cost nothing.
+ */
+struct FGhostStepCodec
+{
+	int64 Time = 0;
+	int64 TimeDelta = 0;
+	int64 Distance = 0;
+	int64 DistanceDelta = 0;
+	int32 OffsetY = 0;
+	int32 OffsetZ = 0;
+	int32 TiltRoll = 0;
+	int32 TiltYaw = 0;
+
+	// Largest encoded step: flag byte and six 64-bit varints.
+	static constexpr int32 MaxStepBytes = 1 + 6 * 10;
+
+	int32 Encode(const FGhostStep &Step, uint8 *Output);
+
+	// Returns the number of bytes read, or 0 if Input doesn't hold a full step.
+	int32 Decode(const uint8 *Input, int32 Length, FGhostStep &OutStep);
+};
+
+/** Streams a ghost to disk through a small fixed buffer. */
+class CATNIP_API FGhostWriter
+{
+public:
+	~FGhostWriter();
+
+	bool Open(const FString &FileName);
+
+	void Write(const FGhostStep &Step);
+
+	void Close();
+
+	FORCEINLINE bool IsOpen() const
+	{
+		return this->Archive.IsValid();
+	}
+
+	FORCEINLINE int64 GetNumBytes() const
+	{
+		return this->NumBytes;
+	}
+
+private:
+	void Flush();
+
+private:
+	TUniquePtr<FArchive> Archive;
+	FGhostStepCodec Codec;
+
+	TArray<uint8> Buffer;
+	int64 NumBytes = 0;
+};
+
+/** Streams a ghost from disk through a small fixed buffer. */
+class CATNIP_API FGhostReader
+{
+public:
+	~FGhostReader();
+
+	bool Open(const FString &FileName);
+
+	// False once the recording ends.
+	bool Read(FGhostStep &OutStep);
+
+private:
+	void Refill();
+
+private:
+	TUniquePtr<FArchive> Archive;
+	FGhostStepCodec Codec;
+
+	TArray<uint8> Buffer;
+	int32 BufferOffset = 0;
+};
@@ -3,39 +3,42 @@
 
 #include "Ring.h"
 
+#include "RingKernel.h"
 #include "RingHandler.h"
+#include "RingHitchDetector.h"
 #include "Engine/World.h"
 #include "Engine/StaticMesh.h"
-#include "Game/DefaultGameMode.h"
 #include "GameFramework/Character.h"
 #include "Camera/PlayerCameraManager.h"
-#include "Components/SplineComponent.h"
 #include "Components/SplineMeshComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
 #include "Materials/MaterialInstanceDynamic.h"
 
 ARing::ARing()
 {
-	//this->bVisible = true;
+	this->bVisible = true;
 
 	this->RotateSpeedMin = -25.0f;
 	this->RotateSpeedMax = 25.0f;
 	this->RotateSpeedRerollZone = 5.0f;
 
-	this->bObstacleHit = false;
-	this->LastOpacity = 1.0f;
-	this->RequiredOpacity = 0.0f;
+	this->LastOpacity = -1.0f;
+	this->BaseRotation = FQuat::Identity;
+	this->RotationOffset = 0.0f;
+	this->SegmentResolution = 0;
 
 	this->bDebugDisableRotation = false;
+	this->MaterialInstanceDynamic = nullptr;
+	this->SingleMeshComponent = nullptr;
+	this->SegmentInstances = nullptr;
+	this->ObstacleMeshComponent = nullptr;
 
 	this->SceneComponent = UObject::CreateDefaultSubobject<USceneComponent>(TEXT("RingSceneComponent"));
+	this->SceneComponent->SetMobility(EComponentMobility::Movable);
 	Super::RootComponent = this->SceneComponent;
 
-	this->SplineComponent = UObject::CreateDefaultSubobject<USplineComponent>(TEXT("RingSplineComponent"));
-	this->SplineComponent->SetMobility(EComponentMobility::Movable);
-	this->SplineComponent->SetClosedLoop(true, false);
-	this->SplineComponent->SetupAttachment(Super::RootComponent);
-
-	Super::PrimaryActorTick.bCanEverTick = true;
+	// The ring handler simulates rotation and opacity, and pushes them in ApplyRecord.
+	Super::PrimaryActorTick.bCanEverTick = false;
 }
 
 void ARing::OnConstruction(const FTransform& Transform)
@@ -51,8 +54,6 @@ void ARing::BeginPlay()
 {
 	Super::BeginPlay();
 
-	this->StaticMeshComponents.Empty();
-
 	//do
 	//{
 	//	this->RotateSpeed = FMath::RandRange(this->RotateSpeedMin, this->RotateSpeedMax);
@@ -70,126 +71,123 @@ void ARing::UpdateColor(FLinearColor Color)
 }
 #endif
 
-void ARing::InitRing(FRingSpawnState *State)
+void ARing::InitRing(const FRingRecord &Record, int32 Seed)
 {
-	if (State == nullptr || State->Mesh == nullptr || this->SplineComponent == nullptr || State->Resolution <= 0)
+	static const FName ColorName(TEXT("Color"));
+
+	const FRingSpawnState *State = &Record.State;
+	if (State->Mesh == nullptr || State->Resolution <= 0)
 	{
 		ensure(false);
 		return;
 	}
-	if (this->SplineComponent->GetNumberOfSplinePoints() > 0)
+
+	this->RingRadius = Record.Radius;
+	this->BaseRotation = Record.Rotation.Quaternion();
+	this->RotationOffset = Record.RotationOffset;
+	this->LastOpacity = -1.0f;
+	this->SegmentResolution = 0;
+
+	this->MaterialInstanceDynamic = nullptr;
+	if (State->MaterialInterface != nullptr)
 	{
-		this->SplineComponent->ClearSplinePoints();
+		UMaterialInstanceDynamic *&Instance = this->MaterialInstances.FindOrAdd(State->MaterialInterface);
+		if (Instance == nullptr)
+		{
+			Instance = UMaterialInstanceDynamic::Create(State->MaterialInterface, this);
+		}
+		Instance->SetVectorParameterValue(ColorName, State->Color);
+		this->MaterialInstanceDynamic = Instance;
 	}
 
-	this->RingRadius = State->Radius;
-
 	FVector ActorLocation = Super::GetActorLocation();
 	FRotator ActorRotation = Super::GetActorRotation();
-	auto CreateStaticMesh = [&](FVector Location, FVector Scale)
+	auto UseStaticMesh = [&](UStaticMeshComponent *Component, FVector Scale, UClass *ComponentClass)
 	{
-		UStaticMeshComponent *StaticMeshComponent = NewObject<UStaticMeshComponent>(this->SplineComponent);
-		StaticMeshComponent->SetCastShadow(false);
-		StaticMeshComponent->SetStaticMesh(State->Mesh);
-		StaticMeshComponent->SetMobility(EComponentMobility::Movable);
-		StaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
-		StaticMeshComponent->SetWorldScale3D(Scale);
-		StaticMeshComponent->SetWorldLocationAndRotation(Location, FRotator::ZeroRotator);
-		StaticMeshComponent->AttachToComponent(this->SplineComponent, FAttachmentTransformRules::KeepWorldTransform);
-		if (this->MaterialInstanceDynamic == nullptr && State->MaterialInterface != nullptr)
+		// Components outlive the ring they were made for. Only the first use of a reused ring creates one.
+		if (Component == nullptr)
 		{
-			this->MaterialInstanceDynamic = UMaterialInstanceDynamic::Create(State->MaterialInterface, this);
-			this->MaterialInstanceDynamic->SetVectorParameterValue(TEXT("Color"), State->Color);
+			RING_HITCH_COUNT(ComponentsCreated, 1);
+			Component = NewObject<UStaticMeshComponent>(this, ComponentClass);
+			Component->SetCastShadow(false);
+			Component->SetMobility(EComponentMobility::Movable);
+			Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			Component->AttachToComponent(Super::RootComponent, FAttachmentTransformRules::KeepWorldTransform);
+			Component->RegisterComponent();
 		}
-		if (this->MaterialInstanceDynamic != nullptr)
-		{
-			StaticMeshComponent->SetMaterial(0, this->MaterialInstanceDynamic);
-		}
-		StaticMeshComponent->RegisterComponent();
-		return StaticMeshComponent;
+		Component->SetStaticMesh(State->Mesh);
+		Component->SetWorldScale3D(Scale);
+		Component->SetWorldLocationAndRotation(ActorLocation, ActorRotation);
+		Component->SetMaterial(0, this->MaterialInstanceDynamic);
+		Component->SetVisibility(true);
+		return Component;
 	};
 
-	// Get rotation offset.
-	float RotationOffset;
-	switch (State->OffsetType)
-	{
-	case ERingOffsetType::Fixed:
-		RotationOffset = State->RotationOffset;
-		break;
-	case ERingOffsetType::Random:
-		RotationOffset = FMath::RandRange(-State->RotationOffset, State->RotationOffset);
-		break;
-	case ERingOffsetType::Incremental:
-		RotationOffset = State->RotationOffset * State->OffsetCounter;
-		++State->OffsetCounter;
-		break;
-	default:
-		RotationOffset = 0.0f;
-		break;
-	}
-
-	// Get rotation speed.
-	do
-	{
-		this->RotateSpeed = FMath::RandRange(State->RotationSpeedMin, State->RotationSpeedMax);
-		//if (State->RotationForceRerollMin < (State->RotationSpeedMax - State->RotationSpeedMin))
-		//{
-		//	ensure(false);
-		//	break;
-		//}
-	} while (FMath::Abs(this->RotateSpeed) <= State->RotationForceRerollMin);
-
-	// Spawn mesh.
+	// Spawn mesh. The component for the other mesh type stays hidden.
 	if (State->MeshType == ERingMeshType::SingleMesh)
 	{
-		UStaticMeshComponent *StaticMeshComponent = CreateStaticMesh(ActorLocation, FVector(State->Radius) * 0.2f);
-		StaticMeshComponent->SetWorldRotation(Super::GetActorRotation());
-		StaticMeshComponent->AddLocalRotation(FRotator(0.0f, 0.0f, RotationOffset));
-		this->StaticMeshComponents.Add(StaticMeshComponent);
+		this->SingleMeshComponent = UseStaticMesh(this->SingleMeshComponent, FVector(State->Radius) * 0.2f, UStaticMeshComponent::StaticClass());
+		this->SingleMeshComponent->AddLocalRotation(FRotator(0.0f, 0.0f, this->RotationOffset));
+		if (this->SegmentInstances != nullptr)
+		{
+			this->SegmentInstances->SetVisibility(false);
+		}
 	}
 	else if(State->MeshType == ERingMeshType::MultipleMesh)
 	{
-		constexpr float PI2 = PI * 2.0f;
-		const float Increment = PI2 / State->Resolution;
-		for (int i = 0; i < State->Resolution; ++i)
+		this->SegmentInstances = Cast<UInstancedStaticMeshComponent>(UseStaticMesh(this->SegmentInstances, FVector::OneVector,
+			UInstancedStaticMeshComponent::StaticClass()));
+		if (this->SingleMeshComponent != nullptr)
 		{
-			float Sin, Cos;
-			FMath::SinCos(&Sin, &Cos, Increment * i + RotationOffset);
-
-			FVector Point = ActorRotation.RotateVector(FVector(0.0f, Sin, Cos)) * State->Radius + ActorLocation;
-			this->SplineComponent->AddSplinePoint(Point, ESplineCoordinateSpace::World, false);
-			this->StaticMeshComponents.Add(CreateStaticMesh(Point, FVector::OneVector));
+			this->SingleMeshComponent->SetVisibility(false);
 		}
-		this->SplineComponent->UpdateSpline();
 	}
 
-	if (State->bSpawnObstacle)
+	if (Record.bObstacle)
 	{
-		this->InitObstacle(State);
+		this->InitObstacle(State, Seed);
 	}
 }
 
-void ARing::InitObstacle(FRingSpawnState *State)
+void ARing::InitObstacle(const FRingSpawnState *State, int32 Seed)
 {
 	if (State->ObstacleMesh == nullptr || State->ObstacleMaterialInterface == nullptr)
 	{
 		return;
 	}
-	UStaticMeshComponent *StaticMeshComponent = NewObject<UStaticMeshComponent>(this->SplineComponent);
-	StaticMeshComponent->SetCastShadow(false);
+	UStaticMeshComponent *StaticMeshComponent = this->ObstacleMeshComponent;
+	if (StaticMeshComponent == nullptr)
+	{
+		RING_HITCH_COUNT(ComponentsCreated, 1);
+		StaticMeshComponent = NewObject<UStaticMeshComponent>(this);
+		StaticMeshComponent->SetCastShadow(false);
+		StaticMeshComponent->SetMobility(EComponentMobility::Movable);
+		StaticMeshComponent->SetCollisionObjectType(ECollisionChannel::ECC_WorldStatic);
+		StaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+		StaticMeshComponent->AttachToComponent(Super::RootComponent, FAttachmentTransformRules::KeepWorldTransform);
+		StaticMeshComponent->RegisterComponent();
+		StaticMeshComponent->OnComponentBeginOverlap.AddDynamic(this, &ARing::OnObstacleOverlap);
+		this->ObstacleMeshComponent = StaticMeshComponent;
+	}
 	StaticMeshComponent->SetStaticMesh(State->ObstacleMesh);
-	StaticMeshComponent->SetMobility(EComponentMobility::Movable);
-	StaticMeshComponent->SetCollisionObjectType(ECollisionChannel::ECC_WorldStatic);
-	StaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
 	StaticMeshComponent->SetWorldScale3D(FVector(State->Radius) * 0.2f);
 	StaticMeshComponent->SetMaterial(0, State->ObstacleMaterialInterface);
 	StaticMeshComponent->SetWorldLocationAndRotation(Super::GetActorLocation(), Super::GetActorRotation());
-	StaticMeshComponent->AddLocalRotation(FRotator(0.0f, 0.0f, FMath::RandRange(0.0f, PI * 2.0f)));
-	StaticMeshComponent->AttachToComponent(Super::RootComponent, FAttachmentTransformRules::KeepWorldTransform);
-	StaticMeshComponent->RegisterComponent();
+	FRandomStream RotationStream = ARingHandler::MakeRandomStream(Seed, this->RingIndex, ERingRandom::ObstacleRotation);
+	StaticMeshComponent->AddLocalRotation(FRotator(0.0f, 0.0f, RotationStream.FRandRange(0.0f, PI * 2.0f)));
+	StaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	StaticMeshComponent->SetVisibility(true);
+}
 
-	this->ObstacleMeshComponent = StaticMeshComponent;
-	StaticMeshComponent->OnComponentBeginOverlap.AddDynamic(this, &ARing::OnObstacleOverlap);
+void ARing::ReleaseRing()
+{
+	this->SetRingVisible(false);
+	if (this->ObstacleMeshComponent != nullptr)
+	{
+		this->ObstacleMeshComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+		this->ObstacleMeshComponent->SetVisibility(false);
+	}
+	this->RingIndex = INDEX_NONE;
 }
 
 void ARing::OnObstacleOverlap(UPrimitiveComponent *OverlappedComponent, AActor *OtherActor, 
@@ -199,18 +197,12 @@ void ARing::OnObstacleOverlap(UPrimitiveComponent *OverlappedComponent, AActor *
 	{
 		return;
 	}
-	if (this->bObstacleHit)
-	{
-		return;
-	}
-	this->bObstacleHit = true;
 
-	// Obstacle hit. Get the ring handler and broadcast the fail.
-	ADefaultGameMode *GameMode = Super::GetWorld()->GetAuthGameMode<ADefaultGameMode>();
-	check(GameMode != nullptr);
-	ARingHandler *RingHandler = GameMode->GetRingHandler();
+	// Obstacle hit. The handler that spawned the ring remembers the hit on the ring record and broadcasts the fail
+	// once. A track graph has several, so it isn't necessarily the game mode's.
+	ARingHandler *RingHandler = Cast<ARingHandler>(Super::GetOwner());
 	check(RingHandler != nullptr);
-	RingHandler->FailRing(this->RingIndex + 1);
+	RingHandler->HitObstacle(this->RingIndex);
 }
 
 #if 0
@@ -281,34 +273,82 @@ void ARing::UpdatePoints(UStaticMesh *Mesh, bool bSingleMesh, float Radius)
 }
 #endif
 
-void ARing::Tick(float DeltaTime)
+void ARing::SetRingVisible(bool bNewVisible)
 {
-	Super::Tick(DeltaTime);
+	if (this->bVisible == bNewVisible)
+	{
+		return;
+	}
+	this->bVisible = bNewVisible;
+	Super::SetActorHiddenInGame(!bNewVisible);
+}
 
-	// Rotate the ring.
-	if ((!WITH_EDITOR || !this->bDebugDisableRotation) && !FMath::IsNearlyZero(this->RotateSpeed))
+void ARing::SetObstacleForcedLod(int32 ForcedLod)
+{
+	if (this->ObstacleMeshComponent != nullptr)
 	{
-		Super::AddActorLocalRotation(FRotator(0.0f, 0.0f, this->RotateSpeed * DeltaTime));
+		this->ObstacleMeshComponent->SetForcedLodModel(ForcedLod);
 	}
-	if (this->MaterialInstanceDynamic == nullptr || FMath::IsNearlyEqual(this->LastOpacity, this->RequiredOpacity))
+}
+
+bool ARing::NeedsSegments(int32 Resolution) const
+{
+	return this->SegmentInstances != nullptr && Resolution != this->SegmentResolution;
+}
+
+void ARing::GetSegmentParams(int32 Resolution, FRingSegmentParams &OutParams) const
+{
+	// Segments are placed in ring space and keep the world rotation they'd have unattached at spawn.
+	OutParams = FRingSegmentParams();
+	OutParams.SegmentRotation = this->BaseRotation.Inverse();
+	OutParams.Radius = this->RingRadius;
+	OutParams.AngleOffset = this->RotationOffset;
+	OutParams.Resolution = Resolution;
+}
+
+void ARing::ApplySegments(TArrayView<const FTransform> Segments)
+{
+	if (this->SegmentInstances == nullptr)
 	{
 		return;
 	}
+	this->SegmentResolution = Segments.Num();
 
-	//float DistanceSquared = (this->PawnLocation - Super::GetActorLocation()).SizeSquared();
-	//float Percentage = 1.0f - FMath::Clamp(DistanceSquared / FMath::Square(this->RingFadeDistance), 0.0f, 1.0f);
-	//this->MaterialInstanceDynamic->SetScalarParameterValue(TEXT("OpacityPercentage"), Percentage);
+	// The component takes its batch as an array. The ring's keeps its memory for the next ring.
+	this->SegmentTransforms.Reset();
+	this->SegmentTransforms.Append(Segments.GetData(), Segments.Num());
 
-	this->MaterialInstanceDynamic->SetScalarParameterValue(TEXT("OpacityPercentage"), this->RequiredOpacity);
-	this->LastOpacity = this->RequiredOpacity;
+	// Only a ring drawn with more segments than it ever had adds instances. All of them are then moved in one batch.
+	UInstancedStaticMeshComponent *Instances = this->SegmentInstances;
+	const int32 Num = this->SegmentTransforms.Num();
+	while (Instances->GetInstanceCount() > Num)
+	{
+		Instances->RemoveInstance(Instances->GetInstanceCount() - 1);
+	}
+	const int32 Existing = Instances->GetInstanceCount();
+	for (int32 i = Existing; i < Num; ++i)
+	{
+		Instances->AddInstance(this->SegmentTransforms[i]);
+	}
+	if (Existing > 0)
+	{
+		Instances->BatchUpdateInstancesTransforms(0, this->SegmentTransforms, false, true);
+	}
+	RING_HITCH_COUNT(InstancesCreated, Num - Existing);
+}
 
-	//if (this->bVisible == FMath::IsNearlyZero(this->LastOpacity))
-	//{
-	//	this->bVisible = !this->bVisible;
-	//	for (USceneComponent *Component : this->SplineComponent->GetAttachChildren())
-	//	{
-	//		Component->SetVisibility(this->bVisible);
-	//	}
-	//}
+void ARing::ApplyRecord(const FRingRecord &Record)
+{
+	// Rotate the ring.
+	if ((!WITH_EDITOR || !this->bDebugDisableRotation) && !FMath::IsNearlyZero(Record.RotationSpeed))
+	{
+		Super::SetActorRotation(this->BaseRotation * FRotator(0.0f, 0.0f, Record.Phase).Quaternion());
+	}
+	if (this->MaterialInstanceDynamic == nullptr || FMath::IsNearlyEqual(this->LastOpacity, Record.Opacity))
+	{
+		return;
+	}
+	this->MaterialInstanceDynamic->SetScalarParameterValue(TEXT("OpacityPercentage"), Record.Opacity);
+	this->LastOpacity = Record.Opacity;
 }
 
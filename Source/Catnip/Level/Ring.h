@@ -6,8 +6,10 @@
 #include "GameFramework/Actor.h"
 #include "Ring.generated.h"
 
+struct FRingRecord;
 struct FRingSpawnState;
-class USplineComponent;
+struct FRingSegmentParams;
+class UInstancedStaticMeshComponent;
 
 UCLASS()
 class CATNIP_API ARing : public AActor
@@ -22,18 +24,35 @@ protected:
 	virtual void OnConstruction(const FTransform& Transform) override;
 
 public:	
-	virtual void Tick(float DeltaTime) override;
+	void InitRing(const FRingRecord &Record, int32 Seed);
 
-	void InitRing(FRingSpawnState *State);
+	void InitObstacle(const FRingSpawnState *State, int32 Seed);
 
-	void InitObstacle(FRingSpawnState *State);
+	// Hides the ring and turns its obstacle off so the ring handler can init it again for another ring. Components are kept.
+	void ReleaseRing();
+
+	// Shows the rotation and opacity the ring handler simulated for this ring. Its detail comes with the segments.
+	void ApplyRecord(const FRingRecord &Record);
+
+	// Hidden rings skip rendering. Their obstacle still collides.
+	void SetRingVisible(bool bNewVisible);
+
+	// 0 lets the engine pick the obstacle mesh LOD.
+	void SetObstacleForcedLod(int32 ForcedLod);
+
+	// Whether the segment instances are built at another resolution. The ring handler builds those of every ring that
+	// needs it in one kernel call, from the ring's params, and hands each ring its part of the output.
+	bool NeedsSegments(int32 Resolution) const;
+
+	void GetSegmentParams(int32 Resolution, FRingSegmentParams &OutParams) const;
+
+	// Replaces the segment instances of a multiple mesh ring with Segments, in ring space.
+	void ApplySegments(TArrayView<const FTransform> Segments);
 
 	//void UpdateColor(FLinearColor Color);
 
 	//void UpdatePoints(UStaticMesh *Mesh, bool bSingleMesh, float Radius);
 
-	void UpdateRingOpacity(float RingOpacity);
-
 	UFUNCTION()
 	void OnObstacleOverlap(UPrimitiveComponent *OverlappedComponent, AActor *OtherActor, 
 		UPrimitiveComponent *OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult &SweepResult);
@@ -66,14 +85,19 @@ protected:
 	UPROPERTY(VisibleAnywhere)
 	USceneComponent *SceneComponent;
 
-	UPROPERTY(VisibleAnywhere)
-	USplineComponent *SplineComponent;
-
 	UPROPERTY()
 	UMaterialInstanceDynamic *MaterialInstanceDynamic;
 
+	// Made the first time each material is used, so a reused ring doesn't create them again.
+	UPROPERTY()
+	TMap<UMaterialInterface*, UMaterialInstanceDynamic*> MaterialInstances;
+
+	UPROPERTY()
+	UStaticMeshComponent *SingleMeshComponent;
+
+	// Every segment of a multiple mesh ring, drawn as instances of one component.
 	UPROPERTY()
-	TArray<UStaticMeshComponent*> StaticMeshComponents;
+	UInstancedStaticMeshComponent *SegmentInstances;
 
 	UPROPERTY()
 	UStaticMeshComponent *ObstacleMeshComponent;
@@ -86,16 +110,10 @@ private:
 	float RingRadius;
 
 	float LastOpacity;
-	float RequiredOpacity;
-
-	//bool bVisible;
-	bool bObstacleHit;
-	float RotateSpeed;
-};
+	FQuat BaseRotation;
+	float RotationOffset;
+	int32 SegmentResolution;
+	TArray<FTransform> SegmentTransforms;
 
-/// INLINE ///
-
-FORCEINLINE void ARing::UpdateRingOpacity(float RingOpacity)
-{
-	this->RequiredOpacity = RingOpacity;
-}
\ No newline at end of file
+	bool bVisible;
+};
\ No newline at end of file
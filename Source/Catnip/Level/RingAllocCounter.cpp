@@ -0,0 +1,272 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingAllocCounter.h"
+
+#include "HAL/MemoryBase.h"
+#include "Misc/CommandLine.h"
+#include "Misc/CoreDelegates.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarAllocCheck(TEXT("Catnip.AllocCheck"), 0,
+	TEXT("Counts heap allocations in the ring pipeline from the next run on, after this many warm-up frames. 0 disables."));
+
+static TAutoConsoleVariable<int32> CVarAllocBudget(TEXT("Catnip.AllocBudget"), 0,
+	TEXT("Ring pipeline allocations allowed per frame once warmed up."));
+
+namespace
+{
+	// Warm-up used by -RingAllocCheck when Catnip.AllocCheck isn't set. Long enough to fill every pool and array.
+	constexpr int32 DefaultWarmupFrames = 300;
+
+	// Only the first few frames over budget are logged on their own.
+	constexpr int32 MaxReportedFrames = 10;
+
+	thread_local int32 ScopeDepth = 0;
+	volatile int64 AllocCount = 0;
+
+	FORCEINLINE void CountAlloc()
+	{
+		if (ScopeDepth > 0)
+		{
+			FPlatformAtomics::InterlockedIncrement(&AllocCount);
+		}
+	}
+
+	/** Forwards everything to the allocator it wraps, counting allocations made inside a scope. */
+	class FCountingMalloc final : public FMalloc
+	{
+	public:
+		explicit FCountingMalloc(FMalloc *InInner)
+			: Inner(InInner)
+		{
+		}
+
+		virtual void *Malloc(SIZE_T Count, uint32 Alignment) override
+		{
+			CountAlloc();
+			return this->Inner->Malloc(Count, Alignment);
+		}
+
+		virtual void *TryMalloc(SIZE_T Count, uint32 Alignment) override
+		{
+			CountAlloc();
+			return this->Inner->TryMalloc(Count, Alignment);
+		}
+
+		virtual void *Realloc(void *Original, SIZE_T Count, uint32 Alignment) override
+		{
+			if (Count > 0)
+			{
+				CountAlloc();
+			}
+			return this->Inner->Realloc(Original, Count, Alignment);
+		}
+
+		virtual void *TryRealloc(void *Original, SIZE_T Count, uint32 Alignment) override
+		{
+			if (Count > 0)
+			{
+				CountAlloc();
+			}
+			return this->Inner->TryRealloc(Original, Count, Alignment);
+		}
+
+		virtual void Free(void *Original) override
+		{
+			this->Inner->Free(Original);
+		}
+
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override
+		{
+			return this->Inner->QuantizeSize(Count, Alignment);
+		}
+
+		virtual bool GetAllocationSize(void *Original, SIZE_T &SizeOut) override
+		{
+			return this->Inner->GetAllocationSize(Original, SizeOut);
+		}
+
+		virtual void Trim(bool bTrimThreadCaches) override
+		{
+			this->Inner->Trim(bTrimThreadCaches);
+		}
+
+		virtual void SetupTLSCachesOnCurrentThread() override
+		{
+			this->Inner->SetupTLSCachesOnCurrentThread();
+		}
+
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override
+		{
+			this->Inner->ClearAndDisableTLSCachesOnCurrentThread();
+		}
+
+		virtual void InitializeStatsMetadata() override
+		{
+			this->Inner->InitializeStatsMetadata();
+		}
+
+		virtual void UpdateStats() override
+		{
+			this->Inner->UpdateStats();
+		}
+
+		virtual void GetAllocatorStats(FGenericMemoryStats &OutStats) override
+		{
+			this->Inner->GetAllocatorStats(OutStats);
+		}
+
+		virtual void DumpAllocatorStats(FOutputDevice &Ar) override
+		{
+			this->Inner->DumpAllocatorStats(Ar);
+		}
+
+		virtual bool IsInternallyThreadSafe() const override
+		{
+			return this->Inner->IsInternallyThreadSafe();
+		}
+
+		virtual bool ValidateHeap() override
+		{
+			return this->Inner->ValidateHeap();
+		}
+
+		virtual bool Exec(UWorld *InWorld, const TCHAR *Cmd, FOutputDevice &Ar) override
+		{
+			return this->Inner->Exec(InWorld, Cmd, Ar);
+		}
+
+		virtual const TCHAR *GetDescriptiveName() override
+		{
+			return this->Inner->GetDescriptiveName();
+		}
+
+	private:
+		FMalloc *Inner;
+	};
+}
+
+FRingAllocCounter::FScope::FScope()
+{
+	++ScopeDepth;
+}
+
+FRingAllocCounter::FScope::~FScope()
+{
+	--ScopeDepth;
+}
+
+FRingAllocCounter::FPause::FPause()
+	: SavedDepth(ScopeDepth)
+{
+	ScopeDepth = 0;
+}
+
+FRingAllocCounter::FPause::~FPause()
+{
+	ScopeDepth = this->SavedDepth;
+}
+
+FRingAllocCounter &FRingAllocCounter::Get()
+{
+	static FRingAllocCounter Instance;
+	return Instance;
+}
+
+FRingAllocCounter::FRingAllocCounter()
+	: bInstalled(false), bRunning(false), WarmupFrames(0), Budget(0), FramesSeen(0), FramesChecked(0), FramesOver(0),
+	bFailedEarlier(false), LastCount(0), MaxFrameCount(0), MaxFrameNumber(0), RunStartCount(0)
+{
+}
+
+void FRingAllocCounter::BeginRun()
+{
+	check(IsInGameThread());
+	int32 Warmup = CVarAllocCheck.GetValueOnGameThread();
+	if (Warmup <= 0 && FParse::Param(FCommandLine::Get(), TEXT("RingAllocCheck")))
+	{
+		Warmup = DefaultWarmupFrames;
+	}
+	if (Warmup <= 0)
+	{
+		return;
+	}
+
+	// Other threads may be allocating. They keep using whichever allocator they read, and both end up in the same one.
+	if (!this->bInstalled)
+	{
+		GMalloc = new FCountingMalloc(GMalloc);
+		FCoreDelegates::OnEndFrame.AddRaw(this, &FRingAllocCounter::OnEndFrame);
+		this->bInstalled = true;
+	}
+
+	this->bRunning = true;
+	this->WarmupFrames = Warmup;
+	this->Budget = FMath::Max(CVarAllocBudget.GetValueOnGameThread(), 0);
+	this->FramesSeen = 0;
+	this->FramesChecked = 0;
+	this->FramesOver = 0;
+	this->MaxFrameCount = 0;
+	this->MaxFrameNumber = 0;
+	this->LastCount = AllocCount;
+	this->RunStartCount = AllocCount;
+	UE_LOG(LogTemp, Log, TEXT("Ring allocation check started: %d warm-up frames, budget %d per frame."), this->WarmupFrames, this->Budget);
+}
+
+void FRingAllocCounter::OnEndFrame()
+{
+	if (!this->bRunning)
+	{
+		return;
+	}
+	const int64 Count = AllocCount;
+	const int64 FrameCount = Count - this->LastCount;
+	this->LastCount = Count;
+	if (++this->FramesSeen <= this->WarmupFrames)
+	{
+		this->RunStartCount = Count;
+		return;
+	}
+
+	++this->FramesChecked;
+	if (FrameCount > this->MaxFrameCount)
+	{
+		this->MaxFrameCount = FrameCount;
+		this->MaxFrameNumber = GFrameCounter;
+	}
+	if (FrameCount > this->Budget && ++this->FramesOver <= MaxReportedFrames)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Ring pipeline allocated %lld times on frame %llu, budget %d."), FrameCount, GFrameCounter, this->Budget);
+	}
+}
+
+void FRingAllocCounter::EndRun(const TCHAR *Reason, bool bFinal)
+{
+	if (!this->bRunning)
+	{
+		return;
+	}
+	this->bRunning = false;
+
+	const bool bPassed = this->FramesOver == 0;
+	const int64 Total = AllocCount - this->RunStartCount;
+	UE_LOG(LogTemp, Log, TEXT("Ring allocation check (%s): %d frames checked after %d warm-up, %d over budget %d, %lld allocations, at most %lld on frame %llu."),
+		Reason, this->FramesChecked, FMath::Min(this->FramesSeen, this->WarmupFrames), this->FramesOver, this->Budget, Total,
+		this->MaxFrameCount, this->MaxFrameNumber);
+	if (!bPassed)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Ring allocation check failed: the ring pipeline allocates in steady play."));
+	}
+
+	if (!bFinal)
+	{
+		this->bFailedEarlier |= !bPassed;
+		return;
+	}
+	if (FParse::Param(FCommandLine::Get(), TEXT("RingAllocCheck")))
+	{
+		FPlatformMisc::RequestExitWithStatus(false, bPassed && !this->bFailedEarlier ? 0 : 1);
+	}
+	this->bFailedEarlier = false;
+}
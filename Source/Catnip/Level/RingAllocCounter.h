@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#define CATNIP_ALLOC_COUNTER !UE_BUILD_SHIPPING
+
+/**
+ * Counts heap allocations made inside the ring pipeline's scopes, on any thread, to check that it allocates nothing once warmed up.
+ * The counting allocator wraps GMalloc and is only installed when Catnip.AllocCheck is set or the game runs with -RingAllocCheck.
+ * After the warm-up frames, every frame in which the pipeline allocated more than Catnip.AllocBudget times is counted, and the
+ * result is logged when the run ends. With -RingAllocCheck the game exits once the run is over for good, with code 1 if any frame
+ * of it went over budget. A run reset in place only logs its window and starts counting again.
+ */
+class CATNIP_API FRingAllocCounter
+{
+public:
+	static FRingAllocCounter &Get();
+
+	// Starts checking a run, installing the counting allocator the first time. Does nothing if the check is off.
+	void BeginRun();
+
+	// Logs the run's result. Final is for the end of the track or of play, and is when -RingAllocCheck exits the game.
+	void EndRun(const TCHAR *Reason, bool bFinal = true);
+
+	/** Allocations made on this thread while a scope is open are counted. */
+	struct FScope
+	{
+		FScope();
+		~FScope();
+	};
+
+	/** Stops counting on this thread for code the pipeline calls out to, like delegate listeners. */
+	struct FPause
+	{
+		FPause();
+		~FPause();
+
+		int32 SavedDepth;
+	};
+
+private:
+	FRingAllocCounter();
+
+	void OnEndFrame();
+
+private:
+	bool bInstalled;
+	bool bRunning;
+
+	int32 WarmupFrames;
+	int32 Budget;
+	int32 FramesSeen;
+	int32 FramesChecked;
+	int32 FramesOver;
+	// A window before a reset went over budget. Kept for the exit code.
+	bool bFailedEarlier;
+
+	int64 LastCount;
+	int64 MaxFrameCount;
+	uint64 MaxFrameNumber;
+	int64 RunStartCount;
+};
+
+#if CATNIP_ALLOC_COUNTER
+#define RING_ALLOC_SCOPE() FRingAllocCounter::FScope PREPROCESSOR_JOIN(RingAllocScope, __LINE__)
+#define RING_ALLOC_PAUSE() FRingAllocCounter::FPause PREPROCESSOR_JOIN(RingAllocPause, __LINE__)
+#else
+#define RING_ALLOC_SCOPE()
+#define RING_ALLOC_PAUSE()
+#endif
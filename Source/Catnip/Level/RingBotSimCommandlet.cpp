@@ -0,0 +1,175 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingBotSimCommandlet.h"
+
+#include "RingSim.h"
+#include "TrackData.h"
+#include "RingHandler.h"
+#include "RingCommandletWorld.h"
+#include "Misc/FileHelper.h"
+#include "Async/ParallelFor.h"
+
+namespace
+{
+	// Spacing of the baked track. The same as the ring handler locates the pawn with.
+	constexpr float SampleSpacing = 100.0f;
+
+	// Beats listed as failed most, per run.
+	constexpr int32 NumHardestBeats = 3;
+
+	TArray<float> ParseList(const FString &List)
+	{
+		TArray<FString> Items;
+		List.ParseIntoArray(Items, TEXT(","));
+		TArray<float> Values;
+		for (const FString &Item : Items)
+		{
+			Values.Add(FCString::Atof(*Item));
+		}
+		return Values;
+	}
+}
+
+URingBotSimCommandlet::URingBotSimCommandlet()
+{
+	UCommandlet::IsClient = false;
+	UCommandlet::IsEditor = true;
+	UCommandlet::IsServer = false;
+	UCommandlet::LogToConsole = true;
+}
+
+int32 URingBotSimCommandlet::Main(const FString &Params)
+{
+#if WITH_EDITOR
+	FString TrackPath, DeviationList = TEXT("0.03,0.06,0.1"), AllowanceList, CsvFile;
+	int32 NumBots = 2048, Seed = 0;
+	FRingBotProfile Profile;
+	Profile.MissChance = 0.02f;
+	Profile.ExtraPressChance = 0.02f;
+	FParse::Value(*Params, TEXT("Track="), TrackPath);
+	FParse::Value(*Params, TEXT("Bots="), NumBots);
+	FParse::Value(*Params, TEXT("Deviations="), DeviationList, false);
+	FParse::Value(*Params, TEXT("Allowances="), AllowanceList, false);
+	FParse::Value(*Params, TEXT("Bias="), Profile.TimingBias);
+	FParse::Value(*Params, TEXT("Miss="), Profile.MissChance);
+	FParse::Value(*Params, TEXT("Extra="), Profile.ExtraPressChance);
+	FParse::Value(*Params, TEXT("Speed="), Profile.Speed);
+	FParse::Value(*Params, TEXT("Lives="), Profile.Lives);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("Csv="), CsvFile);
+	NumBots = FMath::Max(NumBots, 1);
+
+	UTrackData *Data = LoadObject<UTrackData>(nullptr, *TrackPath);
+	if (Data == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Bot sim: could not load track data '%s'."), *TrackPath);
+		return 1;
+	}
+
+	// The handler only bakes the track. Nothing below touches it or any other UObject.
+	FRingSimChart Chart;
+	bool bLoaded = false;
+	{
+		FRingCommandletWorld Fixture;
+		if (!Fixture.IsValid())
+		{
+			return 1;
+		}
+		bLoaded = Fixture.GetHandler()->LoadTrack(Data);
+		if (bLoaded)
+		{
+			Fixture.GetHandler()->BakeSimChart(Chart, SampleSpacing);
+		}
+	}
+	if (!bLoaded || !Chart.Track.IsBaked() || Chart.BeatRings.Num() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Bot sim: %s has no track or beats to play."), *TrackPath);
+		return 1;
+	}
+
+	const TArray<float> Deviations = ParseList(DeviationList);
+	TArray<float> Allowances = ParseList(AllowanceList);
+	if (Allowances.Num() == 0)
+	{
+		Allowances.Add(Chart.BeatAllowance);
+	}
+	const float TrackSeconds = Chart.Track.GetLength() / Profile.Speed;
+
+	UE_LOG(LogTemp, Display, TEXT("Bot sim of %s, %.0f units and %d beats, %.1f s at speed %.0f, %d bots per run:"),
+		*Data->GetName(), Chart.Track.GetLength(), Chart.BeatRings.Num(), TrackSeconds, Profile.Speed, NumBots);
+	UE_LOG(LogTemp, Display, TEXT("  %9s %9s %8s %8s %8s %8s %9s %8s  %s"), TEXT("deviation"), TEXT("allowance"), TEXT("cleared"),
+		TEXT("hits"), TEXT("fails"), TEXT("ignored"), TEXT("reached"), TEXT("speedup"), TEXT("failed most"));
+
+	FString Csv = TEXT("Deviation,Allowance,Bots,Cleared,MeanHits,MeanFails,MeanIgnored,MeanReached,HardestBeats\n");
+	TArray<FRingBotResult> Results;
+	Results.SetNum(NumBots);
+	for (float Allowance : Allowances)
+	{
+		Chart.BeatAllowance = Allowance;
+		for (float Deviation : Deviations)
+		{
+			Profile.TimingDeviation = Deviation;
+
+			// Bots share nothing but the chart, so each core plays its own.
+			const double StartTime = FPlatformTime::Seconds();
+			ParallelFor(NumBots, [&](int32 Bot)
+			{
+				RunRingBot(Chart, Profile, Seed + Bot, Results[Bot]);
+			});
+			const double WallSeconds = FPlatformTime::Seconds() - StartTime;
+
+			int32 NumCleared = 0;
+			int64 Hits = 0, Fails = 0, Ignored = 0;
+			double Reached = 0.0;
+			double PlayedSeconds = 0.0;
+			TArray<int32> BeatFails;
+			BeatFails.SetNumZeroed(Chart.BeatRings.Num());
+			for (const FRingBotResult &Result : Results)
+			{
+				NumCleared += Result.bCleared ? 1 : 0;
+				Hits += Result.Successes;
+				Fails += Result.Fails;
+				Ignored += Result.Ignored;
+				Reached += FMath::Clamp(Result.Distance / Chart.Track.GetLength(), 0.0f, 1.0f);
+				PlayedSeconds += FMath::Max(Result.Distance, 0.0f) / Profile.Speed;
+				for (int32 Beat : Result.FailedBeats)
+				{
+					++BeatFails[Beat];
+				}
+			}
+
+			TArray<int32> Hardest;
+			for (int32 i = 0; i < BeatFails.Num(); ++i)
+			{
+				Hardest.Add(i);
+			}
+			Hardest.Sort([&](int32 A, int32 B) { return BeatFails[A] != BeatFails[B] ? BeatFails[A] > BeatFails[B] : A < B; });
+			FString HardestText, HardestCsv;
+			for (int32 i = 0; i < FMath::Min(NumHardestBeats, Hardest.Num()) && BeatFails[Hardest[i]] > 0; ++i)
+			{
+				const int32 Beat = Hardest[i];
+				HardestText += FString::Printf(TEXT("%sring %d (%.0f%%)"), i > 0 ? TEXT(", ") : TEXT(""),
+					Chart.BeatRings[Beat], 100.0f * BeatFails[Beat] / NumBots);
+				HardestCsv += FString::Printf(TEXT("%s%d"), i > 0 ? TEXT(" ") : TEXT(""), Chart.BeatRings[Beat]);
+			}
+
+			const float Cleared = 100.0f * NumCleared / NumBots;
+			const double Speedup = WallSeconds > 0.0 ? PlayedSeconds / WallSeconds : 0.0;
+			UE_LOG(LogTemp, Display, TEXT("  %9.3f %9.0f %7.1f%% %8.1f %8.2f %8.2f %8.1f%% %7.0fx  %s"), Deviation, Allowance, Cleared,
+				double(Hits) / NumBots, double(Fails) / NumBots, double(Ignored) / NumBots, 100.0 * Reached / NumBots, Speedup, *HardestText);
+			Csv += FString::Printf(TEXT("%.3f,%.0f,%d,%.4f,%.2f,%.2f,%.2f,%.4f,%s\n"), Deviation, Allowance, NumBots, Cleared / 100.0f,
+				double(Hits) / NumBots, double(Fails) / NumBots, double(Ignored) / NumBots, Reached / NumBots, *HardestCsv);
+		}
+	}
+
+	if (!CsvFile.IsEmpty() && !FFileHelper::SaveStringToFile(Csv, *CsvFile))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Bot sim: could not write %s."), *CsvFile);
+		return 1;
+	}
+	return 0;
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,28 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "RingBotSimCommandlet.generated.h"
+
+/**
+ * Plays a track with thousands of simulated players in parallel, far faster than real time, to check its difficulty and timing windows.
+ *
+ * UE4Editor-Cmd Catnip.uproject -run=RingBotSim -Track=<TrackData> [-Bots=2048] [-Deviations=0.03,0.06,0.1] [-Allowances=<Units,...>]
+ *     [-Bias=0] [-Miss=0.02] [-Extra=0.02] [-Speed=1600] [-Lives=9] [-Seed=0] [-Csv=<File>]
+ *
+ * Bots press around every beat with a normally distributed timing error of the given deviation in seconds, sometimes
+ * skip a beat or press between two. Every deviation is run against every beat allowance, the handler's own by default.
+ * Results give the share of bots clearing the track, their hits and fails, and the beats failed most. Obstacles aren't simulated.
+ */
+UCLASS()
+class CATNIP_API URingBotSimCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	URingBotSimCommandlet();
+
+	virtual int32 Main(const FString &Params) override;
+};
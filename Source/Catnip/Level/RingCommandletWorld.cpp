@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingCommandletWorld.h"
+
+#include "RingHandler.h"
+#include "Engine/World.h"
+#include "Misc/PackageName.h"
+
+#define COMMANDLET_HANDLER_CLASS TEXT("/Game/Blueprints/Level/BP_RingHandler.BP_RingHandler_C")
+
+FRingCommandletWorld::FRingCommandletWorld(UPackage *Package)
+	: World(nullptr), Handler(nullptr)
+{
+	UClass *HandlerClass = LoadClass<ARingHandler>(nullptr, COMMANDLET_HANDLER_CLASS);
+	if (HandlerClass == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not load the ring handler class %s."), COMMANDLET_HANDLER_CLASS);
+		return;
+	}
+
+	if (Package != nullptr)
+	{
+		this->World = UWorld::CreateWorld(EWorldType::Inactive, false, FName(*FPackageName::GetShortName(Package)), Package);
+		this->World->SetFlags(RF_Public | RF_Standalone);
+	}
+	else
+	{
+		this->World = UWorld::CreateWorld(EWorldType::Inactive, false);
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	this->Handler = this->World->SpawnActor<ARingHandler>(HandlerClass, FVector::ZeroVector, FRotator::ZeroRotator, SpawnParameters);
+	ensure(this->Handler != nullptr);
+}
+
+FRingCommandletWorld::~FRingCommandletWorld()
+{
+	if (this->World != nullptr)
+	{
+		this->World->DestroyWorld(false);
+		this->World->RemoveFromRoot();
+	}
+}
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UWorld;
+class UPackage;
+class ARingHandler;
+
+/**
+ * Inactive world with one ring handler in it, for commandlets working on tracks outside a game.
+ * The handler is the game's BP_RingHandler, as only the Blueprint sets the default ring mesh and material.
+ * The world is destroyed with this.
+ */
+class CATNIP_API FRingCommandletWorld
+{
+public:
+	// With a package, the world is a map that can be saved to it.
+	explicit FRingCommandletWorld(UPackage *Package = nullptr);
+
+	~FRingCommandletWorld();
+
+	FRingCommandletWorld(const FRingCommandletWorld&) = delete;
+	FRingCommandletWorld &operator=(const FRingCommandletWorld&) = delete;
+
+	// False if the handler class couldn't be loaded or spawned. The error is logged.
+	FORCEINLINE bool IsValid() const
+	{
+		return this->Handler != nullptr;
+	}
+
+	FORCEINLINE UWorld *GetWorld() const
+	{
+		return this->World;
+	}
+
+	FORCEINLINE ARingHandler *GetHandler() const
+	{
+		return this->Handler;
+	}
+
+private:
+	UWorld *World;
+	ARingHandler *Handler;
+};
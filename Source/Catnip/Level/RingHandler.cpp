@@ -4,41 +4,102 @@
 #include "RingHandler.h"
 
 #include "Ring.h"
+#include "TrackData.h"
+#include "TrackManifest.h"
+#include "RingAllocCounter.h"
+#include "RingHitchDetector.h"
+#include "RingTrace.h"
 #include "Engine/World.h"
 #include "DrawDebugHelpers.h"
 #include "Engine/StaticMesh.h"
-#include "ConstructorHelpers.h"
+#include "Game/BeatTelemetry.h"
 #include "Game/DefaultGameMode.h"
+#include "HAL/IConsoleManager.h"
+#include "Camera/PlayerCameraManager.h"
+#include "GameFramework/WorldSettings.h"
 #include "Components/SplineComponent.h"
+#include "GameFramework/PlayerController.h"
 
 #if WITH_EDITOR
 #include "Player/CatCharacter.h"
 #include "Kismet/GameplayStatics.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Components/InstancedStaticMeshComponent.h"
 #endif
 
-#define CONSTRUCTOR_RING_CLASS TEXT("/Game/Blueprints/Level/BP_Ring")
+#define CONSTRUCTOR_RING_CLASS TEXT("/Game/Blueprints/Level/BP_Ring.BP_Ring_C")
+
+static TAutoConsoleVariable<int32> CVarAsyncRingUpdate(TEXT("Catnip.AsyncRingUpdate"), 1,
+	TEXT("Run the ring window simulation on a worker thread between the game mode tick and the ring handler tick."));
+
+// Distance between samples of the track the pawn is located on. Far below the beat allowance.
+static constexpr float SimTrackSpacing = 100.0f;
+
+static TAutoConsoleVariable<int32> CVarRingCulling(TEXT("Catnip.RingCulling"), 1,
+	TEXT("Hide and stop updating rings outside the rail camera view."));
+
+bool FRingView::IntersectsSphere(const FVector &Center, float Radius) const
+{
+	// Distance of the sphere from each side plane of the view, measured in view space.
+	const FVector Offset = Center - this->Location;
+	const float X = FVector::DotProduct(Offset, this->Forward);
+	if (X < -Radius)
+	{
+		return false;
+	}
+	const float Y = FMath::Abs(FVector::DotProduct(Offset, this->Right));
+	if (Y - X * this->TanHalfWidth > Radius * FMath::Sqrt(1.0f + FMath::Square(this->TanHalfWidth)))
+	{
+		return false;
+	}
+	const float Z = FMath::Abs(FVector::DotProduct(Offset, this->Up));
+	return Z - X * this->TanHalfHeight <= Radius * FMath::Sqrt(1.0f + FMath::Square(this->TanHalfHeight));
+}
 
 ARingHandler::ARingHandler()
 {
-	static ConstructorHelpers::FClassFinder<ARing> ConstructorRingClass = ConstructorHelpers::FClassFinder<ARing>(CONSTRUCTOR_RING_CLASS);
-	this->RingClass = ensure(ConstructorRingClass.Succeeded()) ? ConstructorRingClass.Class : ARing::StaticClass();
+	this->RingClass = TSoftClassPtr<ARing>(FSoftObjectPath(CONSTRUCTOR_RING_CLASS));
 
 	this->bDisableObstacles = false;
 	this->bDisableBeatRings = false;
 	this->FailImmunityDuration = 1.0f;
-	this->FailImmunityCounter = 0.0f;
 
 	this->bCompleted = false;
+	this->bTrackContinues = false;
 	this->CurrentPawnDistance = 0.0f;
-	this->NextBeatRingIndex = -1;
-	this->LastFailRing = -1;
-	this->LastSuccessRing = -1;
 	//this->bNextBeatRingCompleted = false;
 	this->BeatActionDistanceAllowance = 650.0f;
 	this->ObstacleSpawnChancePercentage = 1.0f;
+	this->TrackSeed = 0;
 
 	this->RingDistance = 500.0f;
 	this->RingFadeDistance = 10000.0f;
+	this->RingActorOpacity = 0.0f;
+	this->RingActorPoolSize = 0;
+	this->RingLodDistance = 4000.0f;
+	this->RingLodHysteresis = 1000.0f;
+	this->RingLodResolution = 4;
+	this->RingCullMargin = 300.0f;
+
+	auto AddQualityLevel = [&](float FadeDistanceScale, float LodDistanceScale, int32 MaxResolution, int32 SpawnBudget, int32 ObstacleForcedLod)
+	{
+		FRingQualityLevel &Level = this->QualityLevels.AddDefaulted_GetRef();
+		Level.FadeDistanceScale = FadeDistanceScale;
+		Level.LodDistanceScale = LodDistanceScale;
+		Level.MaxResolution = MaxResolution;
+		Level.SpawnBudget = SpawnBudget;
+		Level.ObstacleForcedLod = ObstacleForcedLod;
+	};
+	AddQualityLevel(1.0f, 1.0f, 0, 0, 0);
+	AddQualityLevel(0.8f, 0.6f, 24, 8, 0);
+	AddQualityLevel(0.6f, 0.4f, 16, 4, 2);
+	AddQualityLevel(0.45f, 0.2f, 8, 2, 3);
+	this->BaseFadeDistance = this->RingFadeDistance;
+	this->BaseLodDistance = this->RingLodDistance;
+	this->Leader = nullptr;
+	this->QualityMaxResolution = 0;
+	this->QualitySpawnBudget = 0;
+	this->QualityObstacleLod = 0;
 	//this->bDebugUpdateRings = false;
 	//this->bDebugDeleteRings = false;
 
@@ -48,6 +109,33 @@ ARingHandler::ARingHandler()
 	this->RingSpawnRotateSpeedMin = -25.0f;
 	this->RingSpawnRotateSpeedMax = 25.0f;
 
+	this->TrackManifest = nullptr;
+	this->TrackData = nullptr;
+	this->bDebugGenerateManifest = false;
+	this->bDebugExportTrack = false;
+#if WITH_EDITORONLY_DATA
+	this->bPreviewTrack = false;
+#endif
+
+	this->bEndlessMode = false;
+	this->EndlessSeed = 0;
+	this->EndlessSegmentLength = 2000.0f;
+	this->EndlessMaxTurnAngle = 25.0f;
+	this->EndlessMaxPitchAngle = 10.0f;
+	this->EndlessBeatSpacingMin = 4;
+	this->EndlessBeatSpacingMax = 10;
+	this->EndlessRuleInterval = 40;
+	this->EndlessRadiusMin = 350.0f;
+	this->EndlessRadiusMax = 700.0f;
+	this->EndlessRebaseDistance = 200000.0f;
+
+	this->TrackDistanceBase = 0.0;
+	this->BeatRingIndexBase = 0;
+	this->EndlessNextRuleRing = 0;
+	this->bUpdatePending = false;
+	this->bRunStartSaved = false;
+	this->RingClock = 0.0;
+
 	this->SceneComponent = UObject::CreateDefaultSubobject<USceneComponent>(TEXT("HandlerSceneComponent"));
 	Super::RootComponent = this->SceneComponent;
 
@@ -56,7 +144,9 @@ ARingHandler::ARingHandler()
 	this->SplineComponent->SetClosedLoop(false, false);
 	this->SplineComponent->SetupAttachment(Super::RootComponent);
 
+	// The game mode starts the ring update early in the frame. It's applied here, after physics.
 	Super::PrimaryActorTick.bCanEverTick = true;
+	Super::PrimaryActorTick.TickGroup = TG_PostPhysics;
 }
 
 FVector ARingHandler::GetLocationAtDistance(float Distance) const
@@ -87,9 +177,161 @@ FRotator ARingHandler::GetRotationAtDistance(float Distance) const
 	return this->SplineComponent->GetRotationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World);
 }
 
+namespace
+{
+	// Rule spans in the trace are keyed by the ring they started on and their place in it.
+	FORCEINLINE int64 GetRuleTraceId(int32 RingIndex, int32 RuleIndex)
+	{
+		return int64(RingIndex) * 256 + RuleIndex;
+	}
+
+	// Same as FInterpCurve::Eval, for a segment that is already known.
+	template<typename T>
+	T EvalSplineSegment(const FInterpCurvePoint<T> &P0, const FInterpCurvePoint<T> &P1, float Alpha)
+	{
+		const float Diff = P1.InVal - P0.InVal;
+		if (Diff <= 0.0f || P0.InterpMode == CIM_Constant)
+		{
+			return P0.OutVal;
+		}
+		if (P0.InterpMode == CIM_Linear)
+		{
+			return FMath::Lerp(P0.OutVal, P1.OutVal, Alpha);
+		}
+		return FMath::CubicInterp(P0.OutVal, P0.LeaveTangent * Diff, P1.OutVal, P1.ArriveTangent * Diff, Alpha);
+	}
+}
+
+void ARingHandler::GetTransformsAtDistances(TArrayView<const float> Distances, TArray<FVector> &OutLocations, TArray<FRotator> &OutRotations) const
+{
+	check(this->SplineComponent != nullptr);
+	const FSplineCurves &Curves = this->SplineComponent->SplineCurves;
+	const TArray<FInterpCurvePointFloat> &Reparam = Curves.ReparamTable.Points;
+	const TArray<FInterpCurvePointVector> &Positions = Curves.Position.Points;
+	const TArray<FInterpCurvePointQuat> &Rotations = Curves.Rotation.Points;
+
+	const int32 Num = Distances.Num();
+	OutLocations.SetNumUninitialized(Num, false);
+	OutRotations.SetNumUninitialized(Num, false);
+	if (Positions.Num() < 2 || Reparam.Num() == 0 || Rotations.Num() != Positions.Num())
+	{
+		for (int32 i = 0; i < Num; ++i)
+		{
+			OutLocations[i] = this->SplineComponent->GetLocationAtDistanceAlongSpline(Distances[i], ESplineCoordinateSpace::World);
+			OutRotations[i] = this->SplineComponent->GetRotationAtDistanceAlongSpline(Distances[i], ESplineCoordinateSpace::World);
+		}
+		return;
+	}
+
+	const FTransform &ComponentTransform = this->SplineComponent->GetComponentTransform();
+	const FVector UpVector = this->SplineComponent->GetDefaultUpVector(ESplineCoordinateSpace::Local);
+	const int32 LastSegment = Positions.Num() - 2;
+
+	const VectorRegister One = VectorSetFloat1(1.0f);
+	const VectorRegister Two = VectorSetFloat1(2.0f);
+	const VectorRegister Three = VectorSetFloat1(3.0f);
+	const VectorRegister Four = VectorSetFloat1(4.0f);
+	const VectorRegister Six = VectorSetFloat1(6.0f);
+
+	int32 ReparamIndex = 0;
+	for (int32 Base = 0; Base < Num; Base += 4)
+	{
+		const int32 Count = FMath::Min(4, Num - Base);
+		MS_ALIGN(16) float Alpha[4] GCC_ALIGN(16) = { 0.0f, 0.0f, 0.0f, 0.0f };
+		int32 Segment[4] = { 0, 0, 0, 0 };
+
+		// Distance to input key. Distances are sorted, so the reparam table is only ever walked forward.
+		for (int32 Lane = 0; Lane < Count; ++Lane)
+		{
+			const float Distance = Distances[Base + Lane];
+			checkSlow(Base + Lane == 0 || Distance >= Distances[Base + Lane - 1]);
+			while (ReparamIndex + 1 < Reparam.Num() && Reparam[ReparamIndex + 1].InVal <= Distance)
+			{
+				++ReparamIndex;
+			}
+			const FInterpCurvePointFloat &R0 = Reparam[ReparamIndex];
+			float Key = R0.OutVal;
+			if (ReparamIndex + 1 < Reparam.Num() && Distance > R0.InVal)
+			{
+				const FInterpCurvePointFloat &R1 = Reparam[ReparamIndex + 1];
+				Key = FMath::Lerp(R0.OutVal, R1.OutVal, (Distance - R0.InVal) / (R1.InVal - R0.InVal));
+			}
+
+			const int32 Index = FMath::Clamp(FMath::FloorToInt(Key), 0, LastSegment);
+			const float Diff = Positions[Index + 1].InVal - Positions[Index].InVal;
+			Segment[Lane] = Index;
+			Alpha[Lane] = Diff > 0.0f ? FMath::Clamp((Key - Positions[Index].InVal) / Diff, 0.0f, 1.0f) : 0.0f;
+		}
+
+		// Hermite basis and its derivative for four points at once.
+		MS_ALIGN(16) float H00[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float H10[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float H01[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float H11[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float D00[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float D10[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float D11[4] GCC_ALIGN(16);
+		{
+			const VectorRegister T = VectorLoadAligned(Alpha);
+			const VectorRegister T2 = VectorMultiply(T, T);
+			const VectorRegister T3 = VectorMultiply(T2, T);
+			VectorStoreAligned(VectorAdd(VectorSubtract(VectorMultiply(Two, T3), VectorMultiply(Three, T2)), One), H00);
+			VectorStoreAligned(VectorAdd(VectorSubtract(T3, VectorMultiply(Two, T2)), T), H10);
+			VectorStoreAligned(VectorSubtract(VectorMultiply(Three, T2), VectorMultiply(Two, T3)), H01);
+			VectorStoreAligned(VectorSubtract(T3, T2), H11);
+			VectorStoreAligned(VectorSubtract(VectorMultiply(Six, T2), VectorMultiply(Six, T)), D00);
+			VectorStoreAligned(VectorAdd(VectorSubtract(VectorMultiply(Three, T2), VectorMultiply(Four, T)), One), D10);
+			VectorStoreAligned(VectorSubtract(VectorMultiply(Three, T2), VectorMultiply(Two, T)), D11);
+		}
+
+		for (int32 Lane = 0; Lane < Count; ++Lane)
+		{
+			const int32 Index = Segment[Lane];
+			const FInterpCurvePointVector &P0 = Positions[Index], &P1 = Positions[Index + 1];
+			const float Diff = P1.InVal - P0.InVal;
+
+			FVector Location, Derivative;
+			if (Diff > 0.0f && P0.IsCurveKey())
+			{
+				const VectorRegister VP0 = VectorLoadFloat3(&P0.OutVal);
+				const VectorRegister VP1 = VectorLoadFloat3(&P1.OutVal);
+				const VectorRegister VT0 = VectorMultiply(VectorLoadFloat3(&P0.LeaveTangent), VectorSetFloat1(Diff));
+				const VectorRegister VT1 = VectorMultiply(VectorLoadFloat3(&P1.ArriveTangent), VectorSetFloat1(Diff));
+
+				VectorRegister VLocation = VectorMultiply(VP0, VectorSetFloat1(H00[Lane]));
+				VLocation = VectorMultiplyAdd(VT0, VectorSetFloat1(H10[Lane]), VLocation);
+				VLocation = VectorMultiplyAdd(VP1, VectorSetFloat1(H01[Lane]), VLocation);
+				VLocation = VectorMultiplyAdd(VT1, VectorSetFloat1(H11[Lane]), VLocation);
+
+				// D01 is -D00.
+				VectorRegister VDerivative = VectorMultiply(VectorSubtract(VP0, VP1), VectorSetFloat1(D00[Lane]));
+				VDerivative = VectorMultiplyAdd(VT0, VectorSetFloat1(D10[Lane]), VDerivative);
+				VDerivative = VectorMultiplyAdd(VT1, VectorSetFloat1(D11[Lane]), VDerivative);
+
+				VectorStoreFloat3(VLocation, &Location);
+				VectorStoreFloat3(VDerivative, &Derivative);
+				Derivative /= Diff;
+			}
+			else
+			{
+				Location = EvalSplineSegment(P0, P1, Alpha[Lane]);
+				Derivative = Diff > 0.0f && P0.InterpMode == CIM_Linear ? (P1.OutVal - P0.OutVal) / Diff : FVector::ZeroVector;
+			}
+
+			// Same construction as USplineComponent::GetQuaternionAtSplineInputKey.
+			const FQuat Quat = EvalSplineSegment(Rotations[Index], Rotations[Index + 1], Alpha[Lane]).GetNormalized();
+			const FQuat Rotation = FRotationMatrix::MakeFromXZ(Derivative.GetSafeNormal(), Quat.RotateVector(UpVector)).ToQuat();
+
+			OutLocations[Base + Lane] = ComponentTransform.TransformPosition(Location);
+			OutRotations[Base + Lane] = (ComponentTransform.GetRotation() * Rotation).Rotator();
+		}
+	}
+}
+
 FVector ARingHandler::FindLocationClosestTo(FVector Location) const
 {
 	check(this->SplineComponent != nullptr);
+	RING_HITCH_COUNT(ClosestPointQueries, 1);
 	return this->SplineComponent->FindLocationClosestToWorldLocation(Location, ESplineCoordinateSpace::World);
 }
 
@@ -97,589 +339,1555 @@ void ARingHandler::BeginPlay()
 {
 	Super::BeginPlay();
 
-	for (int32 i = 0; i < this->Rings.Num(); ++i)
+#if CATNIP_HITCH_DETECTOR
+	// Create the detector on the game thread before any update task counts into it.
+	FRingHitchDetector::Get();
+#endif
+
+	this->ClearRings();
+
+#if WITH_EDITOR
+	this->ClearPreview();
+#endif
+
+	if (this->TrackData != nullptr && this->TrackData->HasTrack())
 	{
-		if (this->Rings[i] != nullptr)
-		{
-			this->Rings[i]->Destroy();
-		}
+		this->TrackData->ApplyToSpline(this->SplineComponent);
+		this->SpawnRuleTable = this->TrackData->GetSpawnRuleTable();
+		this->BeatChart = this->TrackData->GetBeatChart();
+		this->TrackSeed = this->TrackData->GetTrackSeed();
+		this->RingDistance = this->TrackData->GetRingDistance();
 	}
-	this->Rings.Empty();
-	this->ActiveRules.Empty();
 
-	this->SpawnState.Color = FColor(45, 195, 220);
-	this->SpawnState.Mesh = this->RingMeshDefault;
-	this->SpawnState.MeshType = ERingMeshType::MultipleMesh;
-	this->SpawnState.Radius = this->RingSpawnRadius;
-	this->SpawnState.Resolution = this->RingSpawnResolution;
-	this->SpawnState.RotationOffset = this->RingSpawnRotationOffset;
-	this->SpawnState.OffsetType = ERingOffsetType::Random;
-	this->SpawnState.RotationSpeedMin = this->RingSpawnRotateSpeedMin;
-	this->SpawnState.RotationSpeedMax = this->RingSpawnRotateSpeedMax;
-	this->SpawnState.RotationForceRerollMin = -1.0f;
-	this->SpawnState.MaterialInterface = this->RingMaterialInterface;
-	this->SpawnState.bSpawnObstacle = false;
+	this->BaseFadeDistance = this->RingFadeDistance;
+	this->BaseLodDistance = this->RingLodDistance;
+	this->QualityGovernor.Reset(this->QualityLevels.Num());
+	this->ApplyQualityLevel(0);
+
+	this->ApplySpawnRuleTable();
+	this->StartTrack();
+	this->bRunStartSaved = false;
+	this->FillRingActorPool();
+
+#if CATNIP_ALLOC_COUNTER
+	if (this->Leader == nullptr)
+	{
+		FRingAllocCounter::Get().BeginRun();
+	}
+#endif
 }
 
-void ARingHandler::FailRing(int32 Ring)
+void ARingHandler::FillRingActorPool()
 {
-	if (this->FailImmunityCounter < this->FailImmunityDuration)
+	UClass *Class = this->RingClass.Get();
+	if (Class == nullptr)
 	{
 		return;
 	}
-	if (Ring != -1)
+
+	// Rings take pooled actors, so steady play doesn't spawn any.
+	const int32 PoolSize = this->RingActorPoolSize > 0 ? this->RingActorPoolSize : this->GetWindowRingCount();
+	FActorSpawnParameters Params;
+	Params.Owner = this;
+	Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	while (this->RingActorPool.Num() < PoolSize)
 	{
-		if (this->LastFailRing == Ring)
+		ARing *Ring = Super::GetWorld()->SpawnActor<ARing>(Class, Super::GetActorLocation(), Super::GetActorRotation(), Params);
+		if (!ensure(Ring != nullptr))
 		{
-			return;
+			break;
 		}
-		this->LastFailRing = Ring;
+		Ring->ReleaseRing();
+		this->RingActorPool.Add(Ring);
 	}
-	this->OnBeatRingFail.Broadcast(Ring);
-	this->FailImmunityCounter = 0.0f;
-	//UE_LOG(LogClass, Log, TEXT("Fail Ring: %d"), Ring);
 }
 
-void ARingHandler::Tick(float DeltaTime)
+bool ARingHandler::LoadTrack(UTrackData *Data)
 {
-	Super::Tick(DeltaTime);
+	if (Data == nullptr || !Data->HasTrack())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("LoadTrack was given no track data."));
+		return false;
+	}
 
-	if (this->FailImmunityCounter < this->FailImmunityDuration)
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
+	this->ClearRings();
+
+	const double StartTime = FPlatformTime::Seconds();
+	Data->ApplyToSpline(this->SplineComponent);
+	this->SpawnRuleTable = Data->GetSpawnRuleTable();
+	this->BeatChart = Data->GetBeatChart();
+	this->TrackSeed = Data->GetTrackSeed();
+	this->RingDistance = Data->GetRingDistance();
+	this->TrackData = Data;
+
+	this->SpawnRuleMap.Reset();
+	this->BeatSpawnState = FRingBeatSpawnState();
+	this->ApplySpawnRuleTable();
+	this->StartTrack();
+	this->bRunStartSaved = false;
+
+	UE_LOG(LogTemp, Log, TEXT("Loaded track %s, %d points, in %.2f ms."),
+		*Data->GetName(), Data->GetNumPoints(), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	return true;
+}
+
+void ARingHandler::ResetRun()
+{
+	const double StartTime = FPlatformTime::Seconds();
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
+	this->ClearRings();
+
+	// Only endless runs change the rules, beats and spline as they go.
+	if (this->bRunStartSaved)
 	{
-		this->FailImmunityCounter += DeltaTime;
+		this->SpawnRuleMap = this->RunStartRuleMap;
+		this->BeatSpawnState.Rings = this->RunStartBeatRings;
+		if (this->bEndlessMode)
+		{
+			this->SplineComponent->SplineCurves = this->RunStartCurves;
+			this->SplineComponent->MarkRenderStateDirty();
+		}
 	}
+	this->StartTrack();
+
+#if CATNIP_ALLOC_COUNTER
+	// Only starts the counting window over. The game exits on track completion or end play.
+	FRingAllocCounter::Get().EndRun(TEXT("run reset"), false);
+	FRingAllocCounter::Get().BeginRun();
+#endif
+	UE_LOG(LogTemp, Log, TEXT("Ring handler reset in %.2f ms."), (FPlatformTime::Seconds() - StartTime) * 1000.0);
 }
 
-void ARingHandler::RegisterAction()
+void ARingHandler::PlaceTrackStart(const FVector &Location, const FQuat &Rotation)
 {
-	if (this->NextBeatRingIndex == -1 || this->NextBeatRingIndex >= this->BeatSpawnState.Rings.Num() || this->CurrentPawnDistance < 0.0f)
+	this->WaitForUpdate();
+	const FVector StartLocation = this->SplineComponent->GetLocationAtSplinePoint(0, ESplineCoordinateSpace::Local);
+	const FQuat StartRotation = this->SplineComponent->GetQuaternionAtSplinePoint(0, ESplineCoordinateSpace::Local);
+	const FQuat ActorRotation = Rotation * StartRotation.Inverse();
+	Super::SetActorLocationAndRotation(Location - ActorRotation.RotateVector(StartLocation), ActorRotation);
+
+	// The baked track is in world space.
+	if (!this->bEndlessMode)
 	{
-		return;
+		this->BakeSimTrack(this->SimTrack, SimTrackSpacing);
 	}
-	auto DistanceToRing = [&](int32 Index)
+}
+
+void ARingHandler::ReleaseTrack()
+{
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
+	this->ClearRings();
+	this->EndActiveRuleTraces();
+
+	// Emptied rather than reset, so a released track holds no memory.
+	this->SpawnRuleMap.Empty();
+	this->ActiveRules.Empty();
+	this->RadiusProfileRules.Empty();
+	this->RadiusBaseRules.Empty();
+	this->BeatSpawnState = FRingBeatSpawnState();
+	this->RunStartRuleMap.Empty();
+	this->RunStartBeatRings.Empty();
+	this->bRunStartSaved = false;
+	this->RadiusProfile.Empty(this->RingSpawnRadius);
+	this->SimTrack.Empty();
+	this->SplineComponent->ClearSplinePoints();
+	this->TrackData = nullptr;
+	this->bTrackContinues = false;
+	this->bCompleted = true;
+}
+
+void ARingHandler::SaveRunStart()
+{
+	this->RunStartRuleMap = this->SpawnRuleMap;
+	this->RunStartBeatRings = this->BeatSpawnState.Rings;
+	if (this->bEndlessMode)
 	{
-		return FMath::Abs(this->CurrentPawnDistance - this->BeatSpawnState.Rings[Index] * this->RingDistance);
-	};
+		this->RunStartCurves = this->SplineComponent->SplineCurves;
+	}
+	this->bRunStartSaved = true;
+}
+
+void ARingHandler::StartTrack()
+{
+	this->ResetSpawnState();
+	this->ResetRadiusProfile();
+
+	this->bCompleted = false;
+	this->CurrentPawnDistance = 0.0f;
+	this->BeatJudge.Init(this->RingDistance, this->BeatActionDistanceAllowance, this->FailImmunityDuration);
 
-	if (DistanceToRing(this->NextBeatRingIndex) <= this->BeatActionDistanceAllowance)
+	this->TrackDistanceBase = 0.0;
+	this->BeatRingIndexBase = 0;
+	this->RingClock = 0.0;
+	for (FRingSpawnKeyframe &Keyframe : this->SpawnKeyframes)
+	{
+		Keyframe.RingIndex = INDEX_NONE;
+	}
+	this->Rings.Reserve(this->GetWindowRingCount());
+	this->ActiveRules.Reserve(32);
+	this->RadiusProfileRules.Reserve(32);
+	this->RadiusBaseRules.Reserve(32);
+	if (this->bEndlessMode)
 	{
-		this->OnBeatRingSuccess.Broadcast(this->NextBeatRingIndex);
-		this->LastSuccessRing = this->NextBeatRingIndex;
-		++this->NextBeatRingIndex;
+		int32 LastPoint = this->SplineComponent->GetNumberOfSplinePoints() - 1;
+		check(LastPoint > 0);
+
+		this->EndlessStream.Initialize(this->EndlessSeed);
+		this->EndlessHeading = this->SplineComponent->GetRotationAtSplinePoint(LastPoint, ESplineCoordinateSpace::World);
+		this->EndlessHeading.Roll = 0.0f;
+		this->EndlessHeading.Pitch = FMath::Clamp(this->EndlessHeading.Pitch, -this->EndlessMaxPitchAngle, this->EndlessMaxPitchAngle);
+		this->EndlessNextRuleRing = FMath::CeilToInt(this->SplineComponent->GetSplineLength() / this->RingDistance);
+		this->SimTrack.Reset(0.0f, 0);
 	}
 	else
 	{
-		// Find distance to closest beat ring.
-		int32 ClosestIndex = 0;
-		check(this->BeatSpawnState.Rings.Num() > 0);
-		for (int32 i = 1; i < this->BeatSpawnState.Rings.Num(); ++i)
-		{
-			if (DistanceToRing(i) < DistanceToRing(ClosestIndex))
-			{
-				ClosestIndex = i;
-			}
-		}
+		this->ExtendRadiusProfile(FMath::CeilToInt(this->SplineComponent->GetSplineLength() / this->RingDistance));
+		this->BakeSimTrack(this->SimTrack, SimTrackSpacing);
+	}
+}
 
-		// If distance to closest beat is greater than x2 allowance.
-		if (DistanceToRing(ClosestIndex) > this->BeatActionDistanceAllowance * 3.0f)
-		{
-			//UE_LOG(LogTemp, Log, TEXT("Fail: Too far."));
-			this->FailRing(-1);
-			return;
-		}
+void ARingHandler::ResetSpawnState()
+{
+	this->EndActiveRuleTraces();
+	this->ActiveRules.Reset();
 
-		// If we're just before the next beat, fail the next beat.
-		if (ClosestIndex == this->NextBeatRingIndex)
-		{
-			//UE_LOG(LogTemp, Log, TEXT("Fail: Just before next beat."));
-			this->FailRing(this->BeatSpawnState.Rings[this->NextBeatRingIndex]);
-			return;
-		}
+	this->MakeDefaultSpawnState(this->SpawnState);
+	this->InitialSpawnState = this->SpawnState;
+}
 
-		// If we just did an action after succeeding a ring.
-		if (ClosestIndex == this->LastSuccessRing)
-		{
-			//UE_LOG(LogTemp, Log, TEXT("Fail: Just after last beat."));
-			this->FailRing(-1);
-			return;
-		}
+void ARingHandler::MakeDefaultSpawnState(FRingSpawnState &OutState) const
+{
+	OutState.Color = FColor(45, 195, 220);
+	OutState.Mesh = this->RingMeshDefault;
+	OutState.MeshType = ERingMeshType::MultipleMesh;
+	OutState.Radius = this->RingSpawnRadius;
+	OutState.Resolution = this->RingSpawnResolution;
+	OutState.RotationOffset = this->RingSpawnRotationOffset;
+	OutState.OffsetType = ERingOffsetType::Random;
+	OutState.OffsetCounter = 0.0f;
+	OutState.RotationSpeedMin = this->RingSpawnRotateSpeedMin;
+	OutState.RotationSpeedMax = this->RingSpawnRotateSpeedMax;
+	OutState.RotationForceRerollMin = -1.0f;
+	OutState.MaterialInterface = this->RingMaterialInterface;
+	OutState.bSpawnObstacle = false;
+}
 
-		// Otherwise, if we just did an action after failing a ring, do nothing.
-		//UE_LOG(LogTemp, Log, TEXT("Fail: Ignore"));
+void ARingHandler::ApplySpawnRuleTable()
+{
+	for (const FRingSpawnRuleEntry &Entry : this->SpawnRuleTable)
+	{
+		this->AddSpawnRule(Entry.OnRing, ARingHandler::MakeSpawnRule(Entry));
+	}
 
-		//this->OnBeatRingFail.Broadcast(-1);
+	const FRingBeatChart &Chart = this->BeatChart;
+	if (!Chart.Rings.IsEmpty())
+	{
+		this->SpawnRule_SetBeatRings(Chart.Rings, Chart.Meshes, Chart.MaterialInterface,
+			Chart.Color, Chart.ObstacleMeshes, Chart.ObstacleMaterialInterface);
 	}
 }
 
-FVector ARingHandler::RestrictPositionOffset(const FVector &SplinePosition, const FVector &PositionOffset, float RadiusShrink) const
+void ARingHandler::SetRewindDistance(float Distance)
 {
-	float SplineDistance = this->GetDistanceAtInputKey(this->SplineComponent->FindInputKeyClosestToWorldLocation(SplinePosition));
-	float RingExact = SplineDistance / this->RingDistance;
-	int32 RingMin = FMath::FloorToInt(RingExact), RingMax = FMath::CeilToInt(RingExact);
-	float RingRadiusMin = -1.0f, RingRadiusMax = -1.0f;
-	for (int32 i = 0; i < this->Rings.Num(); ++i)
-	{
-		if (this->Rings[i] == nullptr)
-		{
-			continue;
-		}
-		if (this->Rings[i]->GetRingIndex() == RingMin)
-		{
-			RingRadiusMin = this->Rings[i]->GetRingRadius();
-		}
-		if (this->Rings[i]->GetRingIndex() == RingMax)
-		{
-			RingRadiusMax = this->Rings[i]->GetRingRadius();
-		}
-	}
-	float Radius = this->RingSpawnRadius;
-	if (RingRadiusMin != -1.0f && RingRadiusMax != -1.0f)
+	this->WaitForUpdate();
+	const int32 Count = Distance > 0.0f ? FMath::CeilToInt(Distance / FMath::Max(this->RingDistance, 1.0f)) + this->GetWindowRingCount() : 0;
+	this->SpawnKeyframes.Reset(Count);
+	this->SpawnKeyframes.SetNum(Count);
+	for (FRingSpawnKeyframe &Keyframe : this->SpawnKeyframes)
 	{
-		Radius = FMath::Lerp(RingRadiusMin, RingRadiusMax, 1.0f - (RingExact - int32(RingExact)));
+		Keyframe.Rules.Reserve(32);
 	}
-	if (PositionOffset.SizeSquared() <= FMath::Square(Radius - RadiusShrink))
+}
+
+void ARingHandler::SaveRewindState(FRingRewindState &OutState) const
+{
+	OutState.Judge = this->BeatJudge.GetState();
+	OutState.Clock = this->RingClock;
+}
+
+bool ARingHandler::CanRewindTo(float Distance) const
+{
+	// Endless tracks are trimmed behind the pawn and may have moved the world origin since.
+	if (this->bEndlessMode || this->SpawnKeyframes.Num() == 0)
 	{
-		return PositionOffset;
+		return false;
 	}
-	return PositionOffset.GetSafeNormal() * (Radius - RadiusShrink);
+	int32 MinRing, MaxRing;
+	this->GetWindowAtDistance(Distance, MinRing, MaxRing);
+	return this->SpawnKeyframes[MinRing % this->SpawnKeyframes.Num()].RingIndex == MinRing;
 }
 
-#if 0
-void ARingHandler::UpdateRings()
+bool ARingHandler::RewindTo(const FRingRewindState &State, float Distance)
 {
-	this->DeleteRings();
+	if (!this->CanRewindTo(Distance))
+	{
+		return false;
+	}
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
+	this->ClearRings();
 
-	if (true)
+	this->BeatJudge.SetState(State.Judge);
+	this->RingClock = State.Clock;
+	this->CurrentPawnDistance = Distance;
+	this->bCompleted = false;
+
+	// Rules run from the state the first ring of the window started with, as they did when it first spawned.
+	int32 MinRing, MaxRing;
+	this->GetWindowAtDistance(Distance, MinRing, MaxRing);
+	const int32 NumKeyframes = this->SpawnKeyframes.Num();
+	const FRingSpawnKeyframe &First = this->SpawnKeyframes[MinRing % NumKeyframes];
+	this->SpawnState = First.State;
+	this->EndActiveRuleTraces();
+	this->ActiveRules.Reset();
+	this->ActiveRules.Append(First.Rules);
+#if CATNIP_RING_TRACE
+	for (const FActiveRingSpawnRule &Rule : this->ActiveRules)
 	{
-		return;
+		RING_TRACE_SPAN(Begin, "Rule", Super::GetUniqueID(), GetRuleTraceId(Rule.RingIndex, Rule.RuleIndex));
 	}
-	if (!ensure(this->RingDistance > 0.0f))
+#endif
+
+	// No update is in flight, so the task's arrays are free to place the rings with.
+	FRingUpdateTask &Task = this->UpdateTask;
+	Task.SpawnDistances.Reset();
+	for (int32 Index = MinRing; Index <= MaxRing; ++Index)
 	{
-		return;
+		Task.SpawnDistances.Add(this->GetDistanceAtRing(Index));
 	}
-	if (!ensure(this->RingStaticMeshes.Num() > 0))
+	this->GetTransformsAtDistances(Task.SpawnDistances, Task.SpawnLocations, Task.SpawnRotations);
+	Task.SpawnIndices.Reset();
+	Task.SpawnDistances.Reset();
+
+	for (int32 Index = MinRing; Index <= MaxRing; ++Index)
 	{
-		return;
+		// Spawning records the keyframe again. Rings further on than the restored step spawn from now.
+		FRingSpawnKeyframe &Keyframe = this->SpawnKeyframes[Index % NumKeyframes];
+		const bool bKept = Keyframe.RingIndex == Index && Keyframe.SpawnClock <= this->RingClock;
+		const double SpawnClock = bKept ? Keyframe.SpawnClock : this->RingClock;
+
+		this->SpawnRing(Index, Task.SpawnLocations[Index - MinRing], Task.SpawnRotations[Index - MinRing]);
+		Keyframe.SpawnClock = SpawnClock;
+
+		FRingRecord &Record = this->Rings.Last();
+		Record.Phase = FMath::Fmod(Record.RotationSpeed * float(this->RingClock - SpawnClock), 360.0f);
+		Record.Opacity = this->GetRingOpacity(Index, Distance);
+		this->UpdateRingLod(Record, Distance);
+		// Culling catches up on the next update.
+		if (Record.Opacity > this->RingActorOpacity && this->SpawnRingActor(Record) != nullptr)
+		{
+			Record.Actor->SetRingVisible(true);
+			this->ApplyRecordToActor(Record);
+		}
 	}
+	this->BuildQueuedSegments();
+	return true;
+}
 
-	float Length = this->SplineComponent->GetSplineLength();
-	for (float i = 0.0f; i < Length; i += this->RingDistance)
+void ARingHandler::CollectTrackAssets(TArray<FSoftObjectPath> &OutAssets) const
+{
+	auto AddAsset = [&](const UObject *Asset)
 	{
-		FVector Location = this->SplineComponent->GetLocationAtDistanceAlongSpline(i, ESplineCoordinateSpace::World);
-		FRotator Rotation = this->SplineComponent->GetRotationAtDistanceAlongSpline(i, ESplineCoordinateSpace::World);
+		if (Asset != nullptr)
+		{
+			OutAssets.AddUnique(FSoftObjectPath(Asset));
+		}
+	};
 
-		FActorSpawnParameters Params;
-		Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	if (!this->RingClass.IsNull())
+	{
+		OutAssets.AddUnique(this->RingClass.ToSoftObjectPath());
+	}
+	AddAsset(this->RingMeshDefault);
+	AddAsset(this->RingMaterialInterface);
 
-		ARing *Ring = Super::GetWorld()->SpawnActor<ARing>(this->RingClass, Location, Rotation, Params);
-		ensure(Ring != nullptr);
-		Ring->UpdatePoints(this->RingStaticMeshes[FMath::RandRange(0, this->RingStaticMeshes.Num() - 1)], this->RingRadius);
+	for (const FRingSpawnRuleEntry &Entry : this->SpawnRuleTable)
+	{
+		AddAsset(Entry.Mesh);
+		AddAsset(Entry.Material);
+	}
 
-		this->Rings.Add(Ring);
+	// Beat rings can only use what the chart provides, but which mesh each ring picks is decided at spawn time.
+	const FRingBeatChart &Chart = this->BeatChart;
+	for (const UStaticMesh *Next : Chart.Meshes)
+	{
+		AddAsset(Next);
+	}
+	for (const UStaticMesh *Next : Chart.ObstacleMeshes)
+	{
+		AddAsset(Next);
+	}
+	AddAsset(Chart.MaterialInterface);
+	AddAsset(Chart.ObstacleMaterialInterface);
+
+	// The pawn and feedback sounds of the game mode the map is played with.
+	const AWorldSettings *Settings = Super::GetWorld() != nullptr ? Super::GetWorld()->GetWorldSettings() : nullptr;
+	UClass *GameModeClass = Settings != nullptr && Settings->DefaultGameMode != nullptr ? Settings->DefaultGameMode.Get() : ADefaultGameMode::StaticClass();
+	if (GameModeClass->IsChildOf<ADefaultGameMode>())
+	{
+		GameModeClass->GetDefaultObject<ADefaultGameMode>()->CollectRunAssets(OutAssets);
 	}
 }
 
-void ARingHandler::DeleteRings()
+void ARingHandler::FailRing(int32 Ring)
 {
-	if (this->Rings.Num() == 0)
+	if (!this->BeatJudge.Fail(Ring))
 	{
 		return;
 	}
-	for (int32 i = this->Rings.Num() - 1; i >= 0; --i)
+	RING_ALLOC_PAUSE();
+	RING_TRACE(Instant, "BeatFail", Ring);
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().MarkBroadcast();
+#endif
+	this->OnBeatRingFail.Broadcast(Ring);
+	//UE_LOG(LogClass, Log, TEXT("Fail Ring: %d"), Ring);
+}
+
+void ARingHandler::HitObstacle(int32 RingIndex)
+{
+	FRingRecord *Record = this->FindRing(RingIndex);
+	if (Record == nullptr || Record->bObstacleHit)
 	{
-		if (this->Rings[i] == nullptr)
-		{
-			continue;
-		}
-		this->Rings[i]->Destroy();
+		return;
 	}
-	this->Rings.Empty();
+	Record->bObstacleHit = true;
+	RING_TRACE(Instant, "ObstacleHit", RingIndex);
+	this->FailRing(RingIndex + 1);
 }
-#endif
 
-ARingHandler* ARingHandler::SpawnRule_SetRadius(int32 OnRing, float NewRadius, int32 TransitionRings)
+FRingRecord *ARingHandler::FindRing(int32 RingIndex)
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			float &Memory = *SpawnRule.GetCache<float>();
-			if (SpawnRule.RingCounter <= 1)
-			{
-				Memory = SpawnState.Radius;
-			}
-			float Percentage = TransitionRings <= 0 ? 1.0f : FMath::Clamp(SpawnRule.RingCounter / float(TransitionRings + 1), 0.0f, 1.0f);
-			float NextRadius = Memory + (NewRadius - Memory) * FMath::Sin(Percentage * PI / 2.0f);
-			SpawnState.Radius = NextRadius;
-			return SpawnRule.RingCounter > TransitionRings;
-		}));
-	return this;
+	// Records are contiguous, so the index gives the position directly.
+	if (this->Rings.Num() == 0)
+	{
+		return nullptr;
+	}
+	int32 Position = RingIndex - this->Rings[0].Index;
+	return this->Rings.IsValidIndex(Position) ? &this->Rings[Position] : nullptr;
 }
 
-ARingHandler* ARingHandler::SpawnRule_SetMesh(int32 OnRing, UStaticMesh *NewMesh, UMaterialInterface *NewMaterial, ERingMeshType Type, bool bSingleRing)
+float ARingHandler::GetRingOpacity(int32 RingIndex, float PawnDistance) const
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			UStaticMesh *&MeshMemory = *SpawnRule.GetCache<UStaticMesh*>();
-			ERingMeshType &MeshTypeMemory = *SpawnRule.GetCache<ERingMeshType, sizeof(UStaticMesh*)>();
-			UMaterialInterface *&MeshMaterialMemory = *SpawnRule.GetCache<UMaterialInterface*, sizeof(UStaticMesh*) + sizeof(ERingMeshType)>();
-			if (SpawnRule.RingCounter <= 1)
-			{
-				MeshMemory = SpawnState.Mesh;
-				MeshTypeMemory = SpawnState.MeshType;
-				MeshMaterialMemory = SpawnState.MaterialInterface;
-			}
-
-			SpawnState.Mesh = NewMesh;
-			SpawnState.MeshType = Type;
-			SpawnState.MaterialInterface = NewMaterial;
-
-			if (!bSingleRing)
-			{
-				return true;
-			}
-			if (SpawnRule.RingCounter >= 2)
-			{
-				SpawnState.Mesh = MeshMemory;
-				SpawnState.MeshType = MeshTypeMemory;
-				SpawnState.MaterialInterface = MeshMaterialMemory;
-				return true;
-			}
-			return false;
-		}));
-	return this;
+	const float FadeTolerance = this->RingDistance * 2.0f;
+	float Fade = FMath::Clamp((this->GetDistanceAtRing(RingIndex) - FadeTolerance - PawnDistance) / this->RingFadeDistance, 0.0f, 1.0f);
+	return 1.0f - Fade;
 }
 
-ARingHandler* ARingHandler::SpawnRule_SetOffset(int32 OnRing, float Value, ERingOffsetType Type)
+void ARingHandler::UpdateRingLod(FRingRecord &Record, float PawnDistance) const
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			SpawnState.RotationOffset = Value;
-			SpawnState.OffsetType = Type;
-			if (Type == ERingOffsetType::Incremental)
-			{
-				SpawnState.OffsetCounter = 0.0f;
-			}
-			return true;
-		}));
-	return this;
+	const float Ahead = this->GetDistanceAtRing(Record.Index) - PawnDistance;
+	if (Record.Lod == 0 && Ahead > this->RingLodDistance + this->RingLodHysteresis)
+	{
+		Record.Lod = 1;
+	}
+	else if (Record.Lod != 0 && Ahead < this->RingLodDistance)
+	{
+		Record.Lod = 0;
+	}
+	Record.Resolution = Record.Lod == 0 ? Record.State.Resolution : FMath::Min(Record.State.Resolution, FMath::Max(this->RingLodResolution, 1));
+	if (this->QualityMaxResolution > 0)
+	{
+		Record.Resolution = FMath::Min(Record.Resolution, this->QualityMaxResolution);
+	}
 }
 
-ARingHandler* ARingHandler::SpawnRule_SetRotation(int32 OnRing, float MinSpeed, float MaxSpeed, float ForceRerollMin)
+void ARingHandler::ApplyQualityLevel(int32 Level)
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			SpawnState.RotationSpeedMin = MinSpeed;
-			SpawnState.RotationSpeedMax = MaxSpeed;
-			SpawnState.RotationForceRerollMin = ForceRerollMin;
-			return true;
-		}));
-	return this;
+	check(!this->UpdateEvent.IsValid());
+	if (!this->QualityLevels.IsValidIndex(Level))
+	{
+		return;
+	}
+	const FRingQualityLevel &Quality = this->QualityLevels[Level];
+	this->RingFadeDistance = FMath::Max(this->BaseFadeDistance * Quality.FadeDistanceScale, this->RingDistance);
+	this->RingLodDistance = this->BaseLodDistance * Quality.LodDistanceScale;
+	this->QualityMaxResolution = Quality.MaxResolution;
+	this->QualitySpawnBudget = Quality.SpawnBudget;
+	this->QualityObstacleLod = Quality.ObstacleForcedLod;
+
+	UE_LOG(LogTemp, Log, TEXT("Ring quality level %d: fade distance %.0f, LOD distance %.0f, max resolution %d, spawn budget %d, obstacle LOD %d."),
+		Level, this->RingFadeDistance, this->RingLodDistance, this->QualityMaxResolution, this->QualitySpawnBudget, this->QualityObstacleLod);
 }
 
-ARingHandler* ARingHandler::SpawnRule_SetColor(int32 OnRing, FColor Color, bool bSingleRing)
+void ARingHandler::ApplyWorldOffset(const FVector &InOffset, bool bWorldShift)
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			FColor &ColorMemory = *SpawnRule.GetCache<FColor>();
-			if (SpawnRule.RingCounter <= 1)
-			{
-				ColorMemory = SpawnState.Color;
-			}
-			SpawnState.Color = Color;
+	Super::ApplyWorldOffset(InOffset, bWorldShift);
+
+	// Actors are moved by the engine. Rings without one only know where to spawn it.
+	this->WaitForUpdate();
+	for (FRingRecord &Record : this->Rings)
+	{
+		Record.Location += InOffset;
+	}
+	for (FVector &Location : this->UpdateTask.SpawnLocations)
+	{
+		Location += InOffset;
+	}
+	this->SimTrack.ApplyOffset(InOffset);
+}
+
+void ARingHandler::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
+
+#if CATNIP_ALLOC_COUNTER
+	FRingAllocCounter::Get().EndRun(TEXT("end play"));
+#endif
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void ARingHandler::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	{
+		RING_ALLOC_SCOPE();
+		this->ApplyUpdate();
+	}
+
+	// Nothing is in flight between the apply and the next update, so settings the worker reads can change here.
+	// Followers copy their leader's governor, so the frame is measured once and a follower taking over carries on from it.
+	const int32 PreviousLevel = this->QualityGovernor.GetLevel();
+	if (this->Leader != nullptr)
+	{
+		this->QualityGovernor = this->Leader->QualityGovernor;
+	}
+	else
+	{
+		this->QualityGovernor.Update(DeltaTime);
+	}
+	if (this->QualityGovernor.GetLevel() != PreviousLevel)
+	{
+		this->ApplyQualityLevel(this->QualityGovernor.GetLevel());
+	}
+#if CATNIP_HITCH_DETECTOR
+	FRingHitchDetector::Get().GetFrame().QualityLevel = this->QualityGovernor.GetLevel();
+#endif
+
+	this->BeatJudge.Tick(DeltaTime);
+}
+
+void ARingHandler::RegisterAction()
+{
+	RING_ALLOC_SCOPE();
+	if (this->CurrentPawnDistance < 0.0f)
+	{
+		return;
+	}
+	const FRingBeatAction Action = this->BeatJudge.RegisterAction(this->BeatSpawnState.Rings, this->TrackDistanceBase + this->CurrentPawnDistance);
+	if (Action.BeatIndex == INDEX_NONE)
+	{
+		return;
+	}
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().MarkJudged(Action.Judgement, Action.BeatIndex + this->BeatRingIndexBase, Action.Error);
+#endif
+
+	if (Action.Judgement == EBeatJudgement::Success)
+	{
+		RING_ALLOC_PAUSE();
+		RING_TRACE(Instant, "BeatSuccess", Action.BeatIndex + this->BeatRingIndexBase);
+#if CATNIP_BEAT_TELEMETRY
+		FBeatTelemetry::Get().MarkBroadcast();
+#endif
+		this->OnBeatRingSuccess.Broadcast(Action.BeatIndex + this->BeatRingIndexBase);
+	}
+	else if (Action.Judgement == EBeatJudgement::Fail)
+	{
+		this->FailRing(Action.FailRing);
+	}
+	// Otherwise, if we just did an action after failing a ring, do nothing.
+}
+
+FVector ARingHandler::RestrictPositionOffset(float Distance, const FVector &PositionOffset, float RadiusShrink) const
+{
+	return this->RadiusProfile.RestrictOffset(this->GetExactRingAtDistance(Distance), PositionOffset, RadiusShrink);
+}
+
+#if 0
+void ARingHandler::UpdateRings()
+{
+	this->DeleteRings();
+
+	if (true)
+	{
+		return;
+	}
+	if (!ensure(this->RingDistance > 0.0f))
+	{
+		return;
+	}
+	if (!ensure(this->RingStaticMeshes.Num() > 0))
+	{
+		return;
+	}
+
+	float Length = this->SplineComponent->GetSplineLength();
+	for (float i = 0.0f; i < Length; i += this->RingDistance)
+	{
+		FVector Location = this->SplineComponent->GetLocationAtDistanceAlongSpline(i, ESplineCoordinateSpace::World);
+		FRotator Rotation = this->SplineComponent->GetRotationAtDistanceAlongSpline(i, ESplineCoordinateSpace::World);
+
+		FActorSpawnParameters Params;
+		Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+		ARing *Ring = Super::GetWorld()->SpawnActor<ARing>(this->RingClass, Location, Rotation, Params);
+		ensure(Ring != nullptr);
+		Ring->UpdatePoints(this->RingStaticMeshes[FMath::RandRange(0, this->RingStaticMeshes.Num() - 1)], this->RingRadius);
+
+		this->Rings.Add(Ring);
+	}
+}
+
+void ARingHandler::DeleteRings()
+{
+	if (this->Rings.Num() == 0)
+	{
+		return;
+	}
+	for (int32 i = this->Rings.Num() - 1; i >= 0; --i)
+	{
+		if (this->Rings[i] == nullptr)
+		{
+			continue;
+		}
+		this->Rings[i]->Destroy();
+	}
+	this->Rings.Empty();
+}
+#endif
 
-			if (!bSingleRing)
+ARingHandler* ARingHandler::SpawnRule_SetRadius(int32 OnRing, float NewRadius, int32 TransitionRings)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Radius;
+	Entry.Value = NewRadius;
+	Entry.Count = TransitionRings;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetMesh(int32 OnRing, UStaticMesh *NewMesh, UMaterialInterface *NewMaterial, ERingMeshType Type, bool bSingleRing)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Mesh;
+	Entry.Mesh = NewMesh;
+	Entry.Material = NewMaterial;
+	Entry.MeshType = Type;
+	Entry.bSingleRing = bSingleRing;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetOffset(int32 OnRing, float Value, ERingOffsetType Type)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Offset;
+	Entry.Value = Value;
+	Entry.OffsetType = Type;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetRotation(int32 OnRing, float MinSpeed, float MaxSpeed, float ForceRerollMin)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Rotation;
+	Entry.Value = MinSpeed;
+	Entry.ValueMax = MaxSpeed;
+	Entry.ForceRerollMin = ForceRerollMin;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetColor(int32 OnRing, FColor Color, bool bSingleRing)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Color;
+	Entry.Color = Color;
+	Entry.bSingleRing = bSingleRing;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetResolution(int32 OnRing, int32 Resolution)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Resolution;
+	Entry.Count = Resolution;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+ARingHandler *ARingHandler::SpawnRule_SetObstacle(int32 OnRing, UStaticMesh *ObstacleMesh, UMaterialInterface *ObstacleMaterial)
+{
+	FRingSpawnRuleEntry Entry;
+	Entry.Type = ERingSpawnRuleType::Obstacle;
+	Entry.Mesh = ObstacleMesh;
+	Entry.Material = ObstacleMaterial;
+	this->AddSpawnRule(OnRing, ARingHandler::MakeSpawnRule(Entry));
+	return this;
+}
+
+FRingSpawnRule ARingHandler::MakeSpawnRule(const FRingSpawnRuleEntry &Entry)
+{
+	// Each rule only captures what its effect reads.
+	switch (Entry.Type)
+	{
+	case ERingSpawnRuleType::Radius:
+	{
+		const float NewRadius = Entry.Value;
+		const int32 TransitionRings = Entry.Count;
+		return FRingSpawnRule::CreateLambda([NewRadius, TransitionRings](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
 			{
-				return true;
-			}
-			if (SpawnRule.RingCounter >= 2)
+				return ApplyRingRadiusRule(SpawnState, SpawnRule, NewRadius, TransitionRings);
+			});
+	}
+	case ERingSpawnRuleType::Mesh:
+	{
+		UStaticMesh *NewMesh = Entry.Mesh;
+		UMaterialInterface *NewMaterial = Entry.Material;
+		const ERingMeshType Type = Entry.MeshType;
+		const bool bSingleRing = Entry.bSingleRing;
+		return FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
 			{
-				SpawnState.Color = ColorMemory;
-				return true;
-			}
-			return false;
-		}));
+				return ApplyRingMeshRule(SpawnState, SpawnRule, NewMesh, NewMaterial, Type, bSingleRing);
+			});
+	}
+	case ERingSpawnRuleType::Offset:
+	{
+		const float Value = Entry.Value;
+		const ERingOffsetType Type = Entry.OffsetType;
+		return FRingSpawnRule::CreateLambda([Value, Type](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+			{
+				return ApplyRingOffsetRule(SpawnState, Value, Type);
+			});
+	}
+	case ERingSpawnRuleType::Rotation:
+	{
+		const float MinSpeed = Entry.Value;
+		const float MaxSpeed = Entry.ValueMax;
+		const float ForceRerollMin = Entry.ForceRerollMin;
+		return FRingSpawnRule::CreateLambda([MinSpeed, MaxSpeed, ForceRerollMin](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+			{
+				return ApplyRingRotationRule(SpawnState, MinSpeed, MaxSpeed, ForceRerollMin);
+			});
+	}
+	case ERingSpawnRuleType::Color:
+	{
+		const FColor Color = Entry.Color;
+		const bool bSingleRing = Entry.bSingleRing;
+		return FRingSpawnRule::CreateLambda([Color, bSingleRing](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+			{
+				return ApplyRingColorRule(SpawnState, SpawnRule, Color, bSingleRing);
+			});
+	}
+	case ERingSpawnRuleType::Resolution:
+	{
+		const int32 Resolution = Entry.Count;
+		return FRingSpawnRule::CreateLambda([Resolution](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+			{
+				return ApplyRingResolutionRule(SpawnState, Resolution);
+			});
+	}
+	case ERingSpawnRuleType::Obstacle:
+	{
+		UStaticMesh *ObstacleMesh = Entry.Mesh;
+		UMaterialInterface *ObstacleMaterial = Entry.Material;
+		return FRingSpawnRule::CreateLambda([ObstacleMesh, ObstacleMaterial](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+			{
+				return ApplyRingObstacleRule(SpawnState, SpawnRule, ObstacleMesh, ObstacleMaterial);
+			});
+	}
+	default:
+		ensure(false);
+		// Ends on its first ring without changing anything.
+		return FRingSpawnRule::CreateLambda([](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule) { return true; });
+	}
+}
+
+ARingHandler* ARingHandler::SpawnRule_SetBeatRings(FString Input, TArray<UStaticMesh*> Meshes, UMaterialInterface *MeshMaterial,
+	FColor Color, TArray<UStaticMesh*> ObstacleMeshes, UMaterialInterface *ObstacleMaterialInterface)
+{
+	this->WaitForUpdate();
+
+	FRingBeatChart Chart;
+	Chart.Rings = MoveTemp(Input);
+	Chart.Meshes = MoveTemp(Meshes);
+	Chart.MaterialInterface = MeshMaterial;
+	Chart.Color = Color;
+	Chart.ObstacleMeshes = MoveTemp(ObstacleMeshes);
+	Chart.ObstacleMaterialInterface = ObstacleMaterialInterface;
+	ARingHandler::MakeBeatSpawnState(Chart, this->BeatSpawnState);
 	return this;
 }
 
-ARingHandler* ARingHandler::SpawnRule_SetResolution(int32 OnRing, int32 Resolution)
-{
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
-		{
-			SpawnState.Resolution = Resolution;
-			return true;
-		}));
-	return this;
+void ARingHandler::MakeBeatSpawnState(const FRingBeatChart &Chart, FRingBeatSpawnState &OutState)
+{
+	TArray<FString> StrArray;
+	Chart.Rings.ParseIntoArray(StrArray, TEXT(","), true);
+
+	TArray<int32> NumArray;
+	NumArray.Reserve(StrArray.Num());
+	
+	for (int32 i = 0; i < StrArray.Num(); ++i)
+	{
+		FString Trimmed = StrArray[i].TrimStartAndEnd();
+		if (Trimmed.Len() == 0)
+		{
+			continue;
+		}
+		int32 Num = FCString::Atoi(*Trimmed);
+		if (NumArray.Contains(Num))
+		{
+			continue;
+		}
+		NumArray.Add(Num);
+	}
+	NumArray.Sort();
+
+	for (int32 i = 1; i < NumArray.Num(); ++i)
+	{
+		if (i % 2 == 0)
+		{
+			continue;
+		}
+		if (NumArray[i] - NumArray[i - 1] == 1 || (i + 1 < NumArray.Num() && NumArray[i + 1] - NumArray[i] == 1))
+		{
+			NumArray.RemoveAt(i--);
+		}
+	}
+	NumArray.Shrink();
+
+	OutState.Rings = NumArray;
+	OutState.Meshes = Chart.Meshes;
+	OutState.MaterialInterface = Chart.MaterialInterface;
+	OutState.Color = Chart.Color;
+	OutState.ObstacleMeshes = Chart.ObstacleMeshes;
+	OutState.ObstacleMaterialInterface = Chart.ObstacleMaterialInterface;
+}
+
+void ARingHandler::ExecuteSpawnRules(const TMap<int32, TArray<FRingSpawnRule>> &RuleMap, FRingSpawnState &State,
+	TArray<FActiveRingSpawnRule> &Rules, int32 Index, bool bTrace) const
+{
+	// Activate rules starting on this ring.
+	const TArray<FRingSpawnRule> *NewRules = RuleMap.Find(Index);
+	const int32 NumNewRules = NewRules != nullptr ? NewRules->Num() : 0;
+	if (bTrace)
+	{
+		for (int32 i = 0; i < NumNewRules; ++i)
+		{
+			RING_TRACE_SPAN(Begin, "Rule", Super::GetUniqueID(), GetRuleTraceId(Index, i));
+		}
+	}
+
+	RunRingSpawnRules(Rules, Index, NumNewRules, [&](FActiveRingSpawnRule &ActiveRule)
+	{
+		RING_HITCH_COUNT(RulesExecuted, 1);
+		const TArray<FRingSpawnRule> *RuleArray = RuleMap.Find(ActiveRule.RingIndex);
+		if (RuleArray != nullptr && RuleArray->IsValidIndex(ActiveRule.RuleIndex) && !(*RuleArray)[ActiveRule.RuleIndex].Execute(State, ActiveRule))
+		{
+			return false;
+		}
+		if (bTrace)
+		{
+			RING_TRACE_SPAN(End, "Rule", Super::GetUniqueID(), GetRuleTraceId(ActiveRule.RingIndex, ActiveRule.RuleIndex));
+		}
+		return true;
+	});
+}
+
+void ARingHandler::EndActiveRuleTraces() const
+{
+#if CATNIP_RING_TRACE
+	for (const FActiveRingSpawnRule &Rule : this->ActiveRules)
+	{
+		RING_TRACE_SPAN(End, "Rule", Super::GetUniqueID(), GetRuleTraceId(Rule.RingIndex, Rule.RuleIndex));
+	}
+#endif
+}
+
+void ARingHandler::ResetRadiusProfile()
+{
+	this->RadiusProfile.Reset(this->RingSpawnRadius);
+	this->RadiusBaseState = this->InitialSpawnState;
+	this->RadiusBaseRules.Reset();
+	this->ReplayRadiusProfile();
+}
+
+void ARingHandler::ReplayRadiusProfile()
+{
+	this->RadiusProfile.Reset(this->RingSpawnRadius, this->RadiusProfile.GetBase());
+	this->RadiusProfileState = this->RadiusBaseState;
+	this->RadiusProfileRules = this->RadiusBaseRules;
+}
+
+void ARingHandler::ExtendRadiusProfile(int32 ToRing)
+{
+	// Rules only depend on the state they're given, so running them on a copy gives the radius of rings not yet spawned.
+	for (int32 Index = this->RadiusProfile.GetEnd(); Index <= ToRing; ++Index)
+	{
+		this->ExecuteSpawnRules(this->SpawnRuleMap, this->RadiusProfileState, this->RadiusProfileRules, Index);
+		this->RadiusProfile.Add(this->RadiusProfileState.Radius);
+	}
+}
+
+void ARingHandler::TrimRadiusProfile(int32 FromRing)
+{
+	const int32 PreviousBase = this->RadiusProfile.GetBase();
+	this->RadiusProfile.Trim(FromRing);
+	for (int32 Index = PreviousBase; Index < this->RadiusProfile.GetBase(); ++Index)
+	{
+		this->ExecuteSpawnRules(this->SpawnRuleMap, this->RadiusBaseState, this->RadiusBaseRules, Index);
+	}
+}
+
+void ARingHandler::BakeSimTrack(FRingSimTrack &OutTrack, float SampleSpacing) const
+{
+	const float Length = this->SplineComponent->GetSplineLength();
+	const int32 NumSamples = FMath::Max(FMath::CeilToInt(Length / FMath::Max(SampleSpacing, 1.0f)), 1) + 1;
+	TArray<float> Distances;
+	Distances.Reserve(NumSamples);
+	for (int32 i = 0; i < NumSamples; ++i)
+	{
+		Distances.Add(Length * i / (NumSamples - 1));
+	}
+	TArray<FVector> Locations;
+	TArray<FRotator> Rotations;
+	this->GetTransformsAtDistances(Distances, Locations, Rotations);
+
+	OutTrack.Reset(Length, NumSamples);
+	for (int32 i = 0; i < NumSamples; ++i)
+	{
+		OutTrack.AddSample(Locations[i], Rotations[i].Quaternion());
+	}
+}
+
+void ARingHandler::BakeSimChart(FRingSimChart &OutChart, float SampleSpacing) const
+{
+	check(!this->bEndlessMode);
+	this->BakeSimTrack(OutChart.Track, SampleSpacing);
+	OutChart.BeatRings = this->BeatSpawnState.Rings;
+	OutChart.RingDistance = this->RingDistance;
+	OutChart.BeatAllowance = this->BeatActionDistanceAllowance;
+	OutChart.FailImmunityDuration = this->FailImmunityDuration;
+}
+
+FRandomStream ARingHandler::MakeRandomStream(int32 Seed, int32 RingIndex, ERingRandom Purpose)
+{
+	// Murmur3 finaliser over the combined key, so neighbouring rings get unrelated streams.
+	uint32 Hash = HashCombine(HashCombine(uint32(Seed), uint32(RingIndex)), uint32(Purpose));
+	Hash ^= Hash >> 16;
+	Hash *= 0x85ebca6b;
+	Hash ^= Hash >> 13;
+	Hash *= 0xc2b2ae35;
+	Hash ^= Hash >> 16;
+	return FRandomStream(int32(Hash));
+}
+
+float ARingHandler::DrawRotationSpeed(FRandomStream &Stream, float MinSpeed, float MaxSpeed, float ForceRerollMin)
+{
+	if (ForceRerollMin < 0.0f)
+	{
+		return Stream.FRandRange(MinSpeed, MaxSpeed);
+	}
+
+	// Speeds slower than ForceRerollMin are not allowed. Draw once from what is left of the range either side of zero.
+	const float LowMax = FMath::Min(MaxSpeed, -ForceRerollMin);
+	const float HighMin = FMath::Max(MinSpeed, ForceRerollMin);
+	const float LowLength = FMath::Max(LowMax - MinSpeed, 0.0f);
+	const float HighLength = FMath::Max(MaxSpeed - HighMin, 0.0f);
+	if (!ensureMsgf(LowLength + HighLength > 0.0f, TEXT("Rotation speed range [%f, %f] is inside the reroll zone %f."), MinSpeed, MaxSpeed, ForceRerollMin))
+	{
+		return FMath::Abs(MinSpeed) > FMath::Abs(MaxSpeed) ? MinSpeed : MaxSpeed;
+	}
+	const float Value = Stream.FRand() * (LowLength + HighLength);
+	return Value < LowLength ? MinSpeed + Value : HighMin + (Value - LowLength);
+}
+
+void ARingHandler::SpawnRing(int32 Index, const FVector &Location, const FRotator &Rotation)
+{
+	if (this->SpawnKeyframes.Num() > 0 && !this->bEndlessMode)
+	{
+		FRingSpawnKeyframe &Keyframe = this->SpawnKeyframes[Index % this->SpawnKeyframes.Num()];
+		Keyframe.RingIndex = Index;
+		Keyframe.SpawnClock = this->RingClock;
+		Keyframe.State = this->SpawnState;
+		Keyframe.Rules.Reset();
+		Keyframe.Rules.Append(this->ActiveRules);
+	}
+	this->ExecuteSpawnRules(this->SpawnRuleMap, this->GetSpawnState(), this->ActiveRules, Index, true);
+	RING_TRACE_SPAN(Begin, "Ring", Super::GetUniqueID(), Index);
+
+	// The record keeps everything drawn for the ring, so an actor made for it later looks the same.
+	FRingRecord &Record = this->Rings.AddDefaulted_GetRef();
+	Record.Location = Location;
+	Record.Rotation = Rotation;
+	this->MakeRingRecord(Record, this->GetSpawnState(), this->BeatSpawnState, Index);
+}
+
+void ARingHandler::MakeRingRecord(FRingRecord &Record, FRingSpawnState &State, const FRingBeatSpawnState &Beat, int32 Index) const
+{
+	// Beat rings take the beat chart's look for this ring only.
+	const FRingSpawnState *RingState = &State;
+	FRingSpawnState BeatState;
+	if (!this->bDisableBeatRings && Beat.Meshes.Num() > 0 && Beat.Rings.Contains(Index + 1))
+	{
+		BeatState = State;
+		FRandomStream MeshStream = ARingHandler::MakeRandomStream(this->TrackSeed, Index, ERingRandom::BeatMesh);
+		FRandomStream ChanceStream = ARingHandler::MakeRandomStream(this->TrackSeed, Index, ERingRandom::ObstacleChance);
+
+		BeatState.Mesh = Beat.Meshes[MeshStream.RandRange(0, Beat.Meshes.Num() - 1)];
+		BeatState.MeshType = ERingMeshType::SingleMesh;
+		BeatState.MaterialInterface = Beat.MaterialInterface;
+		BeatState.Color = Beat.Color;
+
+		if (!this->bDisableObstacles && Beat.ObstacleMeshes.Num() > 0 && ChanceStream.FRand() < this->ObstacleSpawnChancePercentage)
+		{
+			FRandomStream ObstacleStream = ARingHandler::MakeRandomStream(this->TrackSeed, Index, ERingRandom::ObstacleMesh);
+			BeatState.ObstacleMesh = Beat.ObstacleMeshes[ObstacleStream.RandRange(0, Beat.ObstacleMeshes.Num() - 1)];
+			BeatState.ObstacleMaterialInterface = Beat.ObstacleMaterialInterface;
+			BeatState.bSpawnObstacle = true;
+		}
+		RingState = &BeatState;
+	}
+
+	Record.Index = Index;
+	Record.Radius = RingState->Radius;
+	Record.bObstacle = RingState->bSpawnObstacle;
+
+	switch (RingState->OffsetType)
+	{
+	case ERingOffsetType::Fixed:
+		Record.RotationOffset = RingState->RotationOffset;
+		break;
+	case ERingOffsetType::Random:
+		Record.RotationOffset = ARingHandler::MakeRandomStream(this->TrackSeed, Index, ERingRandom::RotationOffset)
+			.FRandRange(-RingState->RotationOffset, RingState->RotationOffset);
+		break;
+	case ERingOffsetType::Incremental:
+		Record.RotationOffset = RingState->RotationOffset * RingState->OffsetCounter;
+		break;
+	default:
+		Record.RotationOffset = 0.0f;
+		break;
+	}
+
+	FRandomStream SpeedStream = ARingHandler::MakeRandomStream(this->TrackSeed, Index, ERingRandom::RotationSpeed);
+	Record.RotationSpeed = ARingHandler::DrawRotationSpeed(SpeedStream, RingState->RotationSpeedMin,
+		RingState->RotationSpeedMax, RingState->RotationForceRerollMin);
+	Record.State = *RingState;
+
+	// Incremental offsets keep counting through beat rings.
+	if (RingState->OffsetType == ERingOffsetType::Incremental)
+	{
+		++State.OffsetCounter;
+	}
+}
+
+ARing *ARingHandler::SpawnRingActor(FRingRecord &Record)
+{
+	ARing *Ring = nullptr;
+	while (Ring == nullptr && this->RingActorPool.Num() > 0)
+	{
+		Ring = this->RingActorPool.Pop(false);
+		Ring = IsValid(Ring) ? Ring : nullptr;
+	}
+	if (Ring != nullptr)
+	{
+		Ring->SetActorLocationAndRotation(Record.Location, Record.Rotation);
+	}
+	else
+	{
+		FActorSpawnParameters Params;
+		Params.Owner = this;
+		Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+		// Only loads here when the run wasn't preloaded.
+		Ring = Super::GetWorld()->SpawnActor<ARing>(this->RingClass.LoadSynchronous(), Record.Location, Record.Rotation, Params);
+		if (!ensure(Ring != nullptr))
+		{
+			return nullptr;
+		}
+		RING_HITCH_COUNT(RingsSpawned, 1);
+	}
+	Ring->SetRingIndex(Record.Index);
+	Ring->InitRing(Record, this->TrackSeed);
+	Ring->SetObstacleForcedLod(this->QualityObstacleLod);
+	Record.Actor = Ring;
+	return Ring;
+}
+
+void ARingHandler::ReleaseRingActor(ARing *Ring)
+{
+	if (Ring == nullptr)
+	{
+		return;
+	}
+	Ring->ReleaseRing();
+	this->RingActorPool.Add(Ring);
+	RING_HITCH_COUNT(RingsDestroyed, 1);
+}
+
+void ARingHandler::ApplyRecordToActor(const FRingRecord &Record)
+{
+	ARing *Ring = Record.Actor;
+	Ring->ApplyRecord(Record);
+	if (Ring->NeedsSegments(Record.Resolution))
+	{
+		this->SegmentRings.Add(Ring);
+		Ring->GetSegmentParams(Record.Resolution, this->SegmentParams.AddDefaulted_GetRef());
+	}
+}
+
+void ARingHandler::BuildQueuedSegments()
+{
+	if (this->SegmentRings.Num() == 0)
+	{
+		return;
+	}
+
+	this->SegmentTransforms.Reset();
+	FRingSegmentKernel::BuildSegmentTransforms(this->SegmentParams, this->SegmentTransforms, &this->SegmentFirstIndices);
+	for (int32 i = 0; i < this->SegmentRings.Num(); ++i)
+	{
+		const int32 Num = FMath::Max(this->SegmentParams[i].Resolution, 0);
+		this->SegmentRings[i]->ApplySegments(MakeArrayView(this->SegmentTransforms.GetData() + this->SegmentFirstIndices[i], Num));
+	}
+	this->SegmentRings.Reset();
+	this->SegmentParams.Reset();
+}
+
+void ARingHandler::ClearRings()
+{
+	for (const FRingRecord &Record : this->Rings)
+	{
+		RING_TRACE_SPAN(End, "Ring", Super::GetUniqueID(), Record.Index);
+		this->ReleaseRingActor(Record.Actor);
+	}
+	this->Rings.Reset();
+}
+
+int32 ARingHandler::GetWindowRingCount() const
+{
+	// From two rings behind the pawn to the fade distance ahead, and the ring either end.
+	return FMath::CeilToInt(this->RingFadeDistance / FMath::Max(this->RingDistance, 1.0f)) + 4;
+}
+
+void ARingHandler::GetWindowAtDistance(float Distance, int32 &OutMinRing, int32 &OutMaxRing) const
+{
+	const float AppearTolerance = this->RingDistance * 2.0f;
+	float MinDistance = Distance - AppearTolerance;
+	float MaxDistance = Distance + this->RingFadeDistance;
+
+	const int32 MaxRings = FMath::CeilToInt(this->GetExactRingAtDistance(this->SplineComponent->GetSplineLength()));
+	OutMinRing = FMath::Clamp(int32(this->GetExactRingAtDistance(MinDistance)), 0, MaxRings);
+	OutMaxRing = FMath::Clamp(int32(this->GetExactRingAtDistance(MaxDistance)) + 1, 0, MaxRings);
+}
+
+void ARingHandler::UpdateHandler(FVector PawnLocation)
+{
+	this->StartUpdate(PawnLocation, true, 0.0f);
+}
+
+void ARingHandler::UpdateHandlerAtDistance(float Distance)
+{
+	this->StartUpdate(FVector::ZeroVector, false, Distance);
+}
+
+void ARingHandler::StartUpdate(const FVector &PawnLocation, bool bLocatePawn, float PawnDistance)
+{
+	RING_ALLOC_SCOPE();
+	if (!this->bRunStartSaved)
+	{
+		this->SaveRunStart();
+	}
+
+	// A second update in the same frame applies the first straight away.
+	this->ApplyUpdate();
+	if (this->bCompleted)
+	{
+		return;
+	}
+
+	this->BeatJudge.BeginBeats(this->BeatSpawnState.Rings.Num());
+
+	FRingUpdateTask &Task = this->UpdateTask;
+	Task.PawnLocation = PawnLocation;
+	Task.bLocatePawn = bLocatePawn;
+	Task.PawnDistance = PawnDistance;
+	Task.NextBeatRingIndex = this->BeatJudge.GetNextBeatIndex();
+	// Endless rules past this ring are generated when the update is applied.
+	Task.ProfileLimit = this->bEndlessMode ? this->EndlessNextRuleRing - 1 : MAX_int32;
+	Task.DeltaTime = Super::GetWorld()->GetDeltaSeconds();
+	this->RingClock += Task.DeltaTime;
+
+	// Without a camera (simulating in the editor) every ring counts as visible.
+	Task.View.bValid = false;
+	APlayerController *Controller = Super::GetWorld()->GetFirstPlayerController();
+	if (CVarRingCulling.GetValueOnGameThread() != 0 && Controller != nullptr && Controller->PlayerCameraManager != nullptr
+		&& !Controller->PlayerCameraManager->GetCameraLocation().IsNearlyZero())
+	{
+		APlayerCameraManager *CameraManager = Controller->PlayerCameraManager;
+		int32 ViewportX = 0, ViewportY = 0;
+		Controller->GetViewportSize(ViewportX, ViewportY);
+		const FRotationMatrix ViewRotation(CameraManager->GetCameraRotation());
+
+		FRingView &View = Task.View;
+		View.Location = CameraManager->GetCameraLocation();
+		View.Forward = ViewRotation.GetScaledAxis(EAxis::X);
+		View.Right = ViewRotation.GetScaledAxis(EAxis::Y);
+		View.Up = ViewRotation.GetScaledAxis(EAxis::Z);
+		View.TanHalfWidth = FMath::Tan(FMath::DegreesToRadians(FMath::Clamp(CameraManager->GetFOVAngle(), 1.0f, 170.0f) * 0.5f));
+		View.TanHalfHeight = ViewportX > 0 && ViewportY > 0 ? View.TanHalfWidth * ViewportY / ViewportX : View.TanHalfWidth;
+		View.bValid = true;
+	}
+
+	this->bUpdatePending = true;
+	if (CVarAsyncRingUpdate.GetValueOnGameThread() != 0)
+	{
+		this->UpdateEvent = FFunctionGraphTask::CreateAndDispatchWhenReady([this]() { this->RunUpdate(this->UpdateTask); },
+			TStatId(), nullptr, ENamedThreads::AnyHiPriThreadNormalTask);
+	}
+	else
+	{
+		this->RunUpdate(Task);
+		this->ApplyUpdate();
+	}
 }
 
-ARingHandler *ARingHandler::SpawnRule_SetObstacle(int32 OnRing, UStaticMesh *ObstacleMesh, UMaterialInterface *ObstacleMaterial)
+void ARingHandler::RunUpdate(FRingUpdateTask &Task)
 {
-	this->AddSpawnRule(OnRing, FRingSpawnRule::CreateLambda([=](FRingSpawnState &SpawnState, FActiveRingSpawnRule &SpawnRule)
+	RING_ALLOC_SCOPE();
+	float DistanceAtLocation;
+	{
+		RING_HITCH_SCOPE(Locate);
+		if (!Task.bLocatePawn)
+		{
+			DistanceAtLocation = Task.PawnDistance;
+		}
+		else if (this->SimTrack.IsBaked())
+		{
+			RING_HITCH_COUNT(ClosestPointQueries, 1);
+			// Starts from where the pawn was, so it only walks the samples it passed since.
+			DistanceAtLocation = this->SimTrack.FindDistanceClosestTo(Task.PawnLocation, this->CurrentPawnDistance);
+		}
+		else
 		{
-			if (SpawnRule.RingCounter >= 2)
+			RING_HITCH_COUNT(ClosestPointQueries, 1);
+			float InputKey = this->SplineComponent->FindInputKeyClosestToWorldLocation(Task.PawnLocation);
+			DistanceAtLocation = this->GetDistanceAtInputKey(InputKey);
+			if (FMath::IsNearlyZero(DistanceAtLocation))
 			{
-				SpawnState.bSpawnObstacle = false;
-				return true;
+				DistanceAtLocation = -(this->SplineComponent->GetLocationAtSplineInputKey(InputKey, ESplineCoordinateSpace::World) - Task.PawnLocation).Size();
 			}
-			SpawnState.ObstacleMesh = ObstacleMesh;
-			SpawnState.ObstacleMaterialInterface = ObstacleMaterial;
-			SpawnState.bSpawnObstacle = true;
-			return false;
-		}));
-	return this;
-}
+		}
+	}
+	float SplineLength = this->SplineComponent->GetSplineLength();
+	check(SplineLength > 0);
 
-ARingHandler* ARingHandler::SpawnRule_SetBeatRings(FString Input, TArray<UStaticMesh*> Meshes, UMaterialInterface *MeshMaterial,
-	FColor Color, TArray<UStaticMesh*> ObstacleMeshes, UMaterialInterface *ObstacleMaterialInterface)
-{
-	TArray<FString> StrArray;
-	Input.ParseIntoArray(StrArray, TEXT(","), true);
+	int32 MinRing, MaxRing;
+	this->GetWindowAtDistance(DistanceAtLocation, MinRing, MaxRing);
 
-	TArray<int32> NumArray;
-	NumArray.Reserve(StrArray.Num());
-	
-	for (int32 i = 0; i < StrArray.Num(); ++i)
+	Task.PawnDistance = DistanceAtLocation;
+	Task.MinRing = MinRing;
+	Task.MaxRing = MaxRing;
+	Task.bMissedBeat = false;
+	Task.SpawnIndices.Reset();
+	Task.SpawnDistances.Reset();
+
+	// Keep the radius of every ring the pawn can reach known ahead of time.
 	{
-		FString Trimmed = StrArray[i].TrimStartAndEnd();
-		if (Trimmed.Len() == 0)
-		{
-			continue;
-		}
-		int32 Num = FCString::Atoi(*Trimmed);
-		if (NumArray.Contains(Num))
+		RING_HITCH_SCOPE(Window);
+		this->ExtendRadiusProfile(FMath::Min(MaxRing + 1, Task.ProfileLimit));
+		if (this->bEndlessMode)
 		{
-			continue;
+			this->TrimRadiusProfile(MinRing);
 		}
-		NumArray.Add(Num);
 	}
-	NumArray.Sort();
 
-	for (int32 i = 1; i < NumArray.Num(); ++i)
+	Task.bReachedEnd = !this->bEndlessMode && DistanceAtLocation >= SplineLength;
+	if (Task.bReachedEnd)
 	{
-		if (i % 2 == 0)
-		{
-			continue;
-		}
-		if (NumArray[i] - NumArray[i - 1] == 1 || (i + 1 < NumArray.Num() && NumArray[i + 1] - NumArray[i] == 1))
-		{
-			NumArray.RemoveAt(i--);
-		}
+		return;
 	}
-	NumArray.Shrink();
 
-	this->BeatSpawnState.Rings = NumArray;
-	this->BeatSpawnState.Meshes = Meshes;
-	this->BeatSpawnState.MaterialInterface = MeshMaterial;
-	this->BeatSpawnState.Color = Color;
-	this->BeatSpawnState.ObstacleMeshes = ObstacleMeshes;
-	this->BeatSpawnState.ObstacleMaterialInterface = ObstacleMaterialInterface;
-	return this;
-}
+	{
+		RING_HITCH_SCOPE(Beats);
+		Task.bMissedBeat = this->BeatJudge.IsBeatMissed(this->BeatSpawnState.Rings, Task.NextBeatRingIndex, this->TrackDistanceBase + DistanceAtLocation);
+	}
 
-ARing* ARingHandler::SpawnRing(int32 Index)
-{
-	// Increment rule ring counter.
-	for (FActiveRingSpawnRule &Next : this->ActiveRules)
+	// Rotate and fade needed rings. Unneeded ones are marked for removal.
+	int32 NextRing = MinRing == 0 ? 0 : INDEX_NONE;
 	{
-		if (Next.RingIndex <= Index)
+		RING_HITCH_SCOPE(Update);
+		for (FRingRecord &Record : this->Rings)
 		{
-			++Next.RingCounter;
+			if (Record.Index >= MinRing && Record.Index <= MaxRing)
+			{
+				Record.Opacity = this->GetRingOpacity(Record.Index, DistanceAtLocation);
+				Record.Phase = FMath::Fmod(Record.Phase + Record.RotationSpeed * Task.DeltaTime, 360.0f);
+				this->UpdateRingLod(Record, DistanceAtLocation);
+				Record.bVisible = !Task.View.bValid || Task.View.IntersectsSphere(Record.Location, Record.Radius + this->RingCullMargin);
+				NextRing = Record.Index + 1;
+				continue;
+			}
+			Record.Opacity = -1.0f;
 		}
 	}
 
-	// Execute all rules.
-	for (int32 i = 0; i < this->ActiveRules.Num(); ++i)
+	// Rings are contiguous, so new ones follow the last one kept. Without any, only the first ring can start the window.
+	RING_HITCH_SCOPE(Spawn);
+	if (NextRing != INDEX_NONE)
 	{
-		FActiveRingSpawnRule &ActiveRule = this->ActiveRules[i];
-		if (ActiveRule.RingIndex > Index)
-		{
-			continue;
-		}
-		if (ActiveRule.Rule.Execute(this->GetSpawnState(), ActiveRule))
+		for (int32 i = NextRing; i <= MaxRing; ++i)
 		{
-			this->ActiveRules.RemoveAtSwap(i--);
+			Task.SpawnIndices.Add(i);
 		}
 	}
 
-	// Spawn the ring. The above rules will have set the conditions for us.
-	float Distance = this->RingDistance * Index;
-
-	FVector Location = this->SplineComponent->GetLocationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World);
-	FRotator Rotation = this->SplineComponent->GetRotationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World);
-
-	FActorSpawnParameters Params;
-	Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
-
-	ARing *Ring = Super::GetWorld()->SpawnActor<ARing>(this->RingClass, Location, Rotation, Params);
-	ensure(Ring != nullptr);
-	//UE_LOG(LogTemp, Log, TEXT("%d, %f"), Index, this->SpawnRadius);
-	//Ring->UpdatePoints(this->SpawnMesh, this->SpawnRingType == ERingType::SingleMesh, this->SpawnRadius);
-	Ring->InitRing(&this->GetSpawnState());
-	return Ring;
+	// Place all of them in one pass along the spline.
+	for (int32 Index : Task.SpawnIndices)
+	{
+		Task.SpawnDistances.Add(this->GetDistanceAtRing(Index));
+	}
+	this->GetTransformsAtDistances(Task.SpawnDistances, Task.SpawnLocations, Task.SpawnRotations);
 }
 
-void ARingHandler::UpdateHandler(FVector PawnLocation)
+void ARingHandler::ApplyUpdate()
 {
-	float InputKey = this->SplineComponent->FindInputKeyClosestToWorldLocation(PawnLocation);
-	float DistanceAtLocation = this->GetDistanceAtInputKey(InputKey);
-	if (FMath::IsNearlyZero(DistanceAtLocation))
+	if (!this->bUpdatePending)
 	{
-		DistanceAtLocation = -(this->SplineComponent->GetLocationAtSplineInputKey(InputKey, ESplineCoordinateSpace::World) - PawnLocation).Size();
+		return;
 	}
-	float SplineLength = this->SplineComponent->GetSplineLength();
-	check(SplineLength > 0);
-	float CurrentPercentage = DistanceAtLocation / SplineLength;
-
-	const float FadeTolerance = this->RingDistance * 2.0f;
-	const float AppearTolerance = this->RingDistance * 2.0f;
-	float MinDistance = DistanceAtLocation - AppearTolerance;
-	float MaxDistance = DistanceAtLocation + this->RingFadeDistance;
+	this->WaitForUpdate();
+	this->bUpdatePending = false;
 
-	const int32 MaxRings = FMath::CeilToInt(SplineLength / this->RingDistance);
-	int32 MinRing = FMath::Clamp(int32(MinDistance / this->RingDistance), 0, MaxRings);
-	int32 MaxRing = FMath::Clamp(int32(MaxDistance / this->RingDistance) + 1, 0, MaxRings);
+	const FRingUpdateTask &Task = this->UpdateTask;
+	this->CurrentPawnDistance = Task.PawnDistance;
 
-	this->CurrentPawnDistance = DistanceAtLocation;
-
-	if (this->bCompleted)
+	if (Task.bReachedEnd && this->bTrackContinues)
 	{
+		// The next segment's handler takes over. Rings stay where they are until this one is released.
+		this->bCompleted = true;
 		return;
 	}
-	if (CurrentPercentage >= 1.0f)
+	if (Task.bReachedEnd)
 	{
+#if CATNIP_ALLOC_COUNTER
+		FRingAllocCounter::Get().EndRun(TEXT("track completed"));
+#endif
 		ADefaultGameMode *GameMode = Super::GetWorld()->GetAuthGameMode<ADefaultGameMode>();
 		check(GameMode != nullptr);
+		RING_ALLOC_PAUSE();
 		GameMode->OnGameCompleted();
 		this->bCompleted = true;
 		return;
 	}
 
-	if (this->NextBeatRingIndex == -1 && this->BeatSpawnState.Rings.Num() > 0)
+	// An action registered while the task ran may already have moved on from this beat.
+	if (Task.bMissedBeat && this->BeatJudge.GetNextBeatIndex() == Task.NextBeatRingIndex)
 	{
-		this->NextBeatRingIndex = 0;
+		this->FailRing(this->BeatSpawnState.Rings[Task.NextBeatRingIndex]);
+		this->BeatJudge.SkipBeat();
 	}
-	if (this->NextBeatRingIndex != -1 && this->NextBeatRingIndex < this->BeatSpawnState.Rings.Num())
-	{
-		float Distance = this->BeatSpawnState.Rings[this->NextBeatRingIndex] * this->RingDistance;
-		if (DistanceAtLocation - Distance > this->BeatActionDistanceAllowance)
-		{
-			//this->OnBeatRingFail.Broadcast(this->NextBeatRingIndex);
-			this->FailRing(this->BeatSpawnState.Rings[this->NextBeatRingIndex]);
-			++this->NextBeatRingIndex;
-		}
-	}
-
-	//// Find next beat ring.
-	//int32 NextBeatRing = -1;
-	//for (int32 i = 0; i < this->BeatSpawnState.Rings.Num(); ++i)
-	//{
-	//	if (this->NextBeatRingIndex != -1 && this->BeatSpawnState.Rings[i] < this->NextBeatRingIndex)
-	//	{
-	//		continue;
-	//	}
-	//	if (FMath::Abs(this->BeatSpawnState.Rings[i] * this->RingDistance
-	//		- DistanceAtLocation) <= this->BeatActionDistanceAllowance)
-	//	{
-	//		NextBeatRing = this->BeatSpawnState.Rings[i];
-	//		break;
-	//	}
-	//}
-	//if (NextBeatRing == -1 && this->NextBeatRingIndex != -1)
-	//{
-	//	if (!this->bNextBeatRingCompleted)
-	//	{
-	//		this->OnBeatRingFail.Broadcast(this->NextBeatRingIndex);
-	//	}
-	//	else
-	//	{
-	//		this->bNextBeatRingCompleted = false;
-	//	}
-	//	this->NextBeatRingIndex = -1;
-	//}
-	//if (NextBeatRing != -1)
-	//{
-	//	this->NextBeatRingIndex = NextBeatRing;
-	//}
 
-	// Remove unneeded rings. Update transparency of needed ones.
-	for (int32 i = 0; i < this->Rings.Num(); ++i)
+	// Removed rings are all at the front or back of the window, so order is kept without moving much.
 	{
-		ARing *Ring = this->Rings[i];
-		if (Ring != nullptr)
+		RING_HITCH_SCOPE(Update);
+		this->Rings.RemoveAll([this](const FRingRecord &Record)
 		{
-			int32 Index = Ring->GetRingIndex();
-			if (Index >= MinRing && Index <= MaxRing)
+			if (Record.Opacity >= 0.0f)
 			{
-				// This ring is needed. Update its transparency.
-				float Percentage = (Index * this->RingDistance - FadeTolerance) / SplineLength;
-				float Opacity =  FMath::Clamp((Percentage - CurrentPercentage) 
-					/ (this->RingFadeDistance / SplineLength), 0.0f, 1.0f);
-				this->Rings[i]->UpdateRingOpacity(1.0f - Opacity);
-				//UE_LOG(LogTemp, Log, TEXT("%f"), Opacity);
-				//this->Rings[i]->UpdateRingOpacity(FMath::Sin((1.0f - Opacity) * PI * 0.5f));
-
-				continue;
+				return false;
 			}
-			Ring->Destroy();
-		}
-		this->Rings.RemoveAtSwap(i--);
+			RING_TRACE_SPAN(End, "Ring", Super::GetUniqueID(), Record.Index);
+			this->ReleaseRingActor(Record.Actor);
+			return true;
+		});
 	}
-	//UE_LOG(LogTemp, Log, TEXT("----"));
 
-	// Spawn any required new rings.
-	for (int32 i = MinRing; i <= MaxRing; ++i)
 	{
-		// Don't spawn if ring exists. Only spawn if previous ring exists (spawn linearly).
-		bool bFound = false, bCanSpawn = i == 0;
-		for (ARing *Next : this->Rings)
+		RING_HITCH_SCOPE(Spawn);
+		for (int32 i = 0; i < Task.SpawnIndices.Num(); ++i)
 		{
-			if (Next == nullptr)
+			this->SpawnRing(Task.SpawnIndices[i], Task.SpawnLocations[i], Task.SpawnRotations[i]);
+			FRingRecord &Record = this->Rings.Last();
+			Record.Opacity = this->GetRingOpacity(Record.Index, Task.PawnDistance);
+			this->UpdateRingLod(Record, Task.PawnDistance);
+			Record.bVisible = !Task.View.bValid || Task.View.IntersectsSphere(Record.Location, Record.Radius + this->RingCullMargin);
+		}
+
+		// Only rings that can be seen need an actor. Past the spawn budget, the furthest wait for the next frame.
+		int32 SpawnBudget = this->QualitySpawnBudget > 0 ? this->QualitySpawnBudget : MAX_int32;
+		for (FRingRecord &Record : this->Rings)
+		{
+			const bool bNeedsActor = Record.Opacity > this->RingActorOpacity;
+			if (bNeedsActor && Record.Actor == nullptr && SpawnBudget > 0)
 			{
-				continue;
+				this->SpawnRingActor(Record);
+				--SpawnBudget;
 			}
-			if (Next->GetRingIndex() == i - 1)
+			else if (!bNeedsActor && Record.Actor != nullptr)
 			{
-				bCanSpawn = true;
+				this->ReleaseRingActor(Record.Actor);
+				Record.Actor = nullptr;
 			}
-			if (Next->GetRingIndex() == i)
+			if (Record.Actor != nullptr)
 			{
-				bFound = true;
-				break;
+				Record.Actor->SetRingVisible(Record.bVisible);
+				if (Record.bVisible)
+				{
+					this->ApplyRecordToActor(Record);
+				}
 			}
 		}
-		if (bFound || !bCanSpawn)
-		{
-			continue;
-		}
+		this->BuildQueuedSegments();
+	}
 
-		// Check if ring is a beat ring.
-		if (!this->bDisableBeatRings && this->BeatSpawnState.Rings.Contains(i + 1))
-		{
-			this->SpawnRule_SetMesh(i + 1, this->BeatSpawnState.Meshes[FMath::RandRange(0, this->BeatSpawnState
-				.Meshes.Num() - 1)], this->BeatSpawnState.MaterialInterface, ERingMeshType::SingleMesh, true);
-			this->SpawnRule_SetColor(i + 1, this->BeatSpawnState.Color, true);
+	if (this->bEndlessMode)
+	{
+		RING_HITCH_SCOPE(Endless);
 
-			if (!this->bDisableObstacles && FMath::RandRange(0.0f, 1.0f) < this->ObstacleSpawnChancePercentage)
-			{
-				UStaticMesh *ObstacleMesh = this->BeatSpawnState.ObstacleMeshes[FMath::RandRange(0, this->BeatSpawnState.ObstacleMeshes.Num() - 1)];
-				this->SpawnRule_SetObstacle(i + 1, ObstacleMesh, this->BeatSpawnState.ObstacleMaterialInterface);
-			}
-		}
+		// Trimming the track moves the distance of every remaining point.
+		const double PreviousBase = this->TrackDistanceBase;
+		this->UpdateEndlessTrack(Task.PawnDistance);
+		this->CurrentPawnDistance -= float(this->TrackDistanceBase - PreviousBase);
+
+		// Rules past the task's limit exist now.
+		this->ExtendRadiusProfile(Task.MaxRing + 1);
+	}
+}
+
+void ARingHandler::WaitForUpdate()
+{
+	if (this->UpdateEvent.IsValid())
+	{
+		RING_HITCH_SCOPE(Wait);
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(this->UpdateEvent, ENamedThreads::GameThread);
+		this->UpdateEvent.SafeRelease();
+	}
+}
+
+void ARingHandler::UpdateEndlessTrack(float PawnDistance)
+{
+	USplineComponent *Spline = this->SplineComponent;
+	const double PawnTrackDistance = this->TrackDistanceBase + PawnDistance;
+
+	// Trim points behind the ring window. The first kept segment changes shape when its start becomes the end point,
+	// so the point after it is used as the anchor that keeps the rest of the track at the same distance.
+	const float TrimDistance = PawnDistance - this->RingDistance * 2.0f - this->EndlessSegmentLength;
+	int32 TrimCount = 0;
+	while (Spline->GetNumberOfSplinePoints() - TrimCount > 4 && Spline->GetDistanceAlongSplineAtSplinePoint(TrimCount + 2) < TrimDistance)
+	{
+		++TrimCount;
+	}
+	const float AnchorDistance = Spline->GetDistanceAlongSplineAtSplinePoint(TrimCount + 1);
+	float Length = Spline->GetSplineLength();
+	for (int32 i = 0; i < TrimCount; ++i)
+	{
+		Spline->RemoveSplinePoint(0, false);
+	}
+
+	// Append segments until the track reaches well past the fade distance. Measured in distances from before the trim.
+	const float RequiredLength = PawnDistance + this->RingFadeDistance + this->EndlessSegmentLength * 2.0f;
+	bool bAppended = false;
+	FVector Location = Spline->GetLocationAtSplinePoint(Spline->GetNumberOfSplinePoints() - 1, ESplineCoordinateSpace::World);
+	while (Length < RequiredLength)
+	{
+		const float MaxPitch = this->EndlessMaxPitchAngle;
+		this->EndlessHeading.Yaw = FRotator::NormalizeAxis(this->EndlessHeading.Yaw 
+			+ this->EndlessStream.FRandRange(-this->EndlessMaxTurnAngle, this->EndlessMaxTurnAngle));
+		this->EndlessHeading.Pitch = FMath::Clamp(this->EndlessHeading.Pitch + this->EndlessStream.FRandRange(-MaxPitch, MaxPitch) * 0.5f, -MaxPitch, MaxPitch);
+
+		Location += this->EndlessHeading.Vector() * this->EndlessSegmentLength;
+		Spline->AddSplinePoint(Location, ESplineCoordinateSpace::World, false);
+		Length += this->EndlessSegmentLength;
+		bAppended = true;
+	}
+	if (TrimCount > 0 || bAppended)
+	{
+		Spline->UpdateSpline();
+	}
+	if (TrimCount > 0)
+	{
+		this->TrackDistanceBase += AnchorDistance - Spline->GetDistanceAlongSplineAtSplinePoint(1);
+	}
+
+	const int32 MinRing = FMath::FloorToInt((PawnTrackDistance - this->RingDistance * 2.0f) / this->RingDistance) - 1;
+	const int32 LookAheadRing = FMath::CeilToInt((PawnTrackDistance + this->RingFadeDistance) / this->RingDistance) + 2;
 
-		// If we get here it means we have to spawn the ring. First ensure any rules are set as active.
-		if (this->SpawnRuleMap.Contains(i))
+	// Produce rules and beats for rings about to enter the window. Rule ring numbers are 1-based.
+	while (this->EndlessNextRuleRing <= LookAheadRing)
+	{
+		const int32 OnRing = this->EndlessNextRuleRing + 1;
+		const float Speed = FMath::Abs(this->RingSpawnRotateSpeedMax) * this->EndlessStream.FRandRange(0.5f, 1.5f);
+		this->SpawnRule_SetRadius(OnRing, this->EndlessStream.FRandRange(this->EndlessRadiusMin, this->EndlessRadiusMax), this->EndlessRuleInterval / 4);
+		this->SpawnRule_SetRotation(OnRing, -Speed, Speed);
+		this->EndlessNextRuleRing += FMath::Max(this->EndlessRuleInterval, 1);
+	}
+	TArray<int32> &BeatRings = this->BeatSpawnState.Rings;
+	if (this->BeatSpawnState.Meshes.Num() > 0)
+	{
+		int32 LastBeat = BeatRings.Num() > 0 ? BeatRings.Last() : 0;
+		while (LastBeat <= LookAheadRing + 1)
 		{
-			for (FRingSpawnRule &Rule : this->SpawnRuleMap[i])
-			{
-				this->ActiveRules.Add(FActiveRingSpawnRule{ i, 0, Rule });
-			}
+			LastBeat += FMath::Max(this->EndlessStream.RandRange(this->EndlessBeatSpacingMin, this->EndlessBeatSpacingMax), 2);
+			BeatRings.Add(LastBeat);
 		}
+	}
+
+	// Release rules and beats the window has passed, so memory stays bounded however long the run.
+	// Running rules are looked up by the ring they started on, so their rings are kept.
+	int32 MinRuleRing = MinRing;
+	for (const FActiveRingSpawnRule &Rule : this->ActiveRules)
+	{
+		MinRuleRing = FMath::Min(MinRuleRing, Rule.RingIndex);
+	}
+	for (const FActiveRingSpawnRule &Rule : this->RadiusProfileRules)
+	{
+		MinRuleRing = FMath::Min(MinRuleRing, Rule.RingIndex);
+	}
 
-		ARing *Ring = this->SpawnRing(i);
-		if (ensure(Ring != nullptr))
+	// The radius profile is replayed from its base when a rule is added behind it.
+	MinRuleRing = FMath::Min(MinRuleRing, this->RadiusProfile.GetBase());
+	for (const FActiveRingSpawnRule &Rule : this->RadiusBaseRules)
+	{
+		MinRuleRing = FMath::Min(MinRuleRing, Rule.RingIndex);
+	}
+	for (auto Itr = this->SpawnRuleMap.CreateIterator(); Itr; ++Itr)
+	{
+		if (Itr.Key() < MinRuleRing)
 		{
-			Ring->SetRingIndex(i);
-			this->Rings.Add(Ring);
+			Itr.RemoveCurrent();
 		}
 	}
+	int32 BeatTrimCount = 0;
+	while (BeatTrimCount < this->BeatJudge.GetNextBeatIndex() && BeatRings[BeatTrimCount] < MinRing)
+	{
+		++BeatTrimCount;
+	}
+	if (BeatTrimCount > 0)
+	{
+		BeatRings.RemoveAt(0, BeatTrimCount, false);
+		this->BeatJudge.TrimBeats(BeatTrimCount);
+		this->BeatRingIndexBase += BeatTrimCount;
+	}
+
+	// Keep world coordinates small. The engine shifts every actor, including this spline and the spawned rings.
+	UWorld *World = Super::GetWorld();
+	FVector PawnLocation = this->GetLocationAtDistance(float(PawnTrackDistance - this->TrackDistanceBase));
+	if (PawnLocation.SizeSquared() > FMath::Square(this->EndlessRebaseDistance))
+	{
+		World->RequestNewWorldOrigin(World->OriginLocation + FIntVector(PawnLocation));
+	}
 }
 
 #if 0
@@ -792,5 +2000,282 @@ void ARingHandler::PostEditChangeProperty(FPropertyChangedEvent& Event)
 
 		this->bDebugPositionCat = false;
 	}
+	if (Name == GET_MEMBER_NAME_CHECKED(ARingHandler, bDebugGenerateManifest))
+	{
+		if (ensureMsgf(this->TrackManifest != nullptr, TEXT("Assign a TrackManifest asset before generating it.")))
+		{
+			TArray<FSoftObjectPath> Assets;
+			this->CollectTrackAssets(Assets);
+			this->TrackManifest->SetGeneratedAssets(Assets);
+			UE_LOG(LogTemp, Log, TEXT("Generated track manifest %s with %d assets."), *this->TrackManifest->GetName(), Assets.Num());
+		}
+		this->bDebugGenerateManifest = false;
+	}
+	if (Name == GET_MEMBER_NAME_CHECKED(ARingHandler, bDebugExportTrack))
+	{
+		if (ensureMsgf(this->TrackData != nullptr, TEXT("Assign a TrackData asset before exporting the track.")))
+		{
+			this->TrackData->SetTrack(this->SplineComponent, this->RingDistance, this->TrackSeed, this->SpawnRuleTable, this->BeatChart);
+			UE_LOG(LogTemp, Log, TEXT("Exported track to %s with %d points."), *this->TrackData->GetName(), this->TrackData->GetNumPoints());
+		}
+		this->bDebugExportTrack = false;
+	}
+
+	// Any rule, beat or spawn default may have changed. Unchanged rings are skipped. Like OnConstruction, only outside play.
+	UWorld *World = Super::GetWorld();
+	if (World != nullptr && !World->IsGameWorld())
+	{
+		this->UpdatePreview();
+	}
+}
+
+void ARingHandler::OnConstruction(const FTransform &Transform)
+{
+	Super::OnConstruction(Transform);
+
+	// Runs after spline points are moved in the editor.
+	UWorld *World = Super::GetWorld();
+	if (World != nullptr && !World->IsGameWorld())
+	{
+		this->UpdatePreview();
+	}
+}
+
+namespace
+{
+	// Rings per preview chunk. Editing a ring rebuilds this many.
+	constexpr int32 PreviewChunkSize = 32;
+
+	uint32 HashPreviewRing(const FRingRecord &Record)
+	{
+		const FRingSpawnState &State = Record.State;
+		uint32 Hash = FCrc::MemCrc32(&Record.Location, sizeof(FVector));
+		Hash = FCrc::MemCrc32(&Record.Rotation, sizeof(FRotator), Hash);
+		Hash = HashCombine(Hash, GetTypeHash(Record.Radius));
+		Hash = HashCombine(Hash, GetTypeHash(Record.RotationOffset));
+		Hash = HashCombine(Hash, GetTypeHash(State.Mesh));
+		Hash = HashCombine(Hash, GetTypeHash(State.MaterialInterface));
+		Hash = HashCombine(Hash, GetTypeHash(State.Color));
+		Hash = HashCombine(Hash, GetTypeHash(uint8(State.MeshType)));
+		Hash = HashCombine(Hash, GetTypeHash(State.Resolution));
+		if (Record.bObstacle)
+		{
+			Hash = HashCombine(Hash, GetTypeHash(State.ObstacleMesh));
+			Hash = HashCombine(Hash, GetTypeHash(State.ObstacleMaterialInterface));
+		}
+		return Hash;
+	}
+
+	void DestroyPreviewComponents(FRingPreviewChunk &Chunk)
+	{
+		for (UInstancedStaticMeshComponent *Component : Chunk.Components)
+		{
+			if (Component != nullptr)
+			{
+				Component->DestroyComponent();
+			}
+		}
+		Chunk.Components.Reset();
+	}
+}
+
+void ARingHandler::UpdatePreview()
+{
+	USplineComponent *Spline = this->SplineComponent;
+	if (!this->bPreviewTrack || Spline == nullptr || Spline->GetNumberOfSplinePoints() < 2 || this->RingDistance <= 0.0f)
+	{
+		this->ClearPreview();
+		return;
+	}
+
+	// Evaluate the rule table and beat chart the same way the game does, on copies of its own. A handler in play keeps its rules.
+	TMap<int32, TArray<FRingSpawnRule>> RuleMap;
+	for (const FRingSpawnRuleEntry &Entry : this->SpawnRuleTable)
+	{
+		RuleMap.FindOrAdd(Entry.OnRing - 1).Add(ARingHandler::MakeSpawnRule(Entry));
+	}
+	FRingBeatSpawnState Beat;
+	if (!this->BeatChart.Rings.IsEmpty())
+	{
+		ARingHandler::MakeBeatSpawnState(this->BeatChart, Beat);
+	}
+
+	const int32 NumRings = FMath::FloorToInt(Spline->GetSplineLength() / this->RingDistance) + 1;
+	TArray<float> Distances;
+	Distances.Reserve(NumRings);
+	for (int32 i = 0; i < NumRings; ++i)
+	{
+		Distances.Add(i * this->RingDistance);
+	}
+	TArray<FVector> Locations;
+	TArray<FRotator> Rotations;
+	this->GetTransformsAtDistances(Distances, Locations, Rotations);
+
+	TArray<FRingRecord> Records;
+	Records.SetNum(NumRings);
+	FRingSpawnState State;
+	this->MakeDefaultSpawnState(State);
+	TArray<FActiveRingSpawnRule> Rules;
+	for (int32 i = 0; i < NumRings; ++i)
+	{
+		this->ExecuteSpawnRules(RuleMap, State, Rules, i);
+		Records[i].Location = Locations[i];
+		Records[i].Rotation = Rotations[i];
+		this->MakeRingRecord(Records[i], State, Beat, i);
+	}
+
+	// Find the chunks whose rings changed.
+	const int32 PreviousRings = this->PreviewHashes.Num();
+	const int32 PreviousChunks = this->PreviewChunks.Num();
+	const int32 NumChunks = FMath::DivideAndRoundUp(NumRings, PreviewChunkSize);
+	TBitArray<> DirtyChunks(false, NumChunks);
+	this->PreviewHashes.SetNumZeroed(NumRings);
+	for (int32 i = 0; i < NumRings; ++i)
+	{
+		const uint32 Hash = HashPreviewRing(Records[i]);
+		if (i >= PreviousRings || this->PreviewHashes[i] != Hash)
+		{
+			DirtyChunks[i / PreviewChunkSize] = true;
+		}
+		this->PreviewHashes[i] = Hash;
+	}
+	if (NumRings < PreviousRings)
+	{
+		DirtyChunks[NumChunks - 1] = true;
+	}
+	for (int32 c = NumChunks; c < PreviousChunks; ++c)
+	{
+		DestroyPreviewComponents(this->PreviewChunks[c]);
+	}
+	this->PreviewChunks.SetNum(NumChunks);
+
+	int32 Rebuilt = 0;
+	TArray<FRingSegmentParams> SegmentRingParams;
+	TArray<UInstancedStaticMeshComponent*> SegmentComponents;
+	TArray<FTransform> Segments;
+	TArray<int32> FirstSegments;
+	for (int32 c = 0; c < NumChunks; ++c)
+	{
+		if (!DirtyChunks[c])
+		{
+			continue;
+		}
+		++Rebuilt;
+		FRingPreviewChunk &Chunk = this->PreviewChunks[c];
+		DestroyPreviewComponents(Chunk);
+
+		// One component per mesh, material and colour in the chunk. Obstacles keep their material as is.
+		struct FBatchKey
+		{
+			UStaticMesh *Mesh;
+			UMaterialInterface *Material;
+			FColor Color;
+			bool bTinted;
+		};
+		TArray<FBatchKey> Keys;
+		auto FindComponent = [&](UStaticMesh *Mesh, UMaterialInterface *Material, FColor Color, bool bTinted)
+		{
+			for (int32 k = 0; k < Keys.Num(); ++k)
+			{
+				const FBatchKey &Key = Keys[k];
+				if (Key.Mesh == Mesh && Key.Material == Material && Key.bTinted == bTinted && (!bTinted || Key.Color == Color))
+				{
+					return Chunk.Components[k];
+				}
+			}
+			UInstancedStaticMeshComponent *Component = NewObject<UInstancedStaticMeshComponent>(this, NAME_None, RF_Transient);
+			Component->SetStaticMesh(Mesh);
+			Component->SetCastShadow(false);
+			Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			if (Material != nullptr && bTinted)
+			{
+				UMaterialInstanceDynamic *MaterialInstanceDynamic = UMaterialInstanceDynamic::Create(Material, Component);
+				MaterialInstanceDynamic->SetVectorParameterValue(TEXT("Color"), Color);
+				MaterialInstanceDynamic->SetScalarParameterValue(TEXT("OpacityPercentage"), 1.0f);
+				Component->SetMaterial(0, MaterialInstanceDynamic);
+			}
+			else if (Material != nullptr)
+			{
+				Component->SetMaterial(0, Material);
+			}
+			Component->SetupAttachment(Super::RootComponent);
+			Component->RegisterComponent();
+			Keys.Add({ Mesh, Material, Color, bTinted });
+			Chunk.Components.Add(Component);
+			return Component;
+		};
+
+		const int32 Last = FMath::Min((c + 1) * PreviewChunkSize, NumRings);
+		SegmentRingParams.Reset();
+		SegmentComponents.Reset();
+		for (int32 i = c * PreviewChunkSize; i < Last; ++i)
+		{
+			const FRingRecord &Record = Records[i];
+			const FRingSpawnState &RingState = Record.State;
+			const FQuat Rotation = Record.Rotation.Quaternion();
+			if (RingState.Mesh != nullptr && RingState.MeshType == ERingMeshType::SingleMesh)
+			{
+				// Same placement as ARing::InitRing: the ring rotation, rolled by the offset.
+				const FQuat MeshRotation = Rotation * FRotator(0.0f, 0.0f, Record.RotationOffset).Quaternion();
+				FindComponent(RingState.Mesh, RingState.MaterialInterface, RingState.Color, true)
+					->AddInstanceWorldSpace(FTransform(MeshRotation, Record.Location, FVector(Record.Radius) * 0.2f));
+			}
+			else if (RingState.Mesh != nullptr && RingState.Resolution > 0)
+			{
+				// Built with the rest of the chunk's segments below.
+				FRingSegmentParams &Params = SegmentRingParams.AddDefaulted_GetRef();
+				Params.BaseRotation = Rotation;
+				Params.BaseLocation = Record.Location;
+				Params.Radius = Record.Radius;
+				Params.AngleOffset = Record.RotationOffset;
+				Params.Resolution = RingState.Resolution;
+				SegmentComponents.Add(FindComponent(RingState.Mesh, RingState.MaterialInterface, RingState.Color, true));
+			}
+			if (Record.bObstacle && RingState.ObstacleMesh != nullptr && RingState.ObstacleMaterialInterface != nullptr)
+			{
+				FRandomStream RotationStream = ARingHandler::MakeRandomStream(this->TrackSeed, i, ERingRandom::ObstacleRotation);
+				const FQuat ObstacleRotation = Rotation * FRotator(0.0f, 0.0f, RotationStream.FRandRange(0.0f, PI * 2.0f)).Quaternion();
+				FindComponent(RingState.ObstacleMesh, RingState.ObstacleMaterialInterface, FColor::White, false)
+					->AddInstanceWorldSpace(FTransform(ObstacleRotation, Record.Location, FVector(Record.Radius) * 0.2f));
+			}
+		}
+
+		// One kernel call for the whole chunk. The engine's instanced components only add instances one at a time.
+		Segments.Reset();
+		FRingSegmentKernel::BuildSegmentTransforms(SegmentRingParams, Segments, &FirstSegments);
+		for (int32 r = 0; r < SegmentRingParams.Num(); ++r)
+		{
+			const int32 First = FirstSegments[r];
+			for (int32 i = First; i < First + SegmentRingParams[r].Resolution; ++i)
+			{
+				SegmentComponents[r]->AddInstanceWorldSpace(Segments[i]);
+			}
+		}
+	}
+
+	if (Rebuilt > 0)
+	{
+		UE_LOG(LogTemp, Verbose, TEXT("Track preview: rebuilt %d of %d chunks (%d rings)."), Rebuilt, NumChunks, NumRings);
+	}
+}
+
+void ARingHandler::ClearPreview()
+{
+	for (FRingPreviewChunk &Chunk : this->PreviewChunks)
+	{
+		DestroyPreviewComponents(Chunk);
+	}
+	this->PreviewChunks.Empty();
+	this->PreviewHashes.Empty();
+}
+
+void ARingHandler::SetGeneratedTrack(const TArray<FVector> &Points, const TArray<FRingSpawnRuleEntry> &Rules, const FRingBeatChart &Chart, int32 Seed)
+{
+	UObject::Modify();
+	this->SplineComponent->SetSplinePoints(Points, ESplineCoordinateSpace::Local, true);
+	this->SpawnRuleTable = Rules;
+	this->BeatChart = Chart;
+	this->TrackSeed = Seed;
+	this->bEndlessMode = false;
 }
 #endif
\ No newline at end of file
@@ -4,10 +4,18 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "RingSim.h"
+#include "RingKernel.h"
+#include "RingQualityGovernor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Components/SplineComponent.h"
 #include "RingHandler.generated.h"
 
 class ARing;
 class UStaticMesh;
+class UTrackData;
+class UTrackManifest;
+class UInstancedStaticMeshComponent;
 class USplineComponent;
 struct FRingSpawnState;
 struct FActiveRingSpawnRule;
@@ -29,6 +37,119 @@ enum class ERingOffsetType : uint8
 	Random, Fixed, Incremental
 };
 
+// What a random draw is used for. Each ring and purpose gets its own stream.
+enum class ERingRandom : uint8
+{
+	RotationOffset, RotationSpeed, ObstacleChance, ObstacleMesh, ObstacleRotation, BeatMesh
+};
+
+UENUM(BlueprintType)
+enum class ERingSpawnRuleType : uint8
+{
+	Radius, Mesh, Offset, Rotation, Color, Resolution, Obstacle
+};
+
+/** Serialized form of a SpawnRule_Set* call. Lets the rule table be inspected in the editor. */
+USTRUCT(BlueprintType)
+struct FRingSpawnRuleEntry
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	ERingSpawnRuleType Type = ERingSpawnRuleType::Radius;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 OnRing = 1;
+
+	// Radius, offset or minimum rotation speed.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float Value = 0.0f;
+
+	// Maximum rotation speed.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float ValueMax = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float ForceRerollMin = -1.0f;
+
+	// Radius transition rings or resolution.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 Count = 0;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UStaticMesh *Mesh = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UMaterialInterface *Material = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	ERingMeshType MeshType = ERingMeshType::MultipleMesh;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	ERingOffsetType OffsetType = ERingOffsetType::Random;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FColor Color = FColor::White;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bSingleRing = false;
+};
+
+/** Ring system settings for one step of the quality governor. */
+USTRUCT(BlueprintType)
+struct FRingQualityLevel
+{
+	GENERATED_BODY()
+
+public:
+	// Scales RingFadeDistance and RingLodDistance.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float FadeDistanceScale = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float LodDistanceScale = 1.0f;
+
+	// Most segments a ring is built with, even at full detail. 0 doesn't limit it.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxResolution = 0;
+
+	// Most ring actors created in one frame. 0 doesn't limit it.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 SpawnBudget = 0;
+
+	// Mesh LOD forced on obstacles, 0 being automatic and 1 the most detailed.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 ObstacleForcedLod = 0;
+};
+
+/** Serialized arguments of SpawnRule_SetBeatRings. */
+USTRUCT(BlueprintType)
+struct FRingBeatChart
+{
+	GENERATED_BODY()
+
+public:
+	// Comma separated ring numbers.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FString Rings;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<UStaticMesh*> Meshes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UMaterialInterface *MaterialInterface = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FColor Color = FColor::White;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<UStaticMesh*> ObstacleMeshes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UMaterialInterface *ObstacleMaterialInterface = nullptr;
+};
+
 USTRUCT()
 struct FActiveRingSpawnRule
 {
@@ -38,7 +159,8 @@ public:
 	int32 RingIndex = -1;
 	int32 RingCounter = 0;
 
-	FRingSpawnRule Rule;
+	// Position of the rule in SpawnRuleMap[RingIndex]. Rules are looked up rather than copied, as copying a delegate allocates.
+	int32 RuleIndex = 0;
 
 	uint8 CacheMemory[18];
 
@@ -105,6 +227,127 @@ public:
 	UMaterialInterface *ObstacleMaterialInterface;
 };
 
+/**
+ * A ring in the window ahead of the pawn. Records are the simulation, kept contiguous and sorted by index.
+ * Only rings visible enough to be seen get an actor, which just shows what the record says.
+ */
+USTRUCT()
+struct FRingRecord
+{
+	GENERATED_BODY()
+
+public:
+	int32 Index = INDEX_NONE;
+
+	// Spawn transform on the spline.
+	FVector Location = FVector::ZeroVector;
+	FRotator Rotation = FRotator::ZeroRotator;
+
+	float Radius = 0.0f;
+
+	// Radians around the ring at which the first segment sits.
+	float RotationOffset = 0.0f;
+
+	// Degrees per second, and the angle reached so far.
+	float RotationSpeed = 0.0f;
+	float Phase = 0.0f;
+
+	// Negative once the ring has left the window.
+	float Opacity = 0.0f;
+
+	// Level of detail, 0 being full. Segments drawn at the current level.
+	uint8 Lod = 1;
+	int32 Resolution = 0;
+
+	bool bObstacle = false;
+	bool bObstacleHit = false;
+
+	// Inside the rail camera view. Hidden rings keep their actor but aren't updated.
+	bool bVisible = true;
+
+	// The look the spawn rules gave this ring, kept until an actor is made for it.
+	UPROPERTY()
+	FRingSpawnState State;
+
+	UPROPERTY()
+	ARing *Actor = nullptr;
+};
+
+/** Spawn state a ring started from, kept for practice rewinds. Recorded once per ring rather than every step. */
+USTRUCT()
+struct FRingSpawnKeyframe
+{
+	GENERATED_BODY()
+
+public:
+	int32 RingIndex = INDEX_NONE;
+
+	// Ring clock when the ring spawned. Its phase follows from this.
+	double SpawnClock = 0.0;
+
+	// Before this ring's rules ran.
+	UPROPERTY()
+	FRingSpawnState State;
+
+	UPROPERTY()
+	TArray<FActiveRingSpawnRule> Rules;
+};
+
+/** Beat judgement state of one step, as much of the ring handler as a practice rewind puts back. */
+struct FRingRewindState
+{
+	FRingBeatJudgeState Judge;
+	double Clock = 0.0;
+};
+
+/** Instanced components drawing one run of rings in the editor track preview. */
+USTRUCT()
+struct FRingPreviewChunk
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(Transient)
+	TArray<UInstancedStaticMeshComponent*> Components;
+};
+
+/** Rail camera view rings are culled against. Taken from the camera manager, so it lags a frame behind the pawn. */
+struct FRingView
+{
+	FVector Location = FVector::ZeroVector;
+	FVector Forward = FVector::ForwardVector;
+	FVector Right = FVector::RightVector;
+	FVector Up = FVector::UpVector;
+	float TanHalfWidth = 1.0f;
+	float TanHalfHeight = 1.0f;
+	bool bValid = false;
+
+	bool IntersectsSphere(const FVector &Center, float Radius) const;
+};
+
+/** One frame of the ring window simulation. Inputs are copied on the game thread, outputs are applied there once the worker is done. */
+struct FRingUpdateTask
+{
+	FVector PawnLocation = FVector::ZeroVector;
+	// Cleared when the pawn's distance is known already, and given in PawnDistance.
+	bool bLocatePawn = true;
+	int32 NextBeatRingIndex = -1;
+	int32 ProfileLimit = MAX_int32;
+	float DeltaTime = 0.0f;
+	FRingView View;
+
+	float PawnDistance = 0.0f;
+	int32 MinRing = 0;
+	int32 MaxRing = 0;
+	bool bReachedEnd = false;
+	bool bMissedBeat = false;
+
+	TArray<int32> SpawnIndices;
+	TArray<float> SpawnDistances;
+	TArray<FVector> SpawnLocations;
+	TArray<FRotator> SpawnRotations;
+};
+
 UCLASS()
 class CATNIP_API ARingHandler : public AActor
 {
@@ -116,24 +359,45 @@ public:
 protected:
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:
 	virtual void Tick(float DeltaTime) override;
 
+	virtual void ApplyWorldOffset(const FVector &InOffset, bool bWorldShift) override;
+
 	void FailRing(int32 Ring);
 
+	// Fails the ring once, however often its obstacle is touched.
+	void HitObstacle(int32 RingIndex);
+
 	void RegisterAction();
 
+	// Starts the ring update for this frame. Rings are spawned, removed and faded when it's applied in Tick.
 	void UpdateHandler(FVector PawnLocation);
 
+	// Like UpdateHandler, for a track the pawn isn't on yet. Distance is along this track, negative before its start.
+	void UpdateHandlerAtDistance(float Distance);
+
 	float GetDistanceAtInputKey(float InputKey) const;
 
 	FVector GetLocationAtDistance(float Distance) const;
 
 	FRotator GetRotationAtDistance(float Distance) const;
 
+	// Sorted distances only. Walks the reparam table and spline segments once instead of searching for each distance.
+	void GetTransformsAtDistances(TArrayView<const float> Distances, TArray<FVector> &OutLocations, TArray<FRotator> &OutRotations) const;
+
 	FVector FindLocationClosestTo(FVector Location) const;
 
-	FVector RestrictPositionOffset(const FVector &SplinePosition, const FVector &PositionOffset, float RadiusShrink = 0.0f) const;
+	FVector RestrictPositionOffset(float Distance, const FVector &PositionOffset, float RadiusShrink = 0.0f) const;
+
+	float GetRingRadius(int32 RingIndex) const;
+
+	// Ring randomness only depends on the seed, ring index and purpose, never on spawn order or frame timing.
+	static FRandomStream MakeRandomStream(int32 Seed, int32 RingIndex, ERingRandom Purpose);
+
+	static float DrawRotationSpeed(FRandomStream &Stream, float MinSpeed, float MaxSpeed, float ForceRerollMin);
 
 	void AddSpawnRule(int32 OnRing, FRingSpawnRule Rule);
 
@@ -162,13 +426,155 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Spawn Rules")
 	ARingHandler *SpawnRule_SetObstacle(int32 OnRing, UStaticMesh *ObstacleMesh, UMaterialInterface *ObstacleMaterial);
 
+	void ApplySpawnRuleTable();
+
+	// The rule a rule table entry stands for. SpawnRule_Set* calls make theirs from an entry too.
+	static FRingSpawnRule MakeSpawnRule(const FRingSpawnRuleEntry &Entry);
+
+	// Beat rings parsed from the chart, with neighbouring rings thinned out.
+	static void MakeBeatSpawnState(const FRingBeatChart &Chart, FRingBeatSpawnState &OutState);
+
+	// Replaces the spline, rule table and beat chart with the track data and starts the track over. Rules added from Blueprint are dropped.
+	// Only the handler starts over. During play, go through ADefaultGameMode::LoadTrack so the rest of the run does too.
+	bool LoadTrack(UTrackData *Data);
+
+	// Puts the rings back to the start of the run in place, keeping pooled actors. Rules and beats are the ones the run started with.
+	UFUNCTION(BlueprintCallable, Category = "RingHandler")
+	void ResetRun();
+
+	// Moves the handler so the first spline point is at Location, facing Rotation. Used to join a track graph segment to the last.
+	void PlaceTrackStart(const FVector &Location, const FQuat &Rotation);
+
+	// Drops the rings, rules, beats and spline of the track, keeping pooled actors, until the next LoadTrack.
+	void ReleaseTrack();
+
+	// A track graph carries on past the end of this track, so reaching it doesn't complete the game.
+	FORCEINLINE void SetTrackContinues(bool bContinues)
+	{
+		this->bTrackContinues = bContinues;
+	}
+
+	// Handlers playing one track together, like the segments of a track graph, follow the one the pawn is on. They take
+	// its quality level instead of governing their own, and a follower spawned mid-run doesn't start an allocation run.
+	FORCEINLINE void SetLeader(ARingHandler *InLeader)
+	{
+		this->Leader = InLeader;
+	}
+
+	// Keeps the spawn state of enough rings to rebuild the window anywhere in the last Distance of track. 0 stops keeping it.
+	void SetRewindDistance(float Distance);
+
+	void SaveRewindState(FRingRewindState &OutState) const;
+
+	// Only on fixed tracks, and only while the spawn state of the window's first ring at Distance is kept.
+	bool CanRewindTo(float Distance) const;
+
+	// Rebuilds the ring window for the pawn at Distance straight from the kept spawn state, without replaying the run.
+	bool RewindTo(const FRingRewindState &State, float Distance);
+
+	// Everything the run loads behind the loading screen, including what the game mode plays it with.
+	void CollectTrackAssets(TArray<FSoftObjectPath> &OutAssets) const;
+
+	// Spawns the pooled ring actors. Does nothing until the ring class is loaded, so it's called again after the preload.
+	void FillRingActorPool();
+
+	// Fixed tracks only. Copies what a simulated run needs: the track sampled every SampleSpacing, radii and beats.
+	void BakeSimChart(FRingSimChart &OutChart, float SampleSpacing) const;
+
 #if WITH_EDITOR
 	void PostEditChangeProperty(struct FPropertyChangedEvent& event) override;
+
+	virtual void OnConstruction(const FTransform &Transform) override;
+
+	// Draws every ring of the track from the spawn rule table and beat chart. Only runs of rings that changed are rebuilt.
+	void UpdatePreview();
+
+	void ClearPreview();
+
+	// Replaces the spline, spawn rule table and beat chart. Used to generate stress tracks.
+	void SetGeneratedTrack(const TArray<FVector> &Points, const TArray<FRingSpawnRuleEntry> &Rules, const FRingBeatChart &Chart, int32 Seed);
 #endif
 
 	/// ///
 
-	ARing *SpawnRing(int32 Index);
+	void SpawnRing(int32 Index, const FVector &Location, const FRotator &Rotation);
+
+	// Everything drawn for a ring besides its transform. State is the spawn state after this ring's rules ran.
+	void MakeRingRecord(FRingRecord &Record, FRingSpawnState &State, const FRingBeatSpawnState &Beat, int32 Index) const;
+
+	void ResetSpawnState();
+
+	// Spawn state before any rule ran, from the handler's spawn defaults.
+	void MakeDefaultSpawnState(FRingSpawnState &OutState) const;
+
+	// Starts the rings over from the beginning of the current spline, rule table and beat chart.
+	void StartTrack();
+
+	// Keeps what the run changes as it goes, for ResetRun. Taken on the first update, after Blueprints added their rules.
+	void SaveRunStart();
+
+	// Takes a pooled actor when there is one.
+	ARing *SpawnRingActor(FRingRecord &Record);
+
+	void ReleaseRingActor(ARing *Ring);
+
+	// Shows the record on its actor, and queues the actor's segments if their resolution changed.
+	void ApplyRecordToActor(const FRingRecord &Record);
+
+	// Builds the segments of every queued ring in one kernel call and hands each ring its part of the output.
+	void BuildQueuedSegments();
+
+	// Drops every ring record, releasing their actors.
+	void ClearRings();
+
+	// Most rings the window can hold at once.
+	int32 GetWindowRingCount() const;
+
+	// Rings the window holds with the pawn at Distance.
+	void GetWindowAtDistance(float Distance, int32 &OutMinRing, int32 &OutMaxRing) const;
+
+	FRingRecord *FindRing(int32 RingIndex);
+
+	float GetRingOpacity(int32 RingIndex, float PawnDistance) const;
+
+	// Moves the ring between full and reduced detail as the pawn approaches or leaves it.
+	void UpdateRingLod(FRingRecord &Record, float PawnDistance) const;
+
+	// Only called between updates, as the worker reads the distances.
+	void ApplyQualityLevel(int32 Level);
+
+	// Dispatches the update once the task's pawn location or distance is set.
+	void StartUpdate(const FVector &PawnLocation, bool bLocatePawn, float PawnDistance);
+
+	// Only rules of the spawned rings are traced, not those the radius profile and preview run ahead on copies.
+	void ExecuteSpawnRules(const TMap<int32, TArray<FRingSpawnRule>> &RuleMap, FRingSpawnState &State,
+		TArray<FActiveRingSpawnRule> &Rules, int32 Index, bool bTrace = false) const;
+
+	// Ends the trace spans of the active rules before they are dropped without finishing.
+	void EndActiveRuleTraces() const;
+
+	// Starts the profile over from ring 0.
+	void ResetRadiusProfile();
+
+	// Drops the evaluated radii and runs the rules again from the profile base, the first ring whose rules are still kept.
+	void ReplayRadiusProfile();
+
+	void ExtendRadiusProfile(int32 ToRing);
+
+	// Endless tracks only. Drops radii before FromRing, running their rules on the base state so replays start from the new base.
+	void TrimRadiusProfile(int32 FromRing);
+
+	// Samples the spline for locating the pawn. Endless tracks change under it, so they keep using the spline.
+	void BakeSimTrack(FRingSimTrack &OutTrack, float SampleSpacing) const;
+
+	void UpdateEndlessTrack(float PawnDistance);
+
+	// Pure data. Only touches the task, the radius profile and the phase and opacity of ring records, so it can run on a worker.
+	void RunUpdate(FRingUpdateTask &Task);
+
+	void ApplyUpdate();
+
+	void WaitForUpdate();
 
 	UFUNCTION(BlueprintPure, Category = "RingHandler")
 	FORCEINLINE float GetFadeDistance() const
@@ -182,11 +588,32 @@ public:
 		return this->RingDistance;
 	}
 
+	FORCEINLINE USplineComponent *GetSplineComponent() const
+	{
+		return this->SplineComponent;
+	}
+
 	FORCEINLINE float GetCurrentPawnDistance() const
 	{
 		return this->CurrentPawnDistance;
 	}
 
+	// Absolute track distance of the first spline point. Only moves in endless mode, as the track is trimmed behind the pawn.
+	FORCEINLINE double GetTrackDistanceBase() const
+	{
+		return this->TrackDistanceBase;
+	}
+
+	FORCEINLINE float GetDistanceAtRing(int32 RingIndex) const
+	{
+		return float(double(RingIndex) * this->RingDistance - this->TrackDistanceBase);
+	}
+
+	FORCEINLINE double GetExactRingAtDistance(float Distance) const
+	{
+		return (this->TrackDistanceBase + Distance) / this->RingDistance;
+	}
+
 	FORCEINLINE FRingSpawnState& GetSpawnState()
 	{
 		return this->SpawnState;
@@ -197,6 +624,11 @@ public:
 		return this->BeatSpawnState.Rings;
 	}
 
+	FORCEINLINE UTrackManifest *GetTrackManifest() const
+	{
+		return this->TrackManifest;
+	}
+
 protected:
 	UPROPERTY(EditDefaultsOnly)
 	bool bDisableObstacles;
@@ -213,6 +645,9 @@ protected:
 	UPROPERTY(EditDefaultsOnly)
 	float ObstacleSpawnChancePercentage;
 
+	UPROPERTY(EditAnywhere)
+	int32 TrackSeed;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float RingDistance;
 
@@ -234,8 +669,9 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float RingSpawnRotationOffset;
 
+	// Soft, so it is loaded with the track manifest rather than the map. The ring pool is filled once it is.
 	UPROPERTY(EditDefaultsOnly)
-	TSubclassOf<ARing> RingClass;
+	TSoftClassPtr<ARing> RingClass;
 
 	UPROPERTY(EditDefaultsOnly)
 	UStaticMesh *RingMeshDefault;	
@@ -243,8 +679,95 @@ protected:
 	UPROPERTY(EditDefaultsOnly)
 	UMaterialInterface *RingMaterialInterface;
 
+	// Rules applied on BeginPlay, in addition to any registered from Blueprint.
+	UPROPERTY(EditAnywhere, Category = "Spawn Rules")
+	TArray<FRingSpawnRuleEntry> SpawnRuleTable;
+
+	UPROPERTY(EditAnywhere, Category = "Spawn Rules")
+	FRingBeatChart BeatChart;
+
+	UPROPERTY(EditAnywhere, Category = "Manifest")
+	UTrackManifest *TrackManifest;
+
+	// Loaded over the spline and rule table on BeginPlay when set.
+	UPROPERTY(EditAnywhere, Category = "Track")
+	UTrackData *TrackData;
+
+	// Generate the track ahead of the pawn and trim it behind, instead of ending at the last spline point.
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	bool bEndlessMode;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	int32 EndlessSeed;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessSegmentLength;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessMaxTurnAngle;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessMaxPitchAngle;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	int32 EndlessBeatSpacingMin;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	int32 EndlessBeatSpacingMax;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	int32 EndlessRuleInterval;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessRadiusMin;
+
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessRadiusMax;
+
+	// Distance from the world origin at which the origin is moved to the pawn.
+	UPROPERTY(EditAnywhere, Category = "Endless")
+	float EndlessRebaseDistance;
+
+	// Rings further ahead than this are drawn with at most RingLodResolution segments.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD")
+	float RingLodDistance;
+
+	// Distance past RingLodDistance a ring must be before dropping back to reduced detail, so rings on the edge don't flicker.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD")
+	float RingLodHysteresis;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD")
+	int32 RingLodResolution;
+
+	// Added to the radius of a ring when testing it against the camera view, to cover the frame the view lags behind.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Culling")
+	float RingCullMargin;
+
+	// From full quality down. The governor steps through these to hold Catnip.QualityTargetFPS.
+	UPROPERTY(EditAnywhere, Category = "Quality")
+	TArray<FRingQualityLevel> QualityLevels;
+
+	// Rings at or below this opacity are simulated without an actor.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float RingActorOpacity;
+
+	// Ring actors spawned at BeginPlay for rings to reuse. 0 spawns as many as the ring window holds.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Pool")
+	int32 RingActorPoolSize;
+
 	UPROPERTY()
-	TArray<ARing*> Rings;
+	TArray<FRingRecord> Rings;
+
+	// Released ring actors, hidden until a ring needs one.
+	UPROPERTY(Transient)
+	TArray<ARing*> RingActorPool;
+
+	// Rings whose segments are built by the next BuildQueuedSegments, and their kernel input and output. Only filled
+	// within one frame's apply, and reset rather than emptied.
+	TArray<ARing*> SegmentRings;
+	TArray<FRingSegmentParams> SegmentParams;
+	TArray<FTransform> SegmentTransforms;
+	TArray<int32> SegmentFirstIndices;
 
 	UPROPERTY(VisibleAnywhere)
 	USceneComponent *SceneComponent;
@@ -261,6 +784,25 @@ protected:
 	UPROPERTY(EditAnywhere)
 	bool bDebugPositionCat;
 
+	UPROPERTY(EditAnywhere, Category = "Manifest")
+	bool bDebugGenerateManifest;
+
+	// Writes the spline, rule table and beat chart to TrackData.
+	UPROPERTY(EditAnywhere, Category = "Track")
+	bool bDebugExportTrack;
+
+#if WITH_EDITORONLY_DATA
+	// Show the rings of the whole track in the editor, from the spawn rule table and beat chart. Rules added from Blueprint only exist in play.
+	UPROPERTY(EditAnywhere, Category = "Preview")
+	bool bPreviewTrack;
+
+	UPROPERTY(Transient)
+	TArray<FRingPreviewChunk> PreviewChunks;
+
+	// One per previewed ring. A ring whose hash changes rebuilds its chunk.
+	TArray<uint32> PreviewHashes;
+#endif
+
 public:
 	/// EVENTS ///
 
@@ -271,14 +813,20 @@ public:
 	FOnBeatRingSuccess OnBeatRingSuccess;
 
 private:
-	int32 NextBeatRingIndex;
-	int32 LastFailRing, LastSuccessRing;
-	float FailImmunityCounter;
+	FRingBeatJudge BeatJudge;
 	//bool bNextBeatRingCompleted;
 
 	bool bCompleted;
+	bool bTrackContinues;
 	float CurrentPawnDistance;
 
+	double TrackDistanceBase;
+	int32 BeatRingIndexBase;
+
+	FRandomStream EndlessStream;
+	FRotator EndlessHeading;
+	int32 EndlessNextRuleRing;
+
 	UPROPERTY()
 	FRingSpawnState SpawnState;
 
@@ -288,12 +836,64 @@ private:
 	UPROPERTY()
 	TArray<FActiveRingSpawnRule> ActiveRules;
 	TMap<int32, TArray<FRingSpawnRule>> SpawnRuleMap;
+
+	// Spawn state before any rule runs. The radius profile replays rules from here.
+	UPROPERTY()
+	FRingSpawnState InitialSpawnState;
+
+	// Radius of every ring from its base on, evaluated ahead of spawning.
+	FRingRadiusProfile RadiusProfile;
+
+	UPROPERTY()
+	FRingSpawnState RadiusProfileState;
+
+	UPROPERTY()
+	TArray<FActiveRingSpawnRule> RadiusProfileRules;
+
+	// Spawn state and running rules before the profile base. The rules of earlier rings may be gone on endless tracks.
+	UPROPERTY()
+	FRingSpawnState RadiusBaseState;
+
+	UPROPERTY()
+	TArray<FActiveRingSpawnRule> RadiusBaseRules;
+
+	FRingQualityGovernor QualityGovernor;
+
+	UPROPERTY(Transient)
+	ARingHandler *Leader;
+
+	float BaseFadeDistance;
+	float BaseLodDistance;
+	int32 QualityMaxResolution;
+	int32 QualitySpawnBudget;
+	int32 QualityObstacleLod;
+
+	bool bRunStartSaved;
+	TMap<int32, TArray<FRingSpawnRule>> RunStartRuleMap;
+	TArray<int32> RunStartBeatRings;
+	FSplineCurves RunStartCurves;
+
+	// Seconds of ring updates since the track started. Ring phases are rebuilt from it on a rewind.
+	double RingClock;
+
+	// Indexed by ring index modulo their number. Empty unless rewinds are enabled.
+	UPROPERTY(Transient)
+	TArray<FRingSpawnKeyframe> SpawnKeyframes;
+
+	// Empty on endless tracks.
+	FRingSimTrack SimTrack;
+
+	// The radius profile belongs to the worker while an update is in flight.
+	FRingUpdateTask UpdateTask;
+	FGraphEventRef UpdateEvent;
+	bool bUpdatePending;
 };
 
 /// INLINE ///
 
 FORCEINLINE void ARingHandler::AddSpawnRule(int32 OnRing, FRingSpawnRule Rule)
 {
+	this->WaitForUpdate();
 	--OnRing;
 
 	TArray<FRingSpawnRule> *Array;
@@ -307,4 +907,16 @@ FORCEINLINE void ARingHandler::AddSpawnRule(int32 OnRing, FRingSpawnRule Rule)
 	}
 	check(Array != nullptr);
 	Array->Add(Rule);
+
+	// A rule behind the evaluated profile changes radii already recorded.
+	if (OnRing < this->RadiusProfile.GetEnd())
+	{
+		this->ReplayRadiusProfile();
+	}
+}
+
+FORCEINLINE float ARingHandler::GetRingRadius(int32 RingIndex) const
+{
+	// Before the track starts there is no profile, nor a default radius for it.
+	return this->RadiusProfile.IsEmpty() ? this->RingSpawnRadius : this->RadiusProfile.GetRadius(RingIndex);
 }
\ No newline at end of file
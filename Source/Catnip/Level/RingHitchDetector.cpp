@@ -0,0 +1,127 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingHitchDetector.h"
+
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "Misc/CoreDelegates.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectGlobals.h"
+
+static TAutoConsoleVariable<float> CVarHitchThreshold(TEXT("Catnip.HitchThreshold"), 50.0f,
+	TEXT("Frames slower than this many milliseconds write the recent ring system activity to Saved/Logs/CatnipHitches.log. 0 disables."));
+
+namespace
+{
+	constexpr int64 MaxLogSize = 1024 * 1024;
+
+	const TCHAR *PhaseNames[] = { TEXT("Locate"), TEXT("Endless"), TEXT("Window"), TEXT("Beats"), TEXT("Update"), TEXT("Spawn"), TEXT("Wait") };
+	static_assert(ARRAY_COUNT(PhaseNames) == int32(ERingPhase::Num), "Name every ring phase.");
+}
+
+FRingHitchDetector &FRingHitchDetector::Get()
+{
+	static FRingHitchDetector Instance;
+	return Instance;
+}
+
+const TCHAR *FRingHitchDetector::GetPhaseName(ERingPhase Phase)
+{
+	return PhaseNames[int32(Phase)];
+}
+
+FRingHitchDetector::FRingHitchDetector()
+	: Current(0), LastFrameEnd(0.0), GarbageCollectStart(0.0)
+{
+	this->Frames[0].FrameNumber = GFrameCounter;
+
+	FCoreDelegates::OnEndFrame.AddRaw(this, &FRingHitchDetector::OnEndFrame);
+	FCoreUObjectDelegates::GetPreGarbageCollectDelegate().AddRaw(this, &FRingHitchDetector::OnPreGarbageCollect);
+	FCoreUObjectDelegates::GetPostGarbageCollect().AddRaw(this, &FRingHitchDetector::OnPostGarbageCollect);
+}
+
+void FRingHitchDetector::OnPreGarbageCollect()
+{
+	this->GarbageCollectStart = FPlatformTime::Seconds();
+}
+
+void FRingHitchDetector::OnPostGarbageCollect()
+{
+	FRingFrameStats &Frame = this->GetFrame();
+	++Frame.GarbageCollections;
+	Frame.GarbageCollectTime += FPlatformTime::Seconds() - this->GarbageCollectStart;
+}
+
+void FRingHitchDetector::OnEndFrame()
+{
+	const double Now = FPlatformTime::Seconds();
+	const double Threshold = CVarHitchThreshold.GetValueOnGameThread() / 1000.0;
+	FRingFrameStats &Frame = this->GetFrame();
+	if (this->LastFrameEnd > 0.0)
+	{
+		Frame.FrameTime = Now - this->LastFrameEnd;
+		if (Threshold > 0.0 && Frame.FrameTime > Threshold)
+		{
+			this->WriteHitch(Threshold);
+		}
+	}
+	this->LastFrameEnd = Now;
+
+	this->Current = (this->Current + 1) % NumFrames;
+	this->Frames[this->Current] = FRingFrameStats();
+	this->Frames[this->Current].FrameNumber = GFrameCounter + 1;
+}
+
+void FRingHitchDetector::WriteHitch(double Threshold)
+{
+	const FRingFrameStats &Hitch = this->GetFrame();
+	UE_LOG(LogTemp, Warning, TEXT("Hitch on frame %llu: %.1f ms. Ring system activity written to CatnipHitches.log."),
+		Hitch.FrameNumber, Hitch.FrameTime * 1000.0);
+
+	FString FileName = FPaths::ProjectLogDir() / TEXT("CatnipHitches.log");
+	if (this->Log.IsValid() && this->Log->TotalSize() > MaxLogSize)
+	{
+		this->Log.Reset();
+		IFileManager::Get().Move(*(FPaths::ProjectLogDir() / TEXT("CatnipHitches-backup.log")), *FileName);
+	}
+	if (!this->Log.IsValid())
+	{
+		this->Log.Reset(IFileManager::Get().CreateFileWriter(*FileName, FILEWRITE_Append | FILEWRITE_AllowRead));
+		if (!this->Log.IsValid())
+		{
+			return;
+		}
+	}
+
+	FString Text = FString::Printf(TEXT("%s hitch on frame %llu: %.2f ms (threshold %.1f ms)\n"),
+		*FDateTime::Now().ToString(), Hitch.FrameNumber, Hitch.FrameTime * 1000.0, Threshold * 1000.0);
+	Text += TEXT("  frame        ms spawned destroyed rules components instances queries quality gc  gc ms");
+	for (const TCHAR *Name : PhaseNames)
+	{
+		Text += FString::Printf(TEXT(" %7s"), Name);
+	}
+	Text += TEXT("\n");
+
+	// Oldest frame first.
+	for (int32 i = 1; i <= NumFrames; ++i)
+	{
+		const FRingFrameStats &Frame = this->Frames[(this->Current + i) % NumFrames];
+		if (Frame.FrameNumber == 0)
+		{
+			continue;
+		}
+		Text += FString::Printf(TEXT("  %5llu %9.2f %7d %9d %5d %10d %9d %7d %7d %2d %6.2f"), Frame.FrameNumber % 100000, Frame.FrameTime * 1000.0,
+			Frame.RingsSpawned, Frame.RingsDestroyed, Frame.RulesExecuted, Frame.ComponentsCreated, Frame.InstancesCreated,
+			Frame.ClosestPointQueries, Frame.QualityLevel, Frame.GarbageCollections, Frame.GarbageCollectTime * 1000.0);
+		for (double PhaseTime : Frame.PhaseTime)
+		{
+			Text += FString::Printf(TEXT(" %7.3f"), PhaseTime * 1000.0);
+		}
+		Text += TEXT("\n");
+	}
+
+	FTCHARToUTF8 Converted(*Text);
+	this->Log->Serialize(const_cast<ANSICHAR*>(Converted.Get()), Converted.Length());
+	this->Log->Flush();
+}
@@ -0,0 +1,107 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RingTrace.h"
+
+#define CATNIP_HITCH_DETECTOR !UE_BUILD_SHIPPING
+
+class FArchive;
+
+/** Timed phases of the ring handler update. Wait is game thread time spent blocked on the update task. */
+enum class ERingPhase : uint8
+{
+	Locate, Endless, Window, Beats, Update, Spawn, Wait, Num
+};
+
+/** What the ring system did during one frame. */
+struct FRingFrameStats
+{
+	uint64 FrameNumber = 0;
+	double FrameTime = 0.0;
+
+	int32 RingsSpawned = 0;
+	int32 RingsDestroyed = 0;
+	int32 RulesExecuted = 0;
+	int32 ComponentsCreated = 0;
+	int32 InstancesCreated = 0;
+	int32 ClosestPointQueries = 0;
+	int32 QualityLevel = 0;
+
+	int32 GarbageCollections = 0;
+	double GarbageCollectTime = 0.0;
+
+	double PhaseTime[int32(ERingPhase::Num)] = {};
+};
+
+/**
+ * Keeps stats for the last few frames. When a frame takes longer than Catnip.HitchThreshold milliseconds,
+ * all of them are appended to Saved/Logs/CatnipHitches.log. The log rolls over to a backup once it grows past a megabyte.
+ */
+class CATNIP_API FRingHitchDetector
+{
+public:
+	static FRingHitchDetector &Get();
+
+	static const TCHAR *GetPhaseName(ERingPhase Phase);
+
+	FORCEINLINE FRingFrameStats &GetFrame()
+	{
+		return this->Frames[this->Current];
+	}
+
+private:
+	FRingHitchDetector();
+
+	void OnEndFrame();
+
+	void OnPreGarbageCollect();
+
+	void OnPostGarbageCollect();
+
+	void WriteHitch(double Threshold);
+
+private:
+	static constexpr int32 NumFrames = 8;
+
+	FRingFrameStats Frames[NumFrames];
+	int32 Current;
+
+	double LastFrameEnd;
+	double GarbageCollectStart;
+
+	TUniquePtr<FArchive> Log;
+};
+
+/** Adds the time spent in its scope to a phase of the current frame. A phase is only ever timed on one thread at a time. */
+struct FRingPhaseScope
+{
+	FORCEINLINE FRingPhaseScope(ERingPhase InPhase)
+		: Phase(InPhase), Start(FPlatformTime::Seconds())
+	{
+	}
+
+	FORCEINLINE ~FRingPhaseScope()
+	{
+		const double End = FPlatformTime::Seconds();
+		FRingHitchDetector::Get().GetFrame().PhaseTime[int32(this->Phase)] += End - this->Start;
+#if CATNIP_RING_TRACE
+		if (FRingTrace::IsActive())
+		{
+			FRingTrace::Get().AddScope(FRingHitchDetector::GetPhaseName(this->Phase), this->Start, End);
+		}
+#endif
+	}
+
+	ERingPhase Phase;
+	double Start;
+};
+
+#if CATNIP_HITCH_DETECTOR
+#define RING_HITCH_SCOPE(Phase) FRingPhaseScope PREPROCESSOR_JOIN(RingPhaseScope, __LINE__)(ERingPhase::Phase)
+#define RING_HITCH_COUNT(Counter, Amount) FPlatformAtomics::InterlockedAdd(&FRingHitchDetector::Get().GetFrame().Counter, (Amount))
+#else
+#define RING_HITCH_SCOPE(Phase)
+#define RING_HITCH_COUNT(Counter, Amount)
+#endif
@@ -0,0 +1,171 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingKernel.h"
+
+#include "HAL/IConsoleManager.h"
+
+namespace
+{
+	int32 ReserveTransforms(TArrayView<const FRingSegmentParams> Rings, TArray<FTransform> &OutTransforms, TArray<int32> *OutFirstIndices)
+	{
+		int32 Total = 0;
+		for (const FRingSegmentParams &Ring : Rings)
+		{
+			Total += FMath::Max(Ring.Resolution, 0);
+		}
+		if (OutFirstIndices != nullptr)
+		{
+			OutFirstIndices->Reset(Rings.Num());
+		}
+		int32 First = OutTransforms.Num();
+		OutTransforms.AddUninitialized(Total);
+		return First;
+	}
+}
+
+void FRingSegmentKernel::BuildSegmentTransforms(TArrayView<const FRingSegmentParams> Rings, TArray<FTransform> &OutTransforms,
+	TArray<int32> *OutFirstIndices)
+{
+	int32 Write = ReserveTransforms(Rings, OutTransforms, OutFirstIndices);
+	FTransform *Output = OutTransforms.GetData();
+
+	const VectorRegister Lanes = MakeVectorRegister(0.0f, 1.0f, 2.0f, 3.0f);
+	const VectorRegister Two = VectorSetFloat1(2.0f);
+
+	for (const FRingSegmentParams &Ring : Rings)
+	{
+		if (OutFirstIndices != nullptr)
+		{
+			OutFirstIndices->Add(Write);
+		}
+		const int32 Num = Ring.Resolution;
+		if (Num <= 0)
+		{
+			continue;
+		}
+
+		const VectorRegister Increment = VectorSetFloat1(PI * 2.0f / Num);
+		const VectorRegister Offset = VectorSetFloat1(Ring.AngleOffset);
+		const VectorRegister Radius = VectorSetFloat1(Ring.Radius);
+		const VectorRegister QX = VectorSetFloat1(Ring.BaseRotation.X);
+		const VectorRegister QY = VectorSetFloat1(Ring.BaseRotation.Y);
+		const VectorRegister QZ = VectorSetFloat1(Ring.BaseRotation.Z);
+		const VectorRegister QW = VectorSetFloat1(Ring.BaseRotation.W);
+		const VectorRegister LX = VectorSetFloat1(Ring.BaseLocation.X);
+		const VectorRegister LY = VectorSetFloat1(Ring.BaseLocation.Y);
+		const VectorRegister LZ = VectorSetFloat1(Ring.BaseLocation.Z);
+
+		for (int32 i = 0; i < Num; i += 4)
+		{
+			VectorRegister Angles = VectorMultiplyAdd(VectorAdd(VectorSetFloat1(float(i)), Lanes), Increment, Offset);
+			VectorRegister Sin, Cos;
+			VectorSinCos(&Sin, &Cos, &Angles);
+
+			// Point on the ring plane is (0, Y, Z). Rotate by the base quaternion: V' = V + W * T + Q x T, where T = 2 * (Q x V).
+			VectorRegister Y = VectorMultiply(Sin, Radius);
+			VectorRegister Z = VectorMultiply(Cos, Radius);
+			VectorRegister TX = VectorMultiply(Two, VectorSubtract(VectorMultiply(QY, Z), VectorMultiply(QZ, Y)));
+			VectorRegister TY = VectorNegate(VectorMultiply(Two, VectorMultiply(QX, Z)));
+			VectorRegister TZ = VectorMultiply(Two, VectorMultiply(QX, Y));
+
+			VectorRegister RX = VectorAdd(VectorMultiplyAdd(QW, TX, VectorSubtract(VectorMultiply(QY, TZ), VectorMultiply(QZ, TY))), LX);
+			VectorRegister RY = VectorAdd(VectorAdd(Y, VectorMultiplyAdd(QW, TY, VectorSubtract(VectorMultiply(QZ, TX), VectorMultiply(QX, TZ)))), LY);
+			VectorRegister RZ = VectorAdd(VectorAdd(Z, VectorMultiplyAdd(QW, TZ, VectorSubtract(VectorMultiply(QX, TY), VectorMultiply(QY, TX)))), LZ);
+
+			MS_ALIGN(16) float X4[4] GCC_ALIGN(16);
+			MS_ALIGN(16) float Y4[4] GCC_ALIGN(16);
+			MS_ALIGN(16) float Z4[4] GCC_ALIGN(16);
+			VectorStoreAligned(RX, X4);
+			VectorStoreAligned(RY, Y4);
+			VectorStoreAligned(RZ, Z4);
+
+			const int32 Count = FMath::Min(4, Num - i);
+			for (int32 Lane = 0; Lane < Count; ++Lane)
+			{
+				new (&Output[Write++]) FTransform(Ring.SegmentRotation, FVector(X4[Lane], Y4[Lane], Z4[Lane]));
+			}
+		}
+	}
+}
+
+void FRingSegmentKernel::BuildSegmentTransformsScalar(TArrayView<const FRingSegmentParams> Rings, TArray<FTransform> &OutTransforms,
+	TArray<int32> *OutFirstIndices)
+{
+	int32 Write = ReserveTransforms(Rings, OutTransforms, OutFirstIndices);
+	FTransform *Output = OutTransforms.GetData();
+
+	for (const FRingSegmentParams &Ring : Rings)
+	{
+		if (OutFirstIndices != nullptr)
+		{
+			OutFirstIndices->Add(Write);
+		}
+		const float Increment = PI * 2.0f / FMath::Max(Ring.Resolution, 1);
+		for (int32 i = 0; i < Ring.Resolution; ++i)
+		{
+			float Sin, Cos;
+			FMath::SinCos(&Sin, &Cos, Increment * i + Ring.AngleOffset);
+
+			FVector Point = Ring.BaseRotation.RotateVector(FVector(0.0f, Sin, Cos) * Ring.Radius) + Ring.BaseLocation;
+			new (&Output[Write++]) FTransform(Ring.SegmentRotation, Point);
+		}
+	}
+}
+
+#if !UE_BUILD_SHIPPING
+static void BenchmarkRingKernel(const TArray<FString> &Args)
+{
+	const int32 NumRings = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000;
+	const int32 Resolution = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 12;
+	const int32 Iterations = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 50;
+	if (NumRings <= 0 || Resolution <= 0 || Iterations <= 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Usage: Catnip.Bench.RingKernel [Rings] [Resolution] [Iterations]"));
+		return;
+	}
+
+	FRandomStream Stream(NumRings);
+	TArray<FRingSegmentParams> Rings;
+	Rings.SetNum(NumRings);
+	for (FRingSegmentParams &Ring : Rings)
+	{
+		Ring.BaseRotation = FRotator(Stream.FRandRange(-30.0f, 30.0f), Stream.FRandRange(-180.0f, 180.0f), 0.0f).Quaternion();
+		Ring.BaseLocation = Stream.GetUnitVector() * Stream.FRandRange(0.0f, 100000.0f);
+		Ring.Radius = Stream.FRandRange(300.0f, 800.0f);
+		Ring.AngleOffset = Stream.FRandRange(-PI, PI);
+		Ring.Resolution = Resolution;
+	}
+
+	TArray<FTransform> Scalar, Vector;
+	Scalar.Reserve(NumRings * Resolution);
+	Vector.Reserve(NumRings * Resolution);
+
+	auto Time = [&](auto Build, TArray<FTransform> &Output)
+	{
+		double Best = MAX_dbl;
+		for (int32 i = 0; i < Iterations; ++i)
+		{
+			Output.Reset();
+			double Start = FPlatformTime::Seconds();
+			Build(Rings, Output, nullptr);
+			Best = FMath::Min(Best, FPlatformTime::Seconds() - Start);
+		}
+		return Best * 1.0e9 / (NumRings * Resolution);
+	};
+	double ScalarNs = Time(&FRingSegmentKernel::BuildSegmentTransformsScalar, Scalar);
+	double VectorNs = Time(&FRingSegmentKernel::BuildSegmentTransforms, Vector);
+
+	float MaxError = 0.0f;
+	for (int32 i = 0; i < Scalar.Num(); ++i)
+	{
+		MaxError = FMath::Max(MaxError, FVector::Dist(Scalar[i].GetLocation(), Vector[i].GetLocation()));
+	}
+	UE_LOG(LogTemp, Log, TEXT("Ring kernel, %d rings x %d segments: scalar %.2f ns/segment, vector %.2f ns/segment (x%.2f), max error %f."),
+		NumRings, Resolution, ScalarNs, VectorNs, ScalarNs / FMath::Max(VectorNs, 1.0e-3), MaxError);
+}
+
+static FAutoConsoleCommand BenchmarkRingKernelCommand(TEXT("Catnip.Bench.RingKernel"),
+	TEXT("Times the vector ring segment kernel against the scalar path. Arguments: [Rings] [Resolution] [Iterations]"),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkRingKernel));
+#endif
@@ -0,0 +1,34 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Placement of one ring's segments. Segment i sits at angle AngleOffset + i * 2PI / Resolution on the ring plane (YZ). */
+struct FRingSegmentParams
+{
+	// Applied to the segment positions.
+	FQuat BaseRotation = FQuat::Identity;
+	FVector BaseLocation = FVector::ZeroVector;
+
+	// Given to every segment as is.
+	FQuat SegmentRotation = FQuat::Identity;
+
+	float Radius = 0.0f;
+	float AngleOffset = 0.0f;
+	int32 Resolution = 0;
+};
+
+/**
+ * Builds segment transforms for many rings at once into one contiguous buffer, four segments at a time.
+ */
+struct CATNIP_API FRingSegmentKernel
+{
+	// Appends the transforms of every ring to OutTransforms, ring after ring. OutFirstIndices (optional) receives where each ring starts.
+	static void BuildSegmentTransforms(TArrayView<const FRingSegmentParams> Rings, TArray<FTransform> &OutTransforms,
+		TArray<int32> *OutFirstIndices = nullptr);
+
+	// Reference implementation matching the original per-segment path. Used to check and benchmark the vector path.
+	static void BuildSegmentTransformsScalar(TArrayView<const FRingSegmentParams> Rings, TArray<FTransform> &OutTransforms,
+		TArray<int32> *OutFirstIndices = nullptr);
+};
@@ -0,0 +1,83 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingQualityGovernor.h"
+
+#include "RenderCore.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<float> CVarQualityTargetFPS(TEXT("Catnip.QualityTargetFPS"), 60.0f,
+	TEXT("Frame rate the ring quality governor holds by lowering ring quality. 0 keeps full quality."));
+
+static TAutoConsoleVariable<int32> CVarQualityLevel(TEXT("Catnip.QualityLevel"), -1,
+	TEXT("Forces a ring quality level, 0 being full quality. -1 lets the governor pick."));
+
+namespace
+{
+	// Weight of the newest frame in the smoothed frame times.
+	constexpr float Smoothing = 0.1f;
+
+	// Fractions of the frame budget. Between the two the level holds.
+	constexpr float DowngradeRatio = 1.05f;
+	constexpr float UpgradeRatio = 0.75f;
+
+	// Seconds spent past either ratio before acting, and after a change before acting again.
+	constexpr float DowngradeDelay = 0.5f;
+	constexpr float UpgradeDelay = 4.0f;
+	constexpr float ChangeCooldown = 2.0f;
+}
+
+FRingQualityGovernor::FRingQualityGovernor()
+	: Level(0), NumLevels(1), GameThreadTime(0.0f), RenderThreadTime(0.0f), OverBudgetTime(0.0f), UnderBudgetTime(0.0f), Cooldown(0.0f)
+{
+}
+
+void FRingQualityGovernor::Reset(int32 InNumLevels)
+{
+	*this = FRingQualityGovernor();
+	this->NumLevels = FMath::Max(InNumLevels, 1);
+}
+
+bool FRingQualityGovernor::Update(float DeltaTime)
+{
+	const int32 PreviousLevel = this->Level;
+	const float GameThread = float(FPlatformTime::ToMilliseconds(GGameThreadTime));
+	const float RenderThread = float(FPlatformTime::ToMilliseconds(GRenderThreadTime));
+	this->GameThreadTime = FMath::Lerp(this->GameThreadTime, GameThread, Smoothing);
+	this->RenderThreadTime = FMath::Lerp(this->RenderThreadTime, RenderThread, Smoothing);
+
+	const int32 ForcedLevel = CVarQualityLevel.GetValueOnGameThread();
+	const float TargetFPS = CVarQualityTargetFPS.GetValueOnGameThread();
+	if (ForcedLevel >= 0 || TargetFPS <= 0.0f)
+	{
+		this->Level = ForcedLevel >= 0 ? FMath::Min(ForcedLevel, this->NumLevels - 1) : 0;
+		this->OverBudgetTime = this->UnderBudgetTime = 0.0f;
+	}
+	else
+	{
+		const float Budget = 1000.0f / TargetFPS;
+		const float FrameTime = FMath::Max(this->GameThreadTime, this->RenderThreadTime);
+		this->OverBudgetTime = FrameTime > Budget * DowngradeRatio ? this->OverBudgetTime + DeltaTime : 0.0f;
+		this->UnderBudgetTime = FrameTime < Budget * UpgradeRatio ? this->UnderBudgetTime + DeltaTime : 0.0f;
+		this->Cooldown = FMath::Max(this->Cooldown - DeltaTime, 0.0f);
+
+		if (this->Cooldown <= 0.0f && this->OverBudgetTime >= DowngradeDelay && this->Level < this->NumLevels - 1)
+		{
+			++this->Level;
+		}
+		else if (this->Cooldown <= 0.0f && this->UnderBudgetTime >= UpgradeDelay && this->Level > 0)
+		{
+			--this->Level;
+		}
+	}
+
+	if (this->Level == PreviousLevel)
+	{
+		return false;
+	}
+	this->OverBudgetTime = this->UnderBudgetTime = 0.0f;
+	this->Cooldown = ChangeCooldown;
+	UE_LOG(LogTemp, Log, TEXT("Ring quality %d -> %d: game thread %.2f ms, render thread %.2f ms, target %.1f fps."),
+		PreviousLevel, this->Level, this->GameThreadTime, this->RenderThreadTime, TargetFPS);
+	return true;
+}
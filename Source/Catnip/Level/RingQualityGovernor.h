@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Picks a ring quality level from game and render thread frame times. Level 0 is full quality.
+ *
+ * The slower of the two threads is smoothed and compared against Catnip.QualityTargetFPS. Quality drops after the
+ * frame has been over budget for a while and only comes back once it has been well under budget for longer, with a
+ * cooldown after every change so one level's cost is measured before moving again.
+ */
+class CATNIP_API FRingQualityGovernor
+{
+public:
+	FRingQualityGovernor();
+
+	void Reset(int32 InNumLevels);
+
+	// Returns true when the level changed.
+	bool Update(float DeltaTime);
+
+	FORCEINLINE int32 GetLevel() const
+	{
+		return this->Level;
+	}
+
+	FORCEINLINE float GetGameThreadTime() const
+	{
+		return this->GameThreadTime;
+	}
+
+	FORCEINLINE float GetRenderThreadTime() const
+	{
+		return this->RenderThreadTime;
+	}
+
+private:
+	int32 Level;
+	int32 NumLevels;
+
+	// Smoothed, in milliseconds.
+	float GameThreadTime;
+	float RenderThreadTime;
+
+	float OverBudgetTime;
+	float UnderBudgetTime;
+	float Cooldown;
+};
@@ -0,0 +1,397 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingSim.h"
+
+FRingSimTrack::FRingSimTrack()
+	: Length(0.0f), Spacing(1.0f)
+{
+}
+
+void FRingSimTrack::Reset(float InLength, int32 NumSamples)
+{
+	this->Length = InLength;
+	this->Spacing = NumSamples > 1 ? FMath::Max(InLength / (NumSamples - 1), KINDA_SMALL_NUMBER) : 1.0f;
+	this->Locations.Reset(NumSamples);
+	this->Rotations.Reset(NumSamples);
+}
+
+void FRingSimTrack::Empty()
+{
+	this->Length = 0.0f;
+	this->Spacing = 1.0f;
+	this->Locations.Empty();
+	this->Rotations.Empty();
+}
+
+void FRingSimTrack::AddSample(const FVector &Location, const FQuat &Rotation)
+{
+	this->Locations.Add(Location);
+	this->Rotations.Add(Rotation);
+}
+
+void FRingSimTrack::ApplyOffset(const FVector &Offset)
+{
+	for (FVector &Location : this->Locations)
+	{
+		Location += Offset;
+	}
+}
+
+FVector FRingSimTrack::GetLocationAtDistance(float Distance) const
+{
+	check(this->IsBaked());
+	const float Key = Distance / this->Spacing;
+	const int32 Index = FMath::Clamp(FMath::FloorToInt(Key), 0, this->Locations.Num() - 2);
+
+	// Alpha is outside [0, 1] past either end, which carries on along the end segment.
+	const FVector &Start = this->Locations[Index];
+	return Start + (this->Locations[Index + 1] - Start) * (Key - Index);
+}
+
+FQuat FRingSimTrack::GetRotationAtDistance(float Distance) const
+{
+	check(this->IsBaked());
+	const float Key = Distance / this->Spacing;
+	const int32 Index = FMath::Clamp(FMath::FloorToInt(Key), 0, this->Rotations.Num() - 2);
+	return FQuat::Slerp(this->Rotations[Index], this->Rotations[Index + 1], FMath::Clamp(Key - Index, 0.0f, 1.0f));
+}
+
+float FRingSimTrack::ProjectOnSegment(int32 Index, const FVector &Location, float &OutDistanceSquared) const
+{
+	const FVector &Start = this->Locations[Index];
+	const FVector Segment = this->Locations[Index + 1] - Start;
+	const float SegmentSquared = Segment.SizeSquared();
+	float Alpha = SegmentSquared > 0.0f ? FVector::DotProduct(Location - Start, Segment) / SegmentSquared : 0.0f;
+	Alpha = FMath::Clamp(Alpha, Index == 0 ? -MAX_flt : 0.0f, Index == this->Locations.Num() - 2 ? MAX_flt : 1.0f);
+	OutDistanceSquared = FVector::DistSquared(Location, Start + Segment * Alpha);
+	return Index + Alpha;
+}
+
+float FRingSimTrack::FindDistanceClosestTo(const FVector &Location, float HintDistance) const
+{
+	check(this->IsBaked());
+	const int32 NumSegments = this->Locations.Num() - 1;
+	int32 Index = FMath::Clamp(FMath::FloorToInt(HintDistance / this->Spacing), 0, NumSegments - 1);
+	float DistanceSquared;
+	float Key = this->ProjectOnSegment(Index, Location, DistanceSquared);
+
+	// Forward first, as the pawn mostly moves on.
+	for (int32 Step : { 1, -1 })
+	{
+		const int32 Start = Index;
+		while (Index + Step >= 0 && Index + Step < NumSegments)
+		{
+			float NextSquared;
+			const float NextKey = this->ProjectOnSegment(Index + Step, Location, NextSquared);
+			if (NextSquared >= DistanceSquared)
+			{
+				break;
+			}
+			Index += Step;
+			Key = NextKey;
+			DistanceSquared = NextSquared;
+		}
+		if (Index != Start)
+		{
+			break;
+		}
+	}
+
+	// Ended on a part of the track the location isn't near, like a bend back past it.
+	if (DistanceSquared > FMath::Square(this->Spacing))
+	{
+		for (int32 i = 0; i < NumSegments; ++i)
+		{
+			float SegmentSquared;
+			const float SegmentKey = this->ProjectOnSegment(i, Location, SegmentSquared);
+			if (SegmentSquared < DistanceSquared)
+			{
+				Key = SegmentKey;
+				DistanceSquared = SegmentSquared;
+			}
+		}
+	}
+	return Key * this->Spacing;
+}
+
+FRingRadiusProfile::FRingRadiusProfile()
+	: Base(0), DefaultRadius(0.0f)
+{
+}
+
+void FRingRadiusProfile::Reset(float InDefaultRadius, int32 InBase)
+{
+	this->Radii.Reset();
+	this->Base = InBase;
+	this->DefaultRadius = InDefaultRadius;
+}
+
+void FRingRadiusProfile::Empty(float InDefaultRadius)
+{
+	this->Radii.Empty();
+	this->Base = 0;
+	this->DefaultRadius = InDefaultRadius;
+}
+
+void FRingRadiusProfile::Trim(int32 FromRing)
+{
+	const int32 Count = FMath::Min(FromRing - this->Base, this->Radii.Num() - 1);
+	if (Count > 0)
+	{
+		this->Radii.RemoveAt(0, Count, false);
+		this->Base += Count;
+	}
+}
+
+float FRingRadiusProfile::GetRadius(int32 RingIndex) const
+{
+	if (this->Radii.Num() == 0)
+	{
+		return this->DefaultRadius;
+	}
+	return this->Radii[FMath::Clamp(RingIndex - this->Base, 0, this->Radii.Num() - 1)];
+}
+
+float FRingRadiusProfile::GetRadiusAtExactRing(double RingExact) const
+{
+	const int32 RingMin = FMath::FloorToInt(RingExact);
+	return FMath::Lerp(this->GetRadius(RingMin), this->GetRadius(RingMin + 1), float(RingExact - RingMin));
+}
+
+FVector FRingRadiusProfile::RestrictOffset(double RingExact, const FVector &Offset, float RadiusShrink) const
+{
+	const float Radius = this->GetRadiusAtExactRing(RingExact) - RadiusShrink;
+	if (Offset.SizeSquared() <= FMath::Square(Radius))
+	{
+		return Offset;
+	}
+	return Offset.GetSafeNormal() * Radius;
+}
+
+FRingBeatJudge::FRingBeatJudge()
+	: RingDistance(500.0f), Allowance(650.0f), FailImmunityDuration(1.0f)
+{
+}
+
+void FRingBeatJudge::Init(float InRingDistance, float InAllowance, float InFailImmunityDuration)
+{
+	this->RingDistance = InRingDistance;
+	this->Allowance = InAllowance;
+	this->FailImmunityDuration = InFailImmunityDuration;
+	this->Reset();
+}
+
+void FRingBeatJudge::Reset()
+{
+	// Immune for the first moments of a run, like after a fail.
+	this->State = FRingBeatJudgeState();
+}
+
+void FRingBeatJudge::Tick(float DeltaTime)
+{
+	if (this->State.FailImmunityCounter < this->FailImmunityDuration)
+	{
+		this->State.FailImmunityCounter += DeltaTime;
+	}
+}
+
+void FRingBeatJudge::BeginBeats(int32 NumBeats)
+{
+	if (this->State.NextBeatIndex == -1 && NumBeats > 0)
+	{
+		this->State.NextBeatIndex = 0;
+	}
+}
+
+FRingBeatAction FRingBeatJudge::RegisterAction(TArrayView<const int32> BeatRings, double Distance)
+{
+	FRingBeatAction Action;
+	const int32 Next = this->State.NextBeatIndex;
+	if (Next == -1 || Next >= BeatRings.Num())
+	{
+		return Action;
+	}
+	auto GetError = [&](int32 Index)
+	{
+		return float(Distance - this->GetBeatDistance(BeatRings[Index]));
+	};
+
+	if (FMath::Abs(GetError(Next)) <= this->Allowance)
+	{
+		Action.Judgement = EBeatJudgement::Success;
+		Action.BeatIndex = Next;
+		Action.Error = GetError(Next);
+		this->State.LastSuccessIndex = Next;
+		++this->State.NextBeatIndex;
+		return Action;
+	}
+
+	// Otherwise judged against the closest beat.
+	int32 Closest = 0;
+	for (int32 i = 1; i < BeatRings.Num(); ++i)
+	{
+		if (FMath::Abs(GetError(i)) < FMath::Abs(GetError(Closest)))
+		{
+			Closest = i;
+		}
+	}
+	Action.BeatIndex = Closest;
+	Action.Error = GetError(Closest);
+
+	if (FMath::Abs(Action.Error) > this->Allowance * 3.0f)
+	{
+		// Too far from any beat.
+		Action.Judgement = EBeatJudgement::Fail;
+	}
+	else if (Closest == Next)
+	{
+		// Just before the next beat, which it fails.
+		Action.Judgement = EBeatJudgement::Fail;
+		Action.FailRing = BeatRings[Next];
+	}
+	else if (Closest == this->State.LastSuccessIndex)
+	{
+		// Again just after a success.
+		Action.Judgement = EBeatJudgement::Fail;
+	}
+	// Just after a failed beat is let go.
+	return Action;
+}
+
+bool FRingBeatJudge::IsBeatMissed(TArrayView<const int32> BeatRings, int32 BeatIndex, double Distance) const
+{
+	return BeatIndex != -1 && BeatIndex < BeatRings.Num() && Distance - this->GetBeatDistance(BeatRings[BeatIndex]) > this->Allowance;
+}
+
+void FRingBeatJudge::SkipBeat()
+{
+	++this->State.NextBeatIndex;
+}
+
+bool FRingBeatJudge::Fail(int32 Ring)
+{
+	if (this->State.FailImmunityCounter < this->FailImmunityDuration)
+	{
+		return false;
+	}
+	if (Ring != -1)
+	{
+		if (this->State.LastFailRing == Ring)
+		{
+			return false;
+		}
+		this->State.LastFailRing = Ring;
+	}
+	this->State.FailImmunityCounter = 0.0f;
+	return true;
+}
+
+void FRingBeatJudge::TrimBeats(int32 Count)
+{
+	this->State.NextBeatIndex -= Count;
+	this->State.LastSuccessIndex = this->State.LastSuccessIndex >= Count ? this->State.LastSuccessIndex - Count : -1;
+}
+
+void RunRingBot(const FRingSimChart &Chart, const FRingBotProfile &Profile, int32 Seed, FRingBotResult &OutResult)
+{
+	OutResult.bCleared = false;
+	OutResult.Successes = 0;
+	OutResult.Fails = 0;
+	OutResult.Ignored = 0;
+	OutResult.LivesLeft = Profile.Lives;
+	OutResult.Distance = 0.0f;
+	OutResult.FailedBeats.Reset();
+
+	const FRingSimTrack &Track = Chart.Track;
+	const TArray<int32> &BeatRings = Chart.BeatRings;
+	if (!ensure(Track.IsBaked() && Profile.Speed > 0.0f && Profile.StepTime > 0.0f))
+	{
+		return;
+	}
+
+	FRingBeatJudge Judge;
+	Judge.Init(Chart.RingDistance, Chart.BeatAllowance, Chart.FailImmunityDuration);
+	Judge.BeginBeats(BeatRings.Num());
+
+	// Every press of the run is drawn up front, from the time each beat is reached at full speed.
+	FRandomStream Stream(Seed);
+	auto DrawNormal = [&Stream]()
+	{
+		const float U = FMath::Max(Stream.FRand(), KINDA_SMALL_NUMBER);
+		return FMath::Sqrt(-2.0f * FMath::Loge(U)) * FMath::Cos(2.0f * PI * Stream.FRand());
+	};
+	TArray<float> Presses;
+	Presses.Reserve(BeatRings.Num() * 2);
+	for (int32 i = 0; i < BeatRings.Num(); ++i)
+	{
+		const float BeatTime = float(Judge.GetBeatDistance(BeatRings[i]) / Profile.Speed);
+		if (Stream.FRand() >= Profile.MissChance)
+		{
+			Presses.Add(BeatTime + Profile.TimingBias + DrawNormal() * Profile.TimingDeviation);
+		}
+		if (i + 1 < BeatRings.Num() && Stream.FRand() < Profile.ExtraPressChance)
+		{
+			const float NextBeatTime = float(Judge.GetBeatDistance(BeatRings[i + 1]) / Profile.Speed);
+			Presses.Add(FMath::Lerp(BeatTime, NextBeatTime, Stream.FRand()));
+		}
+	}
+	Presses.Sort();
+
+	auto Fail = [&](int32 Ring, int32 BeatIndex)
+	{
+		if (Judge.Fail(Ring))
+		{
+			++OutResult.Fails;
+			OutResult.FailedBeats.Add(BeatIndex);
+			--OutResult.LivesLeft;
+		}
+	};
+
+	double Time = 0.0;
+	double RailDistance = 0.0;
+	float Distance = 0.0f;
+	int32 NextPress = 0;
+	while (OutResult.LivesLeft > 0)
+	{
+		// Input comes before the game mode moves the pawn, so it's judged where the last update found the pawn.
+		Time += Profile.StepTime;
+		for (; NextPress < Presses.Num() && Presses[NextPress] <= Time; ++NextPress)
+		{
+			if (Distance < 0.0f)
+			{
+				continue;
+			}
+			const FRingBeatAction Action = Judge.RegisterAction(BeatRings, Distance);
+			if (Action.Judgement == EBeatJudgement::Success)
+			{
+				++OutResult.Successes;
+			}
+			else if (Action.Judgement == EBeatJudgement::Fail)
+			{
+				Fail(Action.FailRing, Action.BeatIndex);
+			}
+			else if (Action.BeatIndex != INDEX_NONE)
+			{
+				++OutResult.Ignored;
+			}
+		}
+
+		RailDistance += Profile.Speed * Profile.StepTime;
+		Distance = Track.FindDistanceClosestTo(Track.GetLocationAtDistance(float(RailDistance)), Distance);
+		if (Distance >= Track.GetLength())
+		{
+			OutResult.bCleared = true;
+			break;
+		}
+
+		const int32 NextBeat = Judge.GetNextBeatIndex();
+		if (Judge.IsBeatMissed(BeatRings, NextBeat, Distance))
+		{
+			Fail(BeatRings[NextBeat], NextBeat);
+			Judge.SkipBeat();
+		}
+		Judge.Tick(Profile.StepTime);
+	}
+	OutResult.Distance = Distance;
+}
@@ -0,0 +1,395 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** How the ring handler judged an action. */
+enum class EBeatJudgement : uint8
+{
+	// Nothing to judge against, or an action just after a failed beat.
+	Ignored, Success, Fail, Num
+};
+
+/**
+ * Track sampled at even distances, so locations and closest points cost a lerp instead of a spline evaluation.
+ * Distances before the start or past the end continue straight on from the end samples.
+ */
+class CATNIP_API FRingSimTrack
+{
+public:
+	FRingSimTrack();
+
+	// Samples are added from distance 0 to Length, NumSamples of them.
+	void Reset(float InLength, int32 NumSamples);
+
+	// Frees the samples.
+	void Empty();
+
+	void AddSample(const FVector &Location, const FQuat &Rotation);
+
+	void ApplyOffset(const FVector &Offset);
+
+	FVector GetLocationAtDistance(float Distance) const;
+
+	FQuat GetRotationAtDistance(float Distance) const;
+
+	// Walks from the hint towards the location, so a pawn moving along the track costs a few samples. Falls back to
+	// every sample when the walk ends away from the track, like after a teleport.
+	float FindDistanceClosestTo(const FVector &Location, float HintDistance) const;
+
+	FORCEINLINE bool IsBaked() const
+	{
+		return this->Locations.Num() >= 2 && this->Locations.Num() == this->Rotations.Num();
+	}
+
+	FORCEINLINE float GetLength() const
+	{
+		return this->Length;
+	}
+
+	FORCEINLINE float GetSpacing() const
+	{
+		return this->Spacing;
+	}
+
+private:
+	// Closest point of segment Index, in segments from the start. The end segments aren't clamped past the track.
+	float ProjectOnSegment(int32 Index, const FVector &Location, float &OutDistanceSquared) const;
+
+private:
+	float Length;
+	float Spacing;
+	TArray<FVector> Locations;
+	TArray<FQuat> Rotations;
+};
+
+/** Radius of every ring from a base ring on. The pawn is kept inside it. */
+class CATNIP_API FRingRadiusProfile
+{
+public:
+	FRingRadiusProfile();
+
+	// Rings outside an empty profile have the default radius. The first ring added is InBase.
+	void Reset(float InDefaultRadius, int32 InBase = 0);
+
+	// Like Reset, but frees the radii.
+	void Empty(float InDefaultRadius);
+
+	FORCEINLINE void Add(float Radius)
+	{
+		this->Radii.Add(Radius);
+	}
+
+	// Drops rings before FromRing, always keeping the last one.
+	void Trim(int32 FromRing);
+
+	float GetRadius(int32 RingIndex) const;
+
+	// Lerps between the rings either side.
+	float GetRadiusAtExactRing(double RingExact) const;
+
+	FVector RestrictOffset(double RingExact, const FVector &Offset, float RadiusShrink) const;
+
+	FORCEINLINE bool IsEmpty() const
+	{
+		return this->Radii.Num() == 0;
+	}
+
+	FORCEINLINE int32 GetBase() const
+	{
+		return this->Base;
+	}
+
+	// First ring not evaluated yet.
+	FORCEINLINE int32 GetEnd() const
+	{
+		return this->Base + this->Radii.Num();
+	}
+
+private:
+	TArray<float> Radii;
+	int32 Base;
+	float DefaultRadius;
+};
+
+/** Beat judgement state, as much as a practice rewind puts back. Beats are indices into the beat ring list. */
+struct FRingBeatJudgeState
+{
+	int32 NextBeatIndex = -1;
+	int32 LastFailRing = -1;
+	int32 LastSuccessIndex = -1;
+	float FailImmunityCounter = 0.0f;
+};
+
+/** What an action was judged as. */
+struct FRingBeatAction
+{
+	EBeatJudgement Judgement = EBeatJudgement::Ignored;
+
+	// Beat judged against, INDEX_NONE when there was nothing to judge.
+	int32 BeatIndex = INDEX_NONE;
+
+	// Distance past the beat ring, negative when early.
+	float Error = 0.0f;
+
+	// Ring a fail is for, -1 when it isn't for any.
+	int32 FailRing = -1;
+};
+
+/**
+ * Judges actions against the beat rings and decides which fails count. Knows nothing of actors or events, so a
+ * simulated run judges exactly like a played one. Distances are along the whole track, not the current spline.
+ */
+class CATNIP_API FRingBeatJudge
+{
+public:
+	FRingBeatJudge();
+
+	// Settings are kept until the next call. Starts over from the first beat.
+	void Init(float InRingDistance, float InAllowance, float InFailImmunityDuration);
+
+	void Reset();
+
+	void Tick(float DeltaTime);
+
+	// Judging starts once there are beats.
+	void BeginBeats(int32 NumBeats);
+
+	FRingBeatAction RegisterAction(TArrayView<const int32> BeatRings, double Distance);
+
+	// The pawn is too far past the beat to still take it.
+	bool IsBeatMissed(TArrayView<const int32> BeatRings, int32 BeatIndex, double Distance) const;
+
+	void SkipBeat();
+
+	// Returns whether the fail counts. It doesn't while immune after the last one, or twice for the same ring.
+	bool Fail(int32 Ring);
+
+	// Beats before Count were dropped from the front of the list.
+	void TrimBeats(int32 Count);
+
+	FORCEINLINE double GetBeatDistance(int32 Ring) const
+	{
+		return double(Ring) * this->RingDistance;
+	}
+
+	FORCEINLINE int32 GetNextBeatIndex() const
+	{
+		return this->State.NextBeatIndex;
+	}
+
+	FORCEINLINE const FRingBeatJudgeState &GetState() const
+	{
+		return this->State;
+	}
+
+	FORCEINLINE void SetState(const FRingBeatJudgeState &InState)
+	{
+		this->State = InState;
+	}
+
+private:
+	FRingBeatJudgeState State;
+	float RingDistance;
+	float Allowance;
+	float FailImmunityDuration;
+};
+
+/**
+ * Runs the spawn rules active on ring Index, NumNewRules of them starting on it. Only the bookkeeping is done
+ * here: every rule counts the ring it's on and runs through Execute, which returns true once the rule is done.
+ * Rules are any struct with RingIndex, RingCounter and RuleIndex.
+ */
+template<typename RuleType, typename ExecuteType>
+void RunRingSpawnRules(TArray<RuleType> &Rules, int32 Index, int32 NumNewRules, ExecuteType &&Execute)
+{
+	for (int32 i = 0; i < NumNewRules; ++i)
+	{
+		RuleType &NewRule = Rules.AddDefaulted_GetRef();
+		NewRule.RingIndex = Index;
+		NewRule.RuleIndex = i;
+	}
+
+	for (RuleType &Rule : Rules)
+	{
+		if (Rule.RingIndex <= Index)
+		{
+			++Rule.RingCounter;
+		}
+	}
+
+	for (int32 i = 0; i < Rules.Num(); ++i)
+	{
+		if (Rules[i].RingIndex <= Index && Execute(Rules[i]))
+		{
+			// Without shrinking, so the array keeps its memory when the last rule ends.
+			Rules.RemoveAtSwap(i--, 1, false);
+		}
+	}
+}
+
+/**
+ * Effects of the spawn rules, for RunRingSpawnRules' Execute. Each sets its part of the spawn state and returns true
+ * once the rule is done. States are any struct with the fields a rule sets, and rules any with RingCounter and a
+ * GetCache for what they keep between rings.
+ */
+template<typename StateType, typename RuleType>
+bool ApplyRingRadiusRule(StateType &State, RuleType &Rule, float NewRadius, int32 TransitionRings)
+{
+	float &Memory = *Rule.template GetCache<float>();
+	if (Rule.RingCounter <= 1)
+	{
+		Memory = State.Radius;
+	}
+	const float Percentage = TransitionRings <= 0 ? 1.0f : FMath::Clamp(Rule.RingCounter / float(TransitionRings + 1), 0.0f, 1.0f);
+	State.Radius = Memory + (NewRadius - Memory) * FMath::Sin(Percentage * PI / 2.0f);
+	return Rule.RingCounter > TransitionRings;
+}
+
+// A single ring rule puts the previous mesh back on the ring after.
+template<typename StateType, typename RuleType, typename MeshType, typename MaterialType, typename MeshKindType>
+bool ApplyRingMeshRule(StateType &State, RuleType &Rule, MeshType NewMesh, MaterialType NewMaterial, MeshKindType Kind, bool bSingleRing)
+{
+	MeshType &MeshMemory = *Rule.template GetCache<MeshType>();
+	MeshKindType &KindMemory = *Rule.template GetCache<MeshKindType, sizeof(MeshType)>();
+	MaterialType &MaterialMemory = *Rule.template GetCache<MaterialType, sizeof(MeshType) + sizeof(MeshKindType)>();
+	if (Rule.RingCounter <= 1)
+	{
+		MeshMemory = State.Mesh;
+		KindMemory = State.MeshType;
+		MaterialMemory = State.MaterialInterface;
+	}
+
+	State.Mesh = NewMesh;
+	State.MeshType = Kind;
+	State.MaterialInterface = NewMaterial;
+
+	if (!bSingleRing)
+	{
+		return true;
+	}
+	if (Rule.RingCounter >= 2)
+	{
+		State.Mesh = MeshMemory;
+		State.MeshType = KindMemory;
+		State.MaterialInterface = MaterialMemory;
+		return true;
+	}
+	return false;
+}
+
+// Offset types are any enum with an Incremental value, which counts up from 0 again.
+template<typename StateType, typename OffsetKindType>
+bool ApplyRingOffsetRule(StateType &State, float Value, OffsetKindType Kind)
+{
+	State.RotationOffset = Value;
+	State.OffsetType = Kind;
+	if (Kind == OffsetKindType::Incremental)
+	{
+		State.OffsetCounter = 0.0f;
+	}
+	return true;
+}
+
+template<typename StateType>
+bool ApplyRingRotationRule(StateType &State, float MinSpeed, float MaxSpeed, float ForceRerollMin)
+{
+	State.RotationSpeedMin = MinSpeed;
+	State.RotationSpeedMax = MaxSpeed;
+	State.RotationForceRerollMin = ForceRerollMin;
+	return true;
+}
+
+template<typename StateType, typename RuleType>
+bool ApplyRingColorRule(StateType &State, RuleType &Rule, FColor Color, bool bSingleRing)
+{
+	FColor &ColorMemory = *Rule.template GetCache<FColor>();
+	if (Rule.RingCounter <= 1)
+	{
+		ColorMemory = State.Color;
+	}
+	State.Color = Color;
+
+	if (!bSingleRing)
+	{
+		return true;
+	}
+	if (Rule.RingCounter >= 2)
+	{
+		State.Color = ColorMemory;
+		return true;
+	}
+	return false;
+}
+
+template<typename StateType>
+bool ApplyRingResolutionRule(StateType &State, int32 Resolution)
+{
+	State.Resolution = Resolution;
+	return true;
+}
+
+// Spawns an obstacle on the rule's ring only.
+template<typename StateType, typename RuleType, typename MeshType, typename MaterialType>
+bool ApplyRingObstacleRule(StateType &State, RuleType &Rule, MeshType ObstacleMesh, MaterialType ObstacleMaterial)
+{
+	if (Rule.RingCounter >= 2)
+	{
+		State.bSpawnObstacle = false;
+		return true;
+	}
+	State.ObstacleMesh = ObstacleMesh;
+	State.ObstacleMaterialInterface = ObstacleMaterial;
+	State.bSpawnObstacle = true;
+	return false;
+}
+
+/**
+ * A fixed track and its beat chart, baked from a ring handler for simulated runs. Ring radii and obstacles aren't
+ * part of it, as the bot rides the rail without steering.
+ */
+struct FRingSimChart
+{
+	FRingSimTrack Track;
+	TArray<int32> BeatRings;
+
+	float RingDistance = 500.0f;
+	float BeatAllowance = 650.0f;
+	float FailImmunityDuration = 1.0f;
+};
+
+/** How a simulated player plays. Timings are in seconds. */
+struct FRingBotProfile
+{
+	float Speed = 1600.0f;
+	float StepTime = 1.0f / 60.0f;
+	int32 Lives = 9;
+
+	// Presses land around the beat with this mean and standard deviation.
+	float TimingBias = 0.0f;
+	float TimingDeviation = 0.05f;
+
+	// Chance a beat gets no press, and of a stray press between two beats.
+	float MissChance = 0.0f;
+	float ExtraPressChance = 0.0f;
+};
+
+struct FRingBotResult
+{
+	bool bCleared = false;
+	int32 Successes = 0;
+	int32 Fails = 0;
+	int32 Ignored = 0;
+	int32 LivesLeft = 0;
+	float Distance = 0.0f;
+
+	// Beat each counted fail was closest to.
+	TArray<int32> FailedBeats;
+};
+
+/**
+ * Plays the chart like the game does, a fixed step at a time: presses are judged against the distance the last step
+ * found, then the pawn moves, is located on the track and misses the beat it is too far past. Safe on any thread.
+ */
+CATNIP_API void RunRingBot(const FRingSimChart &Chart, const FRingBotProfile &Profile, int32 Seed, FRingBotResult &OutResult);
@@ -0,0 +1,210 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingTrace.h"
+
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/CoreDelegates.h"
+#include "HAL/IConsoleManager.h"
+
+static void RingTraceCommand(const TArray<FString> &Args)
+{
+	FRingTrace &Trace = FRingTrace::Get();
+	if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+	{
+		Trace.Stop();
+	}
+	else
+	{
+		Trace.Start(Args.Num() > 0 && Args[0] != TEXT("start") ? Args[0] : FString());
+	}
+}
+
+static FAutoConsoleCommand RingTraceConsoleCommand(TEXT("Catnip.Trace"),
+	TEXT("Catnip.Trace [start|stop|<file>]: records ring system scopes and gameplay events to a Chrome trace file."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&RingTraceCommand));
+
+bool FRingTrace::bActive = false;
+
+FRingTrace &FRingTrace::Get()
+{
+	static FRingTrace Instance;
+	return Instance;
+}
+
+FRingTrace::FRingTrace()
+	: NumDropped(0), NumWritten(0), StartTime(0.0), LastFrameEnd(0.0), bStartedWithRun(false)
+{
+}
+
+bool FRingTrace::Start(const FString &InFileName)
+{
+	check(IsInGameThread());
+	this->Stop();
+
+	this->FileName = !InFileName.IsEmpty() ? InFileName
+		: FPaths::ProjectLogDir() / FString::Printf(TEXT("CatnipTrace_%s.json"), *FDateTime::Now().ToString());
+	this->File.Reset(IFileManager::Get().CreateFileWriter(*this->FileName));
+	if (!this->File.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not open %s for tracing."), *this->FileName);
+		return false;
+	}
+
+	// Both buffers are allocated once. Adding an event never allocates.
+	this->Pending.Reset(MaxEvents);
+	this->Writing.Reset(MaxEvents);
+	this->NumDropped = 0;
+	this->NumWritten = 0;
+	this->StartTime = FPlatformTime::Seconds();
+	this->LastFrameEnd = this->StartTime;
+
+	static const ANSICHAR Header[] = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Catnip\"}}";
+	this->File->Serialize(const_cast<ANSICHAR*>(Header), sizeof(Header) - 1);
+
+	FCoreDelegates::OnEndFrame.AddRaw(this, &FRingTrace::OnEndFrame);
+	bActive = true;
+	UE_LOG(LogTemp, Log, TEXT("Tracing to %s."), *this->FileName);
+	return true;
+}
+
+void FRingTrace::Stop()
+{
+	check(IsInGameThread());
+	if (!bActive)
+	{
+		return;
+	}
+	{
+		FScopeLock ScopeLock(&this->Lock);
+		bActive = false;
+	}
+	FCoreDelegates::OnEndFrame.RemoveAll(this);
+
+	this->Flush();
+	static const ANSICHAR Footer[] = "\n]}\n";
+	this->File->Serialize(const_cast<ANSICHAR*>(Footer), sizeof(Footer) - 1);
+	this->File->Close();
+	this->File.Reset();
+	this->bStartedWithRun = false;
+
+	UE_LOG(LogTemp, Log, TEXT("Trace written to %s: %lld events, %d dropped."), *this->FileName, this->NumWritten, this->NumDropped);
+	this->Writing.Empty();
+	FScopeLock ScopeLock(&this->Lock);
+	this->Pending.Empty();
+}
+
+void FRingTrace::BeginRun()
+{
+	if (!bActive && FParse::Param(FCommandLine::Get(), TEXT("RingTrace")))
+	{
+		this->bStartedWithRun = this->Start();
+	}
+}
+
+void FRingTrace::EndRun()
+{
+	if (this->bStartedWithRun)
+	{
+		this->Stop();
+	}
+}
+
+void FRingTrace::AddScope(const TCHAR *Name, double InStartTime, double EndTime)
+{
+	FScopeLock ScopeLock(&this->Lock);
+	if (!bActive)
+	{
+		return;
+	}
+	if (this->Pending.Num() == this->Pending.Max())
+	{
+		++this->NumDropped;
+		return;
+	}
+	FRingTraceEvent &Event = this->Pending.AddDefaulted_GetRef();
+	Event.Name = Name;
+	Event.Type = ERingTraceType::Scope;
+	Event.ThreadId = FPlatformTLS::GetCurrentThreadId();
+	Event.Time = InStartTime;
+	Event.Duration = EndTime - InStartTime;
+}
+
+void FRingTrace::Add(ERingTraceType Type, const TCHAR *Name, int64 Id, double Value, uint32 Owner)
+{
+	const double Now = FPlatformTime::Seconds();
+	FScopeLock ScopeLock(&this->Lock);
+	if (!bActive)
+	{
+		return;
+	}
+	if (this->Pending.Num() == this->Pending.Max())
+	{
+		++this->NumDropped;
+		return;
+	}
+	FRingTraceEvent &Event = this->Pending.AddDefaulted_GetRef();
+	Event.Name = Name;
+	Event.Type = Type;
+	Event.ThreadId = FPlatformTLS::GetCurrentThreadId();
+	Event.Time = Now;
+	Event.Id = Id;
+	Event.Value = Value;
+	Event.Owner = Owner;
+}
+
+void FRingTrace::OnEndFrame()
+{
+	const double Now = FPlatformTime::Seconds();
+	this->AddScope(TEXT("Frame"), this->LastFrameEnd, Now);
+	this->LastFrameEnd = Now;
+	this->Flush();
+}
+
+void FRingTrace::Flush()
+{
+	{
+		FScopeLock ScopeLock(&this->Lock);
+		Swap(this->Pending, this->Writing);
+	}
+
+	auto ToMicroseconds = [this](double Time)
+	{
+		return (Time - this->StartTime) * 1000000.0;
+	};
+	for (const FRingTraceEvent &Event : this->Writing)
+	{
+		FString Line;
+		switch (Event.Type)
+		{
+		case ERingTraceType::Scope:
+			Line = FString::Printf(TEXT(",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}"),
+				Event.Name, ToMicroseconds(Event.Time), Event.Duration * 1000000.0, Event.ThreadId);
+			break;
+		case ERingTraceType::Instant:
+			Line = FString::Printf(TEXT(",\n{\"name\":\"%s\",\"cat\":\"game\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"index\":%lld}}"),
+				Event.Name, ToMicroseconds(Event.Time), Event.ThreadId, Event.Id);
+			break;
+		case ERingTraceType::Begin:
+		case ERingTraceType::End:
+			// Async spans pair up by name and id, so every ring and rule gets its own row. The id takes the owner
+			// first, as several ring handlers count their rings from 0 at once.
+			Line = FString::Printf(TEXT(",\n{\"name\":\"%s\",\"cat\":\"game\",\"ph\":\"%s\",\"id\":\"%u:%lld\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"owner\":%u,\"index\":%lld}}"),
+				Event.Name, Event.Type == ERingTraceType::Begin ? TEXT("b") : TEXT("e"), Event.Owner, Event.Id, ToMicroseconds(Event.Time), Event.ThreadId, Event.Owner, Event.Id);
+			break;
+		case ERingTraceType::Counter:
+			Line = FString::Printf(TEXT(",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%.3f}}"),
+				Event.Name, ToMicroseconds(Event.Time), Event.Value);
+			break;
+		}
+		FTCHARToUTF8 Utf8(*Line);
+		this->File->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+	}
+	this->NumWritten += this->Writing.Num();
+
+	// Reset keeps the buffer's memory for the next frame.
+	this->Writing.Reset();
+}
@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#define CATNIP_RING_TRACE !UE_BUILD_SHIPPING
+
+class FArchive;
+
+enum class ERingTraceType : uint8
+{
+	// CPU time on the thread that recorded it.
+	Scope,
+	// A moment in the run, like a beat or an obstacle hit.
+	Instant,
+	// Span of something with an id, like a ring from spawn to despawn.
+	Begin,
+	End,
+	// A value over time, like lives or the rail distance.
+	Counter
+};
+
+/** One trace event. Names must be string literals, as they are only read when the event is written out. */
+struct FRingTraceEvent
+{
+	const TCHAR *Name = nullptr;
+	ERingTraceType Type = ERingTraceType::Instant;
+	uint32 ThreadId = 0;
+	double Time = 0.0;
+	double Duration = 0.0;
+	int64 Id = 0;
+	double Value = 0.0;
+	// What the span's id counts within, like the ring handler, so ids only need to be unique per owner.
+	uint32 Owner = 0;
+};
+
+/**
+ * Records gameplay events and ring system CPU scopes of a run as Chrome trace event JSON, for chrome://tracing or Perfetto.
+ * Events go into a fixed buffer that is written out at the end of every frame, so memory stays the same however long the run.
+ * Events past the buffer's size within one frame are dropped and counted. Start it with Catnip.Trace or by running with -RingTrace.
+ */
+class CATNIP_API FRingTrace
+{
+public:
+	static FRingTrace &Get();
+
+	static FORCEINLINE bool IsActive()
+	{
+		return bActive;
+	}
+
+	// Writes to Saved/Logs/CatnipTrace_<date>.json unless a file is given.
+	bool Start(const FString &FileName = FString());
+
+	void Stop();
+
+	// Starts the trace with the run when the game runs with -RingTrace.
+	void BeginRun();
+
+	void EndRun();
+
+	void AddScope(const TCHAR *Name, double StartTime, double EndTime);
+
+	void Add(ERingTraceType Type, const TCHAR *Name, int64 Id = 0, double Value = 0.0, uint32 Owner = 0);
+
+private:
+	FRingTrace();
+
+	void OnEndFrame();
+
+	// Writes every buffered event. Game thread only.
+	void Flush();
+
+private:
+	static constexpr int32 MaxEvents = 8192;
+
+	static bool bActive;
+
+	FCriticalSection Lock;
+	TArray<FRingTraceEvent> Pending;
+	TArray<FRingTraceEvent> Writing;
+	int32 NumDropped;
+	int64 NumWritten;
+
+	double StartTime;
+	double LastFrameEnd;
+	bool bStartedWithRun;
+
+	FString FileName;
+	TUniquePtr<FArchive> File;
+};
+
+#if CATNIP_RING_TRACE
+#define RING_TRACE(Type, Name, ...) do { if (FRingTrace::IsActive()) { FRingTrace::Get().Add(ERingTraceType::Type, TEXT(Name), ##__VA_ARGS__); } } while (0)
+#define RING_TRACE_SPAN(Type, Name, Owner, Id) RING_TRACE(Type, Name, Id, 0.0, Owner)
+#else
+#define RING_TRACE(Type, Name, ...)
+#define RING_TRACE_SPAN(Type, Name, Owner, Id)
+#endif
@@ -0,0 +1,287 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RingTrackGraph.h"
+
+#include "TrackData.h"
+#include "Engine/World.h"
+#include "ConstructorHelpers.h"
+
+#define CONSTRUCTOR_HANDLER_CLASS TEXT("/Game/Blueprints/Level/BP_RingHandler")
+
+ARingTrackGraph::ARingTrackGraph()
+{
+	// The native handler has no ring mesh or material, the Blueprint sets them.
+	static ConstructorHelpers::FClassFinder<ARingHandler> ConstructorHandlerClass = ConstructorHelpers::FClassFinder<ARingHandler>(CONSTRUCTOR_HANDLER_CLASS);
+	this->HandlerClass = ensure(ConstructorHandlerClass.Succeeded()) ? ConstructorHandlerClass.Class : ARingHandler::StaticClass();
+	this->Active = nullptr;
+	this->Trailing = nullptr;
+	this->ActiveSegment = INDEX_NONE;
+	this->ChosenBranch = INDEX_NONE;
+	this->RewindDistance = 0.0f;
+
+	Super::RootComponent = UObject::CreateDefaultSubobject<USceneComponent>(TEXT("GraphSceneComponent"));
+	Super::PrimaryActorTick.bCanEverTick = false;
+}
+
+ARingHandler *ARingTrackGraph::StartGraph()
+{
+	this->ReleaseAll();
+	if (!this->Segments.IsValidIndex(0))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Track graph %s has no segments."), *Super::GetName());
+		return nullptr;
+	}
+
+	this->Active = this->AcquireHandler(0, Super::GetActorLocation(), Super::GetActorQuat());
+	this->ActiveSegment = this->Active != nullptr ? 0 : INDEX_NONE;
+	return this->Active;
+}
+
+ARingHandler *ARingTrackGraph::ResetGraph()
+{
+	if (this->Active == nullptr || this->ActiveSegment != 0)
+	{
+		return this->StartGraph();
+	}
+
+	// Still on the first segment, which starts over in place like a single track.
+	for (ARingHandler *Handler : this->BranchHandlers)
+	{
+		this->ReleaseHandler(Handler);
+	}
+	this->BranchHandlers.Reset();
+	this->ReleaseHandler(this->Trailing);
+	this->Trailing = nullptr;
+	this->ChosenBranch = INDEX_NONE;
+	this->Active->ResetRun();
+	return this->Active;
+}
+
+float ARingTrackGraph::AdvanceGraph(float SplineDistance)
+{
+	if (this->Active == nullptr)
+	{
+		return 0.0f;
+	}
+
+	// The last segment's rings are behind the camera by now.
+	if (this->Trailing != nullptr && SplineDistance > this->Active->GetRingDistance() * 2.0f)
+	{
+		this->ReleaseHandler(this->Trailing);
+		this->Trailing = nullptr;
+	}
+
+	const TArray<int32> &Branches = this->Segments[this->ActiveSegment].Branches;
+	if (Branches.Num() == 0)
+	{
+		return 0.0f;
+	}
+
+	const float Length = this->Active->GetSplineComponent()->GetSplineLength();
+	if (this->BranchHandlers.Num() == 0 && Length - SplineDistance <= this->Active->GetFadeDistance())
+	{
+		this->AcquireBranches();
+	}
+	if (SplineDistance < Length)
+	{
+		return 0.0f;
+	}
+
+	// Past the junction. The middle branch is taken when none was chosen, or the first that loaded.
+	int32 Branch = this->ChosenBranch != INDEX_NONE ? this->ChosenBranch : (Branches.Num() - 1) / 2;
+	if (this->BranchHandlers[Branch] == nullptr)
+	{
+		Branch = this->BranchHandlers.IndexOfByPredicate([](const ARingHandler *Handler) { return Handler != nullptr; });
+		if (Branch == INDEX_NONE)
+		{
+			// The active handler completes the game instead.
+			return 0.0f;
+		}
+	}
+	const int32 NextSegment = Branches[Branch];
+	for (int32 i = 0; i < this->BranchHandlers.Num(); ++i)
+	{
+		if (i != Branch)
+		{
+			this->ReleaseHandler(this->BranchHandlers[i]);
+		}
+	}
+
+	this->ReleaseHandler(this->Trailing);
+	this->Trailing = this->Active;
+	this->Active = this->BranchHandlers[Branch];
+	this->Active->SetLeader(nullptr);
+	this->Trailing->SetLeader(this->Active);
+	this->ActiveSegment = NextSegment;
+	this->BranchHandlers.Reset();
+	this->ChosenBranch = INDEX_NONE;
+	return Length;
+}
+
+void ARingTrackGraph::UpdateBranches(float SplineDistance)
+{
+	if (this->Active == nullptr || this->BranchHandlers.Num() == 0)
+	{
+		return;
+	}
+
+	// Branches start at the junction, so the pawn is as far before their start as it is from the end of this segment.
+	const float BranchDistance = SplineDistance - this->Active->GetSplineComponent()->GetSplineLength();
+	for (ARingHandler *Handler : this->BranchHandlers)
+	{
+		if (Handler != nullptr)
+		{
+			Handler->UpdateHandlerAtDistance(BranchDistance);
+		}
+	}
+}
+
+bool ARingTrackGraph::ChooseBranch(int32 Branch)
+{
+	if (this->Active == nullptr || this->ChosenBranch != INDEX_NONE || !this->Segments[this->ActiveSegment].Branches.IsValidIndex(Branch))
+	{
+		return false;
+	}
+	if (this->BranchHandlers.Num() > 0 && this->BranchHandlers[Branch] == nullptr)
+	{
+		// Loaded already and failed, so taking it would end the track.
+		return false;
+	}
+	this->ChosenBranch = Branch;
+
+	// Branches not yet in reach are never loaded.
+	for (int32 i = 0; i < this->BranchHandlers.Num(); ++i)
+	{
+		if (i != Branch)
+		{
+			this->ReleaseHandler(this->BranchHandlers[i]);
+			this->BranchHandlers[i] = nullptr;
+		}
+	}
+	return true;
+}
+
+void ARingTrackGraph::SetRewindDistance(float Distance)
+{
+	this->RewindDistance = Distance;
+	for (ARingHandler *Handler : { this->Active, this->Trailing })
+	{
+		if (Handler != nullptr)
+		{
+			Handler->SetRewindDistance(Distance);
+		}
+	}
+	for (ARingHandler *Handler : this->BranchHandlers)
+	{
+		if (Handler != nullptr)
+		{
+			Handler->SetRewindDistance(Distance);
+		}
+	}
+}
+
+int32 ARingTrackGraph::GetNumBranches() const
+{
+	return this->Active != nullptr ? this->Segments[this->ActiveSegment].Branches.Num() : 0;
+}
+
+ARingHandler *ARingTrackGraph::AcquireHandler(int32 Segment, const FVector &Location, const FQuat &Rotation)
+{
+	if (!this->Segments.IsValidIndex(Segment) || this->Segments[Segment].Track == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Track graph segment %d has no track."), Segment);
+		return nullptr;
+	}
+
+	ARingHandler *Handler = this->HandlerPool.Num() > 0 ? this->HandlerPool.Pop(false) : nullptr;
+	if (Handler == nullptr)
+	{
+		// Deferred, so the handler knows it follows the active one when it begins play.
+		const FTransform Transform(Rotation, Location);
+		Handler = Super::GetWorld()->SpawnActorDeferred<ARingHandler>(this->HandlerClass, Transform, this, nullptr,
+			ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		if (!ensure(Handler != nullptr))
+		{
+			return nullptr;
+		}
+		Handler->SetLeader(this->Active);
+		Handler->FinishSpawning(Transform);
+
+		// Bound once, as pooled handlers keep their bindings.
+		Handler->OnBeatRingFail.AddDynamic(this, &ARingTrackGraph::HandleBeatRingFail);
+		Handler->OnBeatRingSuccess.AddDynamic(this, &ARingTrackGraph::HandleBeatRingSuccess);
+	}
+
+	Handler->SetLeader(this->Active);
+	Handler->SetActorTickEnabled(true);
+	if (!Handler->LoadTrack(this->Segments[Segment].Track))
+	{
+		this->ReleaseHandler(Handler);
+		return nullptr;
+	}
+	Handler->PlaceTrackStart(Location, Rotation);
+	Handler->SetTrackContinues(this->Segments[Segment].Branches.Num() > 0);
+	Handler->SetRewindDistance(this->RewindDistance);
+	return Handler;
+}
+
+void ARingTrackGraph::ReleaseHandler(ARingHandler *Handler)
+{
+	if (Handler == nullptr)
+	{
+		return;
+	}
+	Handler->ReleaseTrack();
+	Handler->SetActorTickEnabled(false);
+	this->HandlerPool.Add(Handler);
+}
+
+void ARingTrackGraph::AcquireBranches()
+{
+	const TArray<int32> &Branches = this->Segments[this->ActiveSegment].Branches;
+	const float Length = this->Active->GetSplineComponent()->GetSplineLength();
+	const FVector Location = this->Active->GetLocationAtDistance(Length);
+	const FQuat Rotation = this->Active->GetRotationAtDistance(Length).Quaternion();
+
+	this->BranchHandlers.SetNumZeroed(Branches.Num());
+	for (int32 i = 0; i < Branches.Num(); ++i)
+	{
+		if (this->ChosenBranch == INDEX_NONE || this->ChosenBranch == i)
+		{
+			this->BranchHandlers[i] = this->AcquireHandler(Branches[i], Location, Rotation);
+		}
+	}
+
+	// With no branch to go on to, the track ends here after all.
+	if (!this->BranchHandlers.ContainsByPredicate([](const ARingHandler *Handler) { return Handler != nullptr; }))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("No branch of track graph segment %d could be loaded."), this->ActiveSegment);
+		this->Active->SetTrackContinues(false);
+	}
+}
+
+void ARingTrackGraph::ReleaseAll()
+{
+	for (ARingHandler *Handler : this->BranchHandlers)
+	{
+		this->ReleaseHandler(Handler);
+	}
+	this->BranchHandlers.Reset();
+	this->ReleaseHandler(this->Trailing);
+	this->ReleaseHandler(this->Active);
+	this->Trailing = nullptr;
+	this->Active = nullptr;
+	this->ActiveSegment = INDEX_NONE;
+	this->ChosenBranch = INDEX_NONE;
+}
+
+void ARingTrackGraph::HandleBeatRingFail(int32 RingIndex)
+{
+	this->OnBeatRingFail.Broadcast(RingIndex);
+}
+
+void ARingTrackGraph::HandleBeatRingSuccess(int32 RingIndex)
+{
+	this->OnBeatRingSuccess.Broadcast(RingIndex);
+}
@@ -0,0 +1,129 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RingHandler.h"
+#include "GameFramework/Actor.h"
+#include "RingTrackGraph.generated.h"
+
+class UTrackData;
+
+/** One spline segment of a track graph, and the segments its end branches into. */
+USTRUCT(BlueprintType)
+struct FRingTrackSegment
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UTrackData *Track = nullptr;
+
+	// Indices into the graph's segments, from left to right. Empty ends the track.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<int32> Branches;
+};
+
+/**
+ * Track made of segments joined at junctions, the player choosing a branch at each. Segments are played by ring
+ * handlers the graph spawns and pools: only the segment being played, the one just left and the branches of the
+ * next junction once it is within the fade distance hold a handler, and untaken branches are released as soon as
+ * the choice is made. The start segment is placed at the graph, every other one at the end of the segment before.
+ * Every handler follows the active one, which governs ring quality for all of them.
+ */
+UCLASS()
+class CATNIP_API ARingTrackGraph : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ARingTrackGraph();
+
+	// Loads the first segment. Returns its handler, or nullptr if the graph has no playable start.
+	ARingHandler *StartGraph();
+
+	// Releases every branch taken and loads the first segment again.
+	ARingHandler *ResetGraph();
+
+	// Loads the branches once the junction is in reach, and moves on to the chosen one once the pawn is past it.
+	// Returns the length of the segment left behind, 0 if still on the same one. Distances are along the active segment.
+	float AdvanceGraph(float SplineDistance);
+
+	// Updates the rings of the branches ahead, the pawn being SplineDistance along the active segment. The active
+	// handler is updated by the game mode.
+	void UpdateBranches(float SplineDistance);
+
+	// Takes Branch at the next junction and releases the others. The choice holds until the junction is passed.
+	bool ChooseBranch(int32 Branch);
+
+	// Applied to every handler, including those spawned later.
+	void SetRewindDistance(float Distance);
+
+	int32 GetNumBranches() const;
+
+	FORCEINLINE ARingHandler *GetActiveHandler() const
+	{
+		return this->Active;
+	}
+
+	FORCEINLINE int32 GetActiveSegment() const
+	{
+		return this->ActiveSegment;
+	}
+
+private:
+	// Takes a pooled handler when there is one, and loads the segment into it with its start at Location.
+	ARingHandler *AcquireHandler(int32 Segment, const FVector &Location, const FQuat &Rotation);
+
+	void ReleaseHandler(ARingHandler *Handler);
+
+	// Loads the branches of the active segment at its end. Only the chosen one once there is a choice.
+	void AcquireBranches();
+
+	void ReleaseAll();
+
+	UFUNCTION()
+	void HandleBeatRingFail(int32 RingIndex);
+
+	UFUNCTION()
+	void HandleBeatRingSuccess(int32 RingIndex);
+
+protected:
+	// The first one starts the track.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Track Graph")
+	TArray<FRingTrackSegment> Segments;
+
+	// Spawned to play the segments. Its ring settings apply to all of them.
+	UPROPERTY(EditAnywhere, Category = "Track Graph")
+	TSubclassOf<ARingHandler> HandlerClass;
+
+public:
+	/// EVENTS ///
+
+	// Forwarded from whichever handler plays the segment.
+	UPROPERTY(BlueprintAssignable, Category = "Rings")
+	FOnBeatRingFail OnBeatRingFail;
+
+	UPROPERTY(BlueprintAssignable, Category = "Rings")
+	FOnBeatRingSuccess OnBeatRingSuccess;
+
+private:
+	UPROPERTY(Transient)
+	ARingHandler *Active;
+
+	// Segment just left, kept until its rings are behind the camera.
+	UPROPERTY(Transient)
+	ARingHandler *Trailing;
+
+	// One per branch of the active segment, nullptr until in reach or once not taken.
+	UPROPERTY(Transient)
+	TArray<ARingHandler*> BranchHandlers;
+
+	// Released handlers, their rings, rules and spline dropped.
+	UPROPERTY(Transient)
+	TArray<ARingHandler*> HandlerPool;
+
+	int32 ActiveSegment;
+	int32 ChosenBranch;
+	float RewindDistance;
+};
@@ -0,0 +1,202 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SplineBenchCommandlet.h"
+
+#include "RingHandler.h"
+#include "Misc/FileHelper.h"
+#include "RingCommandletWorld.h"
+#include "Components/SplineComponent.h"
+
+namespace
+{
+	// Queries timed together. Short enough for percentiles to mean something, long enough to dwarf the timer.
+	constexpr int32 BatchSize = 64;
+
+	// Rail speed and frame time the monotonic pattern steps with.
+	constexpr float RailSpeed = 3000.0f;
+	constexpr float FrameTime = 1.0f / 60.0f;
+
+	struct FBenchResult
+	{
+		FString Query;
+		FString Pattern;
+		double MeanNs = 0.0;
+		double P50Ns = 0.0;
+		double P90Ns = 0.0;
+		double P99Ns = 0.0;
+		double MaxNs = 0.0;
+	};
+
+	TArray<FVector> MakeTrack(FRandomStream &Stream, int32 NumPoints, float SegmentLength)
+	{
+		TArray<FVector> Points;
+		Points.Reserve(NumPoints);
+		FVector Location = FVector::ZeroVector;
+		FRotator Heading = FRotator::ZeroRotator;
+		for (int32 i = 0; i < NumPoints; ++i)
+		{
+			Points.Add(Location);
+			Heading.Yaw += Stream.FRandRange(-20.0f, 20.0f);
+			Heading.Pitch = FMath::Clamp(Heading.Pitch + Stream.FRandRange(-10.0f, 10.0f), -30.0f, 30.0f);
+			Location += Heading.Vector() * SegmentLength;
+		}
+		return Points;
+	}
+
+	// Values in [0, Max). Monotonic steps forward by Step and wraps, random draws uniformly.
+	TArray<float> MakePattern(FRandomStream &Stream, int32 Num, float Max, float Step, bool bMonotonic)
+	{
+		TArray<float> Values;
+		Values.Reserve(Num);
+		float Value = 0.0f;
+		for (int32 i = 0; i < Num; ++i)
+		{
+			Values.Add(bMonotonic ? Value : Stream.FRandRange(0.0f, Max));
+			Value = FMath::Fmod(Value + Step, Max);
+		}
+		return Values;
+	}
+
+	template<typename QueryType>
+	FBenchResult TimeQuery(const TCHAR *Query, const TCHAR *Pattern, int32 NumQueries, QueryType Run)
+	{
+		// Warm up caches before timing.
+		for (int32 i = 0; i < FMath::Min(NumQueries, BatchSize * 4); ++i)
+		{
+			Run(i);
+		}
+
+		TArray<double> Batches;
+		Batches.Reserve(NumQueries / BatchSize + 1);
+		double Total = 0.0;
+		for (int32 First = 0; First < NumQueries; First += BatchSize)
+		{
+			const int32 Last = FMath::Min(First + BatchSize, NumQueries);
+			const uint64 Start = FPlatformTime::Cycles64();
+			for (int32 i = First; i < Last; ++i)
+			{
+				Run(i);
+			}
+			const double Seconds = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - Start);
+			Total += Seconds;
+			Batches.Add(Seconds * 1.0e9 / (Last - First));
+		}
+		Batches.Sort();
+
+		auto Percentile = [&](double Fraction)
+		{
+			return Batches[FMath::Clamp(FMath::CeilToInt(Fraction * Batches.Num()) - 1, 0, Batches.Num() - 1)];
+		};
+		FBenchResult Result;
+		Result.Query = Query;
+		Result.Pattern = Pattern;
+		Result.MeanNs = Total * 1.0e9 / NumQueries;
+		Result.P50Ns = Percentile(0.5);
+		Result.P90Ns = Percentile(0.9);
+		Result.P99Ns = Percentile(0.99);
+		Result.MaxNs = Batches.Last();
+		return Result;
+	}
+}
+
+USplineBenchCommandlet::USplineBenchCommandlet()
+{
+	UCommandlet::IsClient = false;
+	UCommandlet::IsEditor = true;
+	UCommandlet::IsServer = false;
+	UCommandlet::LogToConsole = true;
+}
+
+int32 USplineBenchCommandlet::Main(const FString &Params)
+{
+#if WITH_EDITOR
+	FString PointsList = TEXT("100,1000,10000");
+	int32 NumQueries = 100000, Seed = 0;
+	FString CsvFile;
+	FParse::Value(*Params, TEXT("Points="), PointsList, false);
+	FParse::Value(*Params, TEXT("Queries="), NumQueries);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("Csv="), CsvFile);
+	NumQueries = FMath::Max(NumQueries, BatchSize);
+
+	TArray<FString> PointCounts;
+	PointsList.ParseIntoArray(PointCounts, TEXT(","));
+
+	FRingCommandletWorld Fixture;
+	if (!Fixture.IsValid())
+	{
+		return 1;
+	}
+	ARingHandler *Handler = Fixture.GetHandler();
+	USplineComponent *Spline = Handler->GetSplineComponent();
+
+	FString Csv = TEXT("Points,Query,Pattern,MeanNs,P50Ns,P90Ns,P99Ns,MaxNs\n");
+	float Sink = 0.0f;
+	for (const FString &Count : PointCounts)
+	{
+		const int32 NumPoints = FMath::Clamp(FCString::Atoi(*Count), 2, 100000);
+		FRandomStream Stream(Seed + NumPoints);
+		Handler->SetGeneratedTrack(MakeTrack(Stream, NumPoints, 2000.0f), TArray<FRingSpawnRuleEntry>(), FRingBeatChart(), Seed);
+
+		const float Length = Spline->GetSplineLength();
+		const float MaxKey = float(Spline->GetNumberOfSplinePoints() - 1);
+		const float DistanceStep = RailSpeed * FrameTime;
+		const float KeyStep = DistanceStep * MaxKey / Length;
+
+		TArray<FBenchResult> Results;
+		for (bool bMonotonic : { true, false })
+		{
+			const TCHAR *Pattern = bMonotonic ? TEXT("monotonic") : TEXT("random");
+			TArray<float> Distances = MakePattern(Stream, NumQueries, Length, DistanceStep, bMonotonic);
+			TArray<float> Keys = MakePattern(Stream, NumQueries, MaxKey, KeyStep, bMonotonic);
+
+			// Closest point queries start near the track, about where the pawn and camera are.
+			TArray<FVector> Locations, Offsets;
+			Locations.Reserve(NumQueries);
+			Offsets.Reserve(NumQueries);
+			for (float Distance : Distances)
+			{
+				FVector OnTrack = Spline->GetLocationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World);
+				Locations.Add(OnTrack + Stream.VRand() * Stream.FRandRange(0.0f, 600.0f));
+				Offsets.Add(FVector(0.0f, Stream.FRandRange(-800.0f, 800.0f), Stream.FRandRange(-800.0f, 800.0f)));
+			}
+
+			Results.Add(TimeQuery(TEXT("GetDistanceAtInputKey"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Handler->GetDistanceAtInputKey(Keys[i]); }));
+			Results.Add(TimeQuery(TEXT("GetLocationAtDistance"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Handler->GetLocationAtDistance(Distances[i]).X; }));
+			Results.Add(TimeQuery(TEXT("GetRotationAtDistance"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Handler->GetRotationAtDistance(Distances[i]).Yaw; }));
+			Results.Add(TimeQuery(TEXT("FindLocationClosestTo"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Handler->FindLocationClosestTo(Locations[i]).X; }));
+			Results.Add(TimeQuery(TEXT("RestrictPositionOffset"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Handler->RestrictPositionOffset(Distances[i], Offsets[i]).Y; }));
+			Results.Add(TimeQuery(TEXT("FindInputKeyClosestToWorldLocation"), Pattern, NumQueries,
+				[&](int32 i) { Sink += Spline->FindInputKeyClosestToWorldLocation(Locations[i]); }));
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("Spline bench, %d points over %.0f units, %d queries each:"), NumPoints, Length, NumQueries);
+		UE_LOG(LogTemp, Display, TEXT("  %-36s %-9s %10s %10s %10s %10s %10s"),
+			TEXT("query"), TEXT("pattern"), TEXT("mean ns"), TEXT("p50"), TEXT("p90"), TEXT("p99"), TEXT("max"));
+		for (const FBenchResult &Result : Results)
+		{
+			UE_LOG(LogTemp, Display, TEXT("  %-36s %-9s %10.1f %10.1f %10.1f %10.1f %10.1f"), *Result.Query, *Result.Pattern,
+				Result.MeanNs, Result.P50Ns, Result.P90Ns, Result.P99Ns, Result.MaxNs);
+			Csv += FString::Printf(TEXT("%d,%s,%s,%.1f,%.1f,%.1f,%.1f,%.1f\n"), NumPoints, *Result.Query, *Result.Pattern,
+				Result.MeanNs, Result.P50Ns, Result.P90Ns, Result.P99Ns, Result.MaxNs);
+		}
+	}
+	// Keeps the queries from being optimised away.
+	UE_LOG(LogTemp, Verbose, TEXT("Spline bench checksum %f."), Sink);
+
+	if (!CsvFile.IsEmpty() && !FFileHelper::SaveStringToFile(Csv, *CsvFile))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Spline bench: could not write %s."), *CsvFile);
+		return 1;
+	}
+	return 0;
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "SplineBenchCommandlet.generated.h"
+
+/**
+ * Times the ring handler's spline queries on generated tracks, away from the rest of a run.
+ *
+ * UE4Editor-Cmd Catnip.uproject -run=SplineBench [-Points=100,1000,10000] [-Queries=100000] [-Seed=0] [-Csv=<File>]
+ *
+ * Every query runs in a monotonic pattern (small steps along the track, like the rail at 60 fps) and a random one.
+ * Queries are timed in batches. Results give the mean ns/op and percentiles of the per-batch ns/op.
+ */
+UCLASS()
+class CATNIP_API USplineBenchCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	USplineBenchCommandlet();
+
+	virtual int32 Main(const FString &Params) override;
+};
@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "StressTrackCommandlet.h"
+
+#include "RingHandler.h"
+#include "Engine/World.h"
+#include "RingCommandletWorld.h"
+#include "Engine/StaticMesh.h"
+#include "Misc/PackageName.h"
+#include "Engine/DirectionalLight.h"
+#include "GameFramework/PlayerStart.h"
+#include "Materials/MaterialInterface.h"
+
+namespace
+{
+	constexpr int32 MaxPoints = 100000;
+	constexpr int32 MaxBeats = 50000;
+
+	// Beat charts start after this many rings so the pawn has time to settle.
+	constexpr int32 FirstBeatRing = 10;
+
+	const TCHAR *RingMeshPaths[] = {
+		TEXT("/Game/Meshes/ring_1.ring_1"), TEXT("/Game/Meshes/ring_2.ring_2"), TEXT("/Game/Meshes/dodeca.dodeca"),
+		TEXT("/Game/Meshes/cat_toy.cat_toy"), TEXT("/Game/Meshes/fish_high.fish_high"), TEXT("/Game/Meshes/mouse_mesh.mouse_mesh")
+	};
+	const TCHAR *ObstacleMeshPaths[] = {
+		TEXT("/Game/Meshes/Barrier_1.Barrier_1"), TEXT("/Game/Meshes/Barrier_2.Barrier_2"), TEXT("/Game/Meshes/Barrier_3.Barrier_3"),
+		TEXT("/Game/Meshes/Barrier_4.Barrier_4"), TEXT("/Game/Meshes/Barrier_5.Barrier_5")
+	};
+	const TCHAR *RingMaterialPaths[] = {
+		TEXT("/Game/Material/RingObjectsMaterial_Inst.RingObjectsMaterial_Inst"), TEXT("/Game/Material/RingObjectsBlue.RingObjectsBlue"),
+		TEXT("/Game/Material/RingObjectsPink.RingObjectsPink")
+	};
+	const TCHAR *ObstacleMaterialPath = TEXT("/Game/Material/ObstacleMaterial.ObstacleMaterial");
+
+	template<typename T, int32 Num>
+	TArray<T*> LoadAll(const TCHAR *(&Paths)[Num])
+	{
+		TArray<T*> Result;
+		for (const TCHAR *Path : Paths)
+		{
+			if (T *Asset = LoadObject<T>(nullptr, Path))
+			{
+				Result.Add(Asset);
+			}
+			else
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Stress track: could not load %s."), Path);
+			}
+		}
+		return Result;
+	}
+
+	FColor RandomColor(FRandomStream &Stream)
+	{
+		return FLinearColor::MakeFromHSV8(uint8(Stream.RandRange(0, 255)), 255, 255).ToFColor(true);
+	}
+
+	template<typename T>
+	T *PickAny(FRandomStream &Stream, const TArray<T*> &Array)
+	{
+		return Array.Num() > 0 ? Array[Stream.RandRange(0, Array.Num() - 1)] : nullptr;
+	}
+}
+
+UStressTrackCommandlet::UStressTrackCommandlet()
+{
+	UCommandlet::IsClient = false;
+	UCommandlet::IsEditor = true;
+	UCommandlet::IsServer = false;
+	UCommandlet::LogToConsole = true;
+}
+
+int32 UStressTrackCommandlet::Main(const FString &Params)
+{
+#if WITH_EDITOR
+	int32 NumPoints = 1000, NumRules = 500, NumBeats = 1000, Seed = 0;
+	float Length = 1000000.0f;
+	FParse::Value(*Params, TEXT("Points="), NumPoints);
+	FParse::Value(*Params, TEXT("Rules="), NumRules);
+	FParse::Value(*Params, TEXT("Beats="), NumBeats);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("Length="), Length);
+
+	NumPoints = FMath::Clamp(NumPoints, 2, MaxPoints);
+	NumBeats = FMath::Clamp(NumBeats, 0, MaxBeats);
+	NumRules = FMath::Max(NumRules, 0);
+
+	FString PackageName = FString::Printf(TEXT("/Game/Maps/Test/StressTrack_%d_%d"), NumPoints, NumBeats);
+	FParse::Value(*Params, TEXT("Map="), PackageName);
+	if (!FPackageName::IsValidLongPackageName(PackageName))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Stress track: %s is not a valid package name."), *PackageName);
+		return 1;
+	}
+
+	UPackage *Package = CreatePackage(nullptr, *PackageName);
+	FRingCommandletWorld Fixture(Package);
+	if (!Fixture.IsValid())
+	{
+		return 1;
+	}
+	UWorld *World = Fixture.GetWorld();
+	ARingHandler *Handler = Fixture.GetHandler();
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	World->SpawnActor<APlayerStart>(FVector::ZeroVector, FRotator::ZeroRotator, SpawnParameters);
+	World->SpawnActor<ADirectionalLight>(FVector(0.0f, 0.0f, 1000.0f), FRotator(-45.0f, 0.0f, 0.0f), SpawnParameters);
+
+	// Every beat needs a free ring either side.
+	const float RingDistance = Handler->GetRingDistance();
+	Length = FMath::Max(Length, (FirstBeatRing + NumBeats * 2 + 2) * RingDistance);
+	const int32 NumRings = FMath::FloorToInt(Length / RingDistance);
+
+	FRandomStream Stream(Seed);
+
+	// Random walk with gentle turns so rings never intersect.
+	TArray<FVector> Points;
+	Points.Reserve(NumPoints);
+	{
+		const float SegmentLength = Length / (NumPoints - 1);
+		FVector Location = FVector::ZeroVector;
+		FRotator Heading = FRotator::ZeroRotator;
+		for (int32 i = 0; i < NumPoints; ++i)
+		{
+			Points.Add(Location);
+			Heading.Yaw += Stream.FRandRange(-20.0f, 20.0f);
+			Heading.Pitch = FMath::Clamp(Heading.Pitch + Stream.FRandRange(-10.0f, 10.0f), -30.0f, 30.0f);
+			Location += Heading.Vector() * SegmentLength;
+		}
+	}
+
+	TArray<UStaticMesh*> RingMeshes = LoadAll<UStaticMesh>(RingMeshPaths);
+	TArray<UStaticMesh*> ObstacleMeshes = LoadAll<UStaticMesh>(ObstacleMeshPaths);
+	TArray<UMaterialInterface*> RingMaterials = LoadAll<UMaterialInterface>(RingMaterialPaths);
+	UMaterialInterface *ObstacleMaterial = LoadObject<UMaterialInterface>(nullptr, ObstacleMaterialPath);
+
+	// Cycle through the rule types so every SpawnRule_Set* is used.
+	TArray<FRingSpawnRuleEntry> Rules;
+	Rules.Reserve(NumRules);
+	for (int32 i = 0; i < NumRules; ++i)
+	{
+		FRingSpawnRuleEntry Entry;
+		Entry.Type = ERingSpawnRuleType(i % (int32(ERingSpawnRuleType::Obstacle) + 1));
+		Entry.OnRing = Stream.RandRange(1, NumRings);
+		Entry.bSingleRing = Stream.RandRange(0, 3) == 0;
+		switch (Entry.Type)
+		{
+		case ERingSpawnRuleType::Radius:
+			Entry.Value = Stream.FRandRange(300.0f, 900.0f);
+			Entry.Count = Stream.RandRange(0, 10);
+			break;
+		case ERingSpawnRuleType::Mesh:
+			Entry.Mesh = PickAny(Stream, RingMeshes);
+			Entry.Material = PickAny(Stream, RingMaterials);
+			Entry.MeshType = Stream.RandRange(0, 1) == 0 ? ERingMeshType::SingleMesh : ERingMeshType::MultipleMesh;
+			break;
+		case ERingSpawnRuleType::Offset:
+			Entry.Value = Stream.FRandRange(0.0f, PI * 2.0f);
+			Entry.OffsetType = ERingOffsetType(Stream.RandRange(0, 2));
+			break;
+		case ERingSpawnRuleType::Rotation:
+			Entry.Value = Stream.FRandRange(-60.0f, -10.0f);
+			Entry.ValueMax = Stream.FRandRange(10.0f, 60.0f);
+			Entry.ForceRerollMin = Stream.RandRange(0, 1) == 0 ? -1.0f : Stream.FRandRange(0.0f, 10.0f);
+			break;
+		case ERingSpawnRuleType::Color:
+			Entry.Color = RandomColor(Stream);
+			break;
+		case ERingSpawnRuleType::Resolution:
+			Entry.Count = Stream.RandRange(4, 32);
+			break;
+		case ERingSpawnRuleType::Obstacle:
+			Entry.Mesh = PickAny(Stream, ObstacleMeshes);
+			Entry.Material = ObstacleMaterial;
+			break;
+		default:
+			break;
+		}
+		if ((Entry.Type == ERingSpawnRuleType::Mesh || Entry.Type == ERingSpawnRuleType::Obstacle) && Entry.Mesh == nullptr)
+		{
+			continue;
+		}
+		Rules.Add(Entry);
+	}
+	Rules.StableSort([](const FRingSpawnRuleEntry &A, const FRingSpawnRuleEntry &B) { return A.OnRing < B.OnRing; });
+
+	// Spread beats evenly with jitter, keeping at least one plain ring between any two.
+	FRingBeatChart Chart;
+	if (NumBeats > 0)
+	{
+		const int32 Spacing = FMath::Max((NumRings - FirstBeatRing) / NumBeats, 2);
+		TArray<FString> BeatRings;
+		BeatRings.Reserve(NumBeats);
+		for (int32 i = 0; i < NumBeats; ++i)
+		{
+			BeatRings.Add(FString::FromInt(FirstBeatRing + i * Spacing + Stream.RandRange(0, Spacing - 2)));
+		}
+		Chart.Rings = FString::Join(BeatRings, TEXT(","));
+		Chart.Meshes = RingMeshes;
+		Chart.MaterialInterface = PickAny(Stream, RingMaterials);
+		Chart.Color = RandomColor(Stream);
+		Chart.ObstacleMeshes = ObstacleMeshes;
+		Chart.ObstacleMaterialInterface = ObstacleMaterial;
+	}
+
+	Handler->SetGeneratedTrack(Points, Rules, Chart, Seed);
+
+	FString FileName = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetMapPackageExtension());
+	bool bSaved = UPackage::SavePackage(Package, World, RF_NoFlags, *FileName, GError, nullptr, false, true, SAVE_NoError);
+	if (!bSaved)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Stress track: could not save %s."), *FileName);
+		return 1;
+	}
+	UE_LOG(LogTemp, Display, TEXT("Stress track saved to %s: %d points over %.0f units, %d rings, %d rules, %d beats."),
+		*PackageName, NumPoints, Length, NumRings, Rules.Num(), NumBeats);
+	return 0;
+#else
+	return 1;
+#endif
+}
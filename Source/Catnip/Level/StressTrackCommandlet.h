@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "StressTrackCommandlet.generated.h"
+
+/**
+ * Generates a test map holding a single ring handler with a random spline, spawn rule table and beat chart.
+ *
+ * UE4Editor-Cmd Catnip.uproject -run=StressTrack [-Points=1000] [-Length=1000000] [-Rules=500] [-Beats=1000] [-Seed=0]
+ *     [-Map=/Game/Maps/Test/StressTrack_<Points>_<Beats>]
+ *
+ * Points is capped at 100000 and Beats at 50000. The track is lengthened when needed to fit every beat.
+ */
+UCLASS()
+class CATNIP_API UStressTrackCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UStressTrackCommandlet();
+
+	virtual int32 Main(const FString &Params) override;
+};
@@ -0,0 +1,204 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TrackData.h"
+
+#include "Serialization/CustomVersion.h"
+#include "Components/SplineComponent.h"
+
+// Layout of the bulk arrays. Add an entry whenever the packed layout changes.
+struct FTrackDataVersion
+{
+	enum Type
+	{
+		// An int32 version of 1 came first, followed by points whose padding may not be zero.
+		BeforeCustomVersionWasAdded = 0,
+		// Registered as a custom version. Point padding is zeroed.
+		CustomVersionAdded,
+
+		VersionPlusOne,
+		LatestVersion = VersionPlusOne - 1
+	};
+
+	static const FGuid GUID;
+};
+
+const FGuid FTrackDataVersion::GUID(0x6A1C3E52, 0x4F2B47D8, 0x9E0A5B31, 0xC7D48F16);
+static FCustomVersionRegistration GRegisterTrackDataVersion(FTrackDataVersion::GUID, FTrackDataVersion::LatestVersion, TEXT("TrackData"));
+
+namespace
+{
+	constexpr float PositionScale = 8.0f;
+	constexpr float RotationScale = 32767.0f;
+
+	// The only layout written before the custom version.
+	constexpr int32 LegacyTrackDataVersion = 1;
+
+	void PackVector(const FVector &Vector, int32 (&Out)[3])
+	{
+		for (int32 i = 0; i < 3; ++i)
+		{
+			Out[i] = int32(FMath::Clamp<double>(FMath::RoundToDouble(double(Vector[i]) * PositionScale), MIN_int32, MAX_int32));
+		}
+	}
+
+	FVector UnpackVector(const int32 (&In)[3])
+	{
+		return FVector(In[0], In[1], In[2]) / PositionScale;
+	}
+}
+
+FArchive &operator<<(FArchive &Ar, FTrackPointPacked &Point)
+{
+	for (int32 i = 0; i < 3; ++i)
+	{
+		Ar << Point.Position[i] << Point.ArriveTangent[i] << Point.LeaveTangent[i];
+	}
+	for (int16 &Next : Point.Rotation)
+	{
+		Ar << Next;
+	}
+	Ar << Point.InterpMode;
+	for (uint8 &Next : Point.Padding)
+	{
+		Ar << Next;
+	}
+	return Ar;
+}
+
+FArchive &operator<<(FArchive &Ar, FTrackReparamPoint &Point)
+{
+	Ar << Point.Distance << Point.InputKey;
+	return Ar;
+}
+
+UTrackData::UTrackData()
+{
+	this->Origin = FVector::ZeroVector;
+	this->Length = 0.0f;
+	this->ReparamStepsPerSegment = 10;
+	this->RingDistance = 500.0f;
+	this->TrackSeed = 0;
+}
+
+void UTrackData::Serialize(FArchive &Ar)
+{
+	Super::Serialize(Ar);
+	Ar.UsingCustomVersion(FTrackDataVersion::GUID);
+
+	const int32 Version = Ar.CustomVer(FTrackDataVersion::GUID);
+	if (Ar.IsLoading() && Version < FTrackDataVersion::CustomVersionAdded)
+	{
+		int32 LegacyVersion = 0;
+		Ar << LegacyVersion;
+		if (LegacyVersion != LegacyTrackDataVersion)
+		{
+			// Still read, so the rest of the archive lines up.
+			TArray<FTrackPointPacked> LegacyPoints;
+			TArray<FTrackReparamPoint> LegacyReparam;
+			LegacyPoints.BulkSerialize(Ar);
+			LegacyReparam.BulkSerialize(Ar);
+			this->Points.Empty();
+			this->Reparam.Empty();
+			UE_LOG(LogTemp, Warning, TEXT("%s was saved with track data version %d, which can't be read. Export it again."),
+				*UObject::GetPathName(), LegacyVersion);
+			return;
+		}
+	}
+
+	// Both arrays are plain memory, read in one go.
+	this->Points.BulkSerialize(Ar);
+	this->Reparam.BulkSerialize(Ar);
+
+	// Same layout as now, but whatever was in the padding came along.
+	if (Ar.IsLoading() && Version < FTrackDataVersion::CustomVersionAdded)
+	{
+		for (FTrackPointPacked &Point : this->Points)
+		{
+			FMemory::Memzero(Point.Padding);
+		}
+	}
+}
+
+void UTrackData::ApplyToSpline(USplineComponent *Spline) const
+{
+	check(Spline != nullptr);
+	FSplineCurves &Curves = Spline->SplineCurves;
+	const int32 Num = this->Points.Num();
+
+	Curves.Position.Points.SetNumUninitialized(Num);
+	Curves.Rotation.Points.SetNumUninitialized(Num);
+	Curves.Scale.Points.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const FTrackPointPacked &Point = this->Points[i];
+		const EInterpCurveMode Mode = EInterpCurveMode(Point.InterpMode);
+		const FQuat Rotation = FQuat(Point.Rotation[0], Point.Rotation[1], Point.Rotation[2], Point.Rotation[3]).GetNormalized();
+
+		Curves.Position.Points[i] = FInterpCurvePointVector(float(i), this->Origin + UnpackVector(Point.Position),
+			UnpackVector(Point.ArriveTangent), UnpackVector(Point.LeaveTangent), Mode);
+		Curves.Rotation.Points[i] = FInterpCurvePointQuat(float(i), Rotation, FQuat::Identity, FQuat::Identity, CIM_CurveAuto);
+		Curves.Scale.Points[i] = FInterpCurvePointVector(float(i), FVector::OneVector, FVector::ZeroVector, FVector::ZeroVector, CIM_CurveAuto);
+	}
+	Curves.Position.bIsLooped = Curves.Rotation.bIsLooped = Curves.Scale.bIsLooped = false;
+	Curves.Rotation.AutoSetTangents(0.0f, false);
+
+	// The reparam table is what UpdateSpline spends its time on. Copy it instead.
+	TArray<FInterpCurvePointFloat> &Table = Curves.ReparamTable.Points;
+	Table.SetNumUninitialized(this->Reparam.Num());
+	for (int32 i = 0; i < this->Reparam.Num(); ++i)
+	{
+		Table[i] = FInterpCurvePointFloat(this->Reparam[i].Distance, this->Reparam[i].InputKey, 0.0f, 0.0f, CIM_Linear);
+	}
+	++Curves.Version;
+
+	Spline->ReparamStepsPerSegment = this->ReparamStepsPerSegment;
+	Spline->bSplineHasBeenEdited = true;
+	Spline->MarkRenderStateDirty();
+}
+
+#if WITH_EDITOR
+void UTrackData::SetTrack(const USplineComponent *Spline, float InRingDistance, int32 InTrackSeed,
+	const TArray<FRingSpawnRuleEntry> &InSpawnRuleTable, const FRingBeatChart &InBeatChart)
+{
+	check(Spline != nullptr);
+	UObject::Modify();
+
+	const FSplineCurves &Curves = Spline->SplineCurves;
+	const int32 Num = Curves.Position.Points.Num();
+	this->Origin = Num > 0 ? Curves.Position.Points[0].OutVal : FVector::ZeroVector;
+
+	this->Points.SetNumZeroed(Num);
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const FInterpCurvePointVector &Position = Curves.Position.Points[i];
+		const FQuat Rotation = Curves.Rotation.Points.IsValidIndex(i) ? Curves.Rotation.Points[i].OutVal.GetNormalized() : FQuat::Identity;
+
+		FTrackPointPacked &Point = this->Points[i];
+		PackVector(Position.OutVal - this->Origin, Point.Position);
+		PackVector(Position.ArriveTangent, Point.ArriveTangent);
+		PackVector(Position.LeaveTangent, Point.LeaveTangent);
+		Point.Rotation[0] = int16(FMath::RoundToInt(Rotation.X * RotationScale));
+		Point.Rotation[1] = int16(FMath::RoundToInt(Rotation.Y * RotationScale));
+		Point.Rotation[2] = int16(FMath::RoundToInt(Rotation.Z * RotationScale));
+		Point.Rotation[3] = int16(FMath::RoundToInt(Rotation.W * RotationScale));
+		Point.InterpMode = uint8(Position.InterpMode.GetValue());
+	}
+
+	const TArray<FInterpCurvePointFloat> &Table = Curves.ReparamTable.Points;
+	this->Reparam.SetNumUninitialized(Table.Num());
+	for (int32 i = 0; i < Table.Num(); ++i)
+	{
+		this->Reparam[i].Distance = Table[i].InVal;
+		this->Reparam[i].InputKey = Table[i].OutVal;
+	}
+
+	this->Length = Spline->GetSplineLength();
+	this->ReparamStepsPerSegment = Spline->ReparamStepsPerSegment;
+	this->RingDistance = InRingDistance;
+	this->TrackSeed = InTrackSeed;
+	this->SpawnRuleTable = InSpawnRuleTable;
+	this->BeatChart = InBeatChart;
+	UObject::MarkPackageDirty();
+}
+#endif
@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RingHandler.h"
+#include "Engine/DataAsset.h"
+#include "TrackData.generated.h"
+
+class USplineComponent;
+
+/** Spline point stored relative to the first point, in 1/8 units. Rotation is a quaternion scaled to int16. */
+struct FTrackPointPacked
+{
+	int32 Position[3];
+	int32 ArriveTangent[3];
+	int32 LeaveTangent[3];
+	int16 Rotation[4];
+	uint8 InterpMode;
+	// Always zero. Spelled out so the bulk serialized bytes don't include uninitialized ones.
+	uint8 Padding[3];
+
+	friend FArchive &operator<<(FArchive &Ar, FTrackPointPacked &Point);
+};
+
+static_assert(sizeof(FTrackPointPacked) == 48, "FTrackPointPacked has implicit padding.");
+
+/** Entry of the spline's distance to input key table. */
+struct FTrackReparamPoint
+{
+	float Distance;
+	float InputKey;
+
+	friend FArchive &operator<<(FArchive &Ar, FTrackReparamPoint &Point);
+};
+
+template<> struct TCanBulkSerialize<FTrackPointPacked> { enum { Value = true }; };
+template<> struct TCanBulkSerialize<FTrackReparamPoint> { enum { Value = true }; };
+
+/**
+ * A ring handler track: quantised spline points, the spline's precomputed reparam table, and the rings' rule table and beat chart.
+ * Points and the table are bulk serialized and copied straight into the spline curves on load, without rebuilding the spline,
+ * so long tracks load in milliseconds and can be swapped during play (see ADefaultGameMode::LoadTrack).
+ * Exported from a ring handler in the editor with ARingHandler::bDebugExportTrack.
+ */
+UCLASS(BlueprintType)
+class CATNIP_API UTrackData : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	UTrackData();
+
+	virtual void Serialize(FArchive &Ar) override;
+
+	// Replaces the curves of the spline. Points are in component space, as they were exported.
+	void ApplyToSpline(USplineComponent *Spline) const;
+
+#if WITH_EDITOR
+	void SetTrack(const USplineComponent *Spline, float InRingDistance, int32 InTrackSeed,
+		const TArray<FRingSpawnRuleEntry> &InSpawnRuleTable, const FRingBeatChart &InBeatChart);
+#endif
+
+	FORCEINLINE bool HasTrack() const
+	{
+		return this->Points.Num() >= 2 && this->Reparam.Num() > 0;
+	}
+
+	FORCEINLINE int32 GetNumPoints() const
+	{
+		return this->Points.Num();
+	}
+
+	FORCEINLINE float GetRingDistance() const
+	{
+		return this->RingDistance;
+	}
+
+	FORCEINLINE int32 GetTrackSeed() const
+	{
+		return this->TrackSeed;
+	}
+
+	FORCEINLINE const TArray<FRingSpawnRuleEntry> &GetSpawnRuleTable() const
+	{
+		return this->SpawnRuleTable;
+	}
+
+	FORCEINLINE const FRingBeatChart &GetBeatChart() const
+	{
+		return this->BeatChart;
+	}
+
+protected:
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	FVector Origin;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	float Length;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	int32 ReparamStepsPerSegment;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	float RingDistance;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	int32 TrackSeed;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	TArray<FRingSpawnRuleEntry> SpawnRuleTable;
+
+	UPROPERTY(VisibleAnywhere, Category = "Track")
+	FRingBeatChart BeatChart;
+
+private:
+	TArray<FTrackPointPacked> Points;
+	TArray<FTrackReparamPoint> Reparam;
+};
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TrackManifest.h"
+
+void UTrackManifest::GetAssetsToLoad(TArray<FSoftObjectPath> &OutAssets) const
+{
+	OutAssets.Reserve(OutAssets.Num() + this->GetNumAssets());
+	for (const FSoftObjectPath &Next : this->GeneratedAssets)
+	{
+		if (Next.IsValid())
+		{
+			OutAssets.AddUnique(Next);
+		}
+	}
+	for (const FSoftObjectPath &Next : this->AdditionalAssets)
+	{
+		if (Next.IsValid())
+		{
+			OutAssets.AddUnique(Next);
+		}
+	}
+}
+
+#if WITH_EDITOR
+void UTrackManifest::SetGeneratedAssets(const TArray<FSoftObjectPath> &NewAssets)
+{
+	UObject::Modify();
+	this->GeneratedAssets = NewAssets;
+	this->GeneratedAssets.Sort([](const FSoftObjectPath &A, const FSoftObjectPath &B) { return A.ToString() < B.ToString(); });
+	UObject::MarkPackageDirty();
+}
+#endif
@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "TrackManifest.generated.h"
+
+/**
+ * List of every asset a track run needs. Generated in the editor from the ring handler
+ * (see ARingHandler::bDebugGenerateManifest) and preloaded in one batch before the run starts.
+ */
+UCLASS(BlueprintType)
+class CATNIP_API UTrackManifest : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	void GetAssetsToLoad(TArray<FSoftObjectPath> &OutAssets) const;
+
+#if WITH_EDITOR
+	void SetGeneratedAssets(const TArray<FSoftObjectPath> &NewAssets);
+#endif
+
+	FORCEINLINE int32 GetNumAssets() const
+	{
+		return this->GeneratedAssets.Num() + this->AdditionalAssets.Num();
+	}
+
+protected:
+	// Filled by the ring handler. The ring class, meshes and materials of the rule table and beat chart, and the game mode's pawn and sounds.
+	UPROPERTY(VisibleAnywhere, Category = "Manifest")
+	TArray<FSoftObjectPath> GeneratedAssets;
+
+	// Assets the handler can't discover on its own (sounds, Blueprint-only references).
+	UPROPERTY(EditAnywhere, Category = "Manifest", meta = (AllowedClasses = "SoundBase,StaticMesh,MaterialInterface,Blueprint"))
+	TArray<FSoftObjectPath> AdditionalAssets;
+};
@@ -3,6 +3,7 @@
 
 #include "CatCharacter.h"
 
+#include "Game/BeatTelemetry.h"
 #include "Game/DefaultGameMode.h"
 #include "Camera/CameraComponent.h"
 #include "GameFramework/Controller.h"
@@ -67,11 +68,28 @@ void ACatCharacter::Tick(float DeltaTime)
 
 void ACatCharacter::Action()
 {
+#if CATNIP_BEAT_TELEMETRY
+	FBeatTelemetry::Get().BeginAction();
+#endif
 	ADefaultGameMode *GameMode = Super::GetWorld()->GetAuthGameMode<ADefaultGameMode>();
 	check(GameMode != nullptr);
 	GameMode->RegisterAction();
 }
 
+void ACatCharacter::BranchLeft()
+{
+	ADefaultGameMode *GameMode = Super::GetWorld()->GetAuthGameMode<ADefaultGameMode>();
+	check(GameMode != nullptr);
+	GameMode->ChooseBranch(false);
+}
+
+void ACatCharacter::BranchRight()
+{
+	ADefaultGameMode *GameMode = Super::GetWorld()->GetAuthGameMode<ADefaultGameMode>();
+	check(GameMode != nullptr);
+	GameMode->ChooseBranch(true);
+}
+
 void ACatCharacter::MoveUp(float Value)
 {
 	float DeltaTime = Super::GetWorld()->GetDeltaSeconds();
@@ -104,4 +122,6 @@ void ACatCharacter::SetupPlayerInputComponent(UInputComponent *PlayerInputCompon
 	PlayerInputComponent->BindAxis(TEXT("MoveRight"), this, &ACatCharacter::MoveRight);
 
 	PlayerInputComponent->BindAction(TEXT("Action"), EInputEvent::IE_Pressed, this, &ACatCharacter::Action);
+	PlayerInputComponent->BindAction(TEXT("BranchLeft"), EInputEvent::IE_Pressed, this, &ACatCharacter::BranchLeft);
+	PlayerInputComponent->BindAction(TEXT("BranchRight"), EInputEvent::IE_Pressed, this, &ACatCharacter::BranchRight);
 }
@@ -25,6 +25,10 @@ public:
 
 	void Action();
 
+	// Picks the branch taken at the next junction of a track graph.
+	void BranchLeft();
+	void BranchRight();
+
 	void MoveUp(float Value);
 	void MoveRight(float Value);
 
@@ -33,6 +37,12 @@ public:
 		return this->Tilt;
 	}
 
+	// Used by ghosts, which have no input of their own.
+	FORCEINLINE void SetTilt(const FRotator &NewTilt)
+	{
+		this->Tilt = NewTilt;
+	}
+
 	FORCEINLINE FVector &GetPlayerOffsetRef()
 	{
 		return this->PlayerOffset;